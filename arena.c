@@ -0,0 +1,158 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   arena.c
+ * Desc:   Per-stream bump arena implementation
+ */
+
+#include "arena.h"
+
+/* Header of an arena block, the block's memory follows it */
+typedef struct fmp4_arena_block_t
+{
+    struct fmp4_arena_block_t *next;
+    size_t                     size;
+
+} __attribute__ ((aligned (FMP4_ARENA_ALIGNMENT))) fmp4_arena_block_t;
+
+static void *arena_default_alloc(size_t size, void *userdata);
+static void arena_default_free(void *ptr, size_t size, void *userdata);
+static fmp4_arena_block_t *arena_block(const fmp4_allocator_t *allocator,
+        size_t size);
+
+fmp4_arena_t *
+fmp4_arena_create(const fmp4_allocator_t *allocator,
+                  error_context_t        *errctx)
+{
+    const fmp4_allocator_t  defaults = { arena_default_alloc,
+                                         arena_default_free, NULL };
+    fmp4_arena_block_t     *block    = NULL;
+    fmp4_arena_t           *arena    = NULL;
+
+    /* Sanity checks */
+    if (!errctx || (allocator && (!allocator->alloc || !allocator->free)))
+        error_save_retval(errctx, EINVAL, NULL);
+    allocator = allocator ? allocator : &defaults;
+
+    /* Place the arena at the head of its first block */
+    block = arena_block(allocator, FMP4_ARENA_BLOCK_SIZE);
+    error_save_retval_if(!block, errctx, ENOMEM, NULL);
+    arena = (fmp4_arena_t *)(block + 1);
+    memset(arena, 0, sizeof(fmp4_arena_t));
+    arena->allocator = *allocator;
+    arena->blocks = block;
+    arena->cursor = (uint8_t *)(arena + 1);
+    arena->end = (uint8_t *)(block) + block->size;
+
+    return arena;
+}
+
+void *
+fmp4_arena_alloc(fmp4_arena_t    *arena,
+                 size_t           size,
+                 error_context_t *errctx)
+{
+    fmp4_arena_block_t *block = NULL;
+    uint8_t            *ptr   = NULL;
+    size_t              pad   = 0;
+
+    /* Sanity checks */
+    if (!size || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Without an arena the caller owns a heap allocation */
+    if (!arena)
+    {
+        ptr = (uint8_t *)(calloc(1, size));
+        error_save_retval_if(!ptr, errctx, ENOMEM, NULL);
+        return ptr;
+    }
+
+    /* Bump the cursor, chaining a new block when this one is exhausted */
+    pad = (FMP4_ARENA_ALIGNMENT - (uintptr_t)(arena->cursor) %
+            FMP4_ARENA_ALIGNMENT) % FMP4_ARENA_ALIGNMENT;
+    if (pad + size > (size_t)(arena->end - arena->cursor))
+    {
+        block = arena_block(&(arena->allocator),
+                MAX(FMP4_ARENA_BLOCK_SIZE, size + sizeof(fmp4_arena_block_t)));
+        error_save_retval_if(!block, errctx, ENOMEM, NULL);
+        block->next = (fmp4_arena_block_t *)(arena->blocks);
+        arena->blocks = block;
+        arena->cursor = (uint8_t *)(block + 1);
+        arena->end = (uint8_t *)(block) + block->size;
+        pad = 0;
+    }
+    ptr = arena->cursor + pad;
+    arena->cursor = ptr + size;
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+char *
+fmp4_arena_strndup(fmp4_arena_t    *arena,
+                   const char      *string,
+                   size_t           length,
+                   error_context_t *errctx)
+{
+    char *copy = NULL;
+
+    /* Sanity checks */
+    if (!string || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Copy up to length characters, always terminated */
+    length = strnlen(string, length);
+    copy = (char *)(fmp4_arena_alloc(arena, length + 1, errctx));
+    if (copy)
+        memcpy(copy, string, length);
+
+    return copy;
+}
+
+void fmp4_arena_destroy(fmp4_arena_t **arena)
+{
+    fmp4_allocator_t    allocator = {};
+    fmp4_arena_block_t *block     = NULL;
+    fmp4_arena_block_t *next      = NULL;
+
+    /* Sanity checks */
+    if (!arena || !*arena)
+        return;
+
+    /* Free every block, the first one holding the arena goes last */
+    allocator = (*arena)->allocator;
+    for (block = (fmp4_arena_block_t *)((*arena)->blocks); block; block = next)
+    {
+        next = block->next;
+        allocator.free(block, block->size, allocator.userdata);
+    }
+    *arena = NULL;
+}
+
+static void *arena_default_alloc(size_t size, void *userdata)
+{
+    return malloc(size);
+}
+
+static void arena_default_free(void *ptr, size_t size, void *userdata)
+{
+    free(ptr);
+}
+
+static fmp4_arena_block_t *
+arena_block(const fmp4_allocator_t *allocator,
+            size_t                  size)
+{
+    fmp4_arena_block_t *block = NULL;
+
+    /* Allocate a block, its header records its size for the free */
+    block = (fmp4_arena_block_t *)(allocator->alloc(size,
+                allocator->userdata));
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+
+    return block;
+}
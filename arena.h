@@ -0,0 +1,47 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   arena.h
+ * Desc:   Per-stream bump arena interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    #define FMP4_ARENA_BLOCK_SIZE (16 * 1024)
+    #define FMP4_ARENA_ALIGNMENT  16
+
+    /* Bump arena of a stream's context & metadata */
+    typedef struct fmp4_arena_t
+    {
+        fmp4_allocator_t  allocator;
+        uint8_t          *cursor; // next free byte of the current block
+        uint8_t          *end;    // end of the current block
+        void             *blocks; // most recent block, chained to the older
+
+    } fmp4_arena_t;
+
+    /* Arena public functions */
+    fmp4_arena_t *fmp4_arena_create(const fmp4_allocator_t *allocator,
+            error_context_t *errctx);
+    void *fmp4_arena_alloc(fmp4_arena_t *arena, size_t size,
+            error_context_t *errctx);
+    char *fmp4_arena_strndup(fmp4_arena_t *arena, const char *string,
+            size_t length, error_context_t *errctx);
+    void fmp4_arena_destroy(fmp4_arena_t **arena);
+
+#ifdef __cplusplus
+}
+#endif
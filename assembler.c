@@ -0,0 +1,264 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   assembler.c
+ * Desc:   Streaming FMP4 box assembler implementation
+ */
+
+#include "assembler.h"
+#include "slab.h"
+
+static bool assembler_reserve(fmp4_assembler_t *assembler, size_t size,
+        error_context_t *errctx);
+static void assembler_shrink(fmp4_assembler_t *assembler);
+static void assembler_recycle(fmp4_assembler_t *assembler);
+static bool assembler_append(fmp4_assembler_t *assembler,
+        const uint8_t **ptr, const uint8_t *end, size_t target,
+        error_context_t *errctx);
+static bool assembler_complete(fmp4_assembler_t *assembler,
+        const uint8_t **ptr, const uint8_t *end, bool final,
+        fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+
+bool
+fmp4_assembler_feed(fmp4_assembler_t   *assembler,
+                    const uint8_t      *data,
+                    size_t              length,
+                    bool                final,
+                    size_t              remaining,
+                    fmp4box_function_t  callback,
+                    void               *userdata,
+                    error_context_t    *errctx)
+{
+    fmp4_box_iter_t  iter = {};
+    const uint8_t   *ptr  = data;
+    const uint8_t   *end  = data + length;
+
+    /* Sanity checks */
+    if (!assembler || (!data && length) || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    assembler_recycle(assembler);
+
+    /* Check whether a new message is an event response or a FMP4 frame */
+    if (!assembler->in_message)
+        assembler->skip_message = (!assembler->length && length &&
+                *data == '{' && length + remaining <
+                ASSEMBLER_MAX_CONTROL_MESSAGE_LENGTH);
+    assembler->in_message = !(final && remaining == 0);
+    if (assembler->skip_message)
+        return true;
+
+    /* Complete the box left over from previous receives first */
+    if (assembler->length && !assembler_complete(assembler, &ptr, end,
+                !assembler->in_message, callback, userdata, errctx))
+        return false;
+    if (assembler->length)
+        return true;
+
+    /* Dispatch all boxes contained whole in this receive without copying */
+    fmp4_box_iter_init(&iter, ptr, (size_t)(end - ptr));
+    while (fmp4_box_iter_next(&iter) && !iter.unbounded)
+    {
+        /* Invoke user-provided callback with FMP4 box */
+        if (!callback(iter.box, userdata, errctx))
+            error_save_retval(errctx, errno, false);
+    }
+    error_save_retval_if(iter.errnum == EBADMSG, errctx, EBADMSG, false);
+    error_save_retval_if(iter.size > ASSEMBLER_MAX_BOX_SIZE, errctx,
+            EMSGSIZE, false);
+
+    /* Stage the tail of a box straddling the receive boundary, boxes
+     * running to the end of the message are always staged so that the
+     * callback sees their actual size */
+    ptr = iter.unbounded ? (const uint8_t *)(iter.box) : iter.cursor;
+    if (ptr < end)
+    {
+        if (!assembler_append(assembler, &ptr, end, iter.header, errctx))
+            return false;
+        if (!assembler_complete(assembler, &ptr, end, !assembler->in_message,
+                    callback, userdata, errctx))
+            return false;
+    }
+
+    return true;
+}
+
+void fmp4_assembler_reset(fmp4_assembler_t *assembler)
+{
+    /* Sanity checks */
+    if (!assembler)
+        return;
+
+    /* Drop any partially staged box, keep the buffer for reuse unless it
+     * outgrew the stream */
+    assembler->length = 0;
+    assembler->expected = 0;
+    assembler->unbounded = false;
+    assembler->in_message = false;
+    assembler->skip_message = false;
+    assembler_recycle(assembler);
+}
+
+void fmp4_assembler_fini(fmp4_assembler_t *assembler)
+{
+    /* Sanity checks */
+    if (!assembler)
+        return;
+
+    /* Give the staging buffers back to the pool */
+    slab_free(assembler->buffer, assembler->capacity);
+    slab_free(assembler->retired, assembler->retired_capacity);
+    memset(assembler, 0, sizeof(fmp4_assembler_t));
+}
+
+static bool
+assembler_reserve(fmp4_assembler_t *assembler,
+                  size_t            size,
+                  error_context_t  *errctx)
+{
+    uint8_t *buffer   = NULL;
+    size_t   capacity = 0;
+
+    /* Grow geometrically so that repeated large boxes settle quickly, the
+     * pool rounds up to its size class */
+    if (size <= assembler->capacity)
+        return true;
+    buffer = (uint8_t *)(slab_alloc(MAX(size, assembler->capacity * 2),
+                &capacity, errctx));
+    if (!buffer)
+        return false;
+    if (assembler->length)
+        memcpy(buffer, assembler->buffer, assembler->length);
+    slab_free(assembler->buffer, assembler->capacity);
+
+    assembler->buffer = buffer;
+    assembler->capacity = capacity;
+
+    return true;
+}
+
+static void assembler_shrink(fmp4_assembler_t *assembler)
+{
+    /* Only an idle buffer well past the usual box size is given back */
+    if (assembler->length || !assembler->buffer || assembler->capacity <=
+            assembler->average * ASSEMBLER_SHRINK_FACTOR)
+        return;
+    slab_free(assembler->buffer, assembler->capacity);
+    assembler->buffer = NULL;
+    assembler->capacity = 0;
+}
+
+static void assembler_recycle(fmp4_assembler_t *assembler)
+{
+    /* Take back the buffer of a box handed out by the previous feed, then
+     * let go of one the stream outgrew */
+    if (assembler->retired && !assembler->buffer)
+    {
+        assembler->buffer = assembler->retired;
+        assembler->capacity = assembler->retired_capacity;
+    }
+    else
+        slab_free(assembler->retired, assembler->retired_capacity);
+    assembler->retired = NULL;
+    assembler->retired_capacity = 0;
+    assembler_shrink(assembler);
+}
+
+static bool
+assembler_append(fmp4_assembler_t  *assembler,
+                 const uint8_t    **ptr,
+                 const uint8_t     *end,
+                 size_t             target,
+                 error_context_t   *errctx)
+{
+    size_t count = 0;
+
+    /* Copy bytes from the receive buffer until target length is staged,
+     * unbounded boxes grow with every receive & are capped here too */
+    if (assembler->length >= target)
+        return true;
+    error_save_retval_if(target > ASSEMBLER_MAX_BOX_SIZE, errctx, EMSGSIZE,
+            false);
+    if (!assembler_reserve(assembler, target, errctx))
+        return false;
+    count = MIN(target - assembler->length, (size_t)(end - *ptr));
+    memcpy(assembler->buffer + assembler->length, *ptr, count);
+    assembler->length += count;
+    *ptr += count;
+
+    return true;
+}
+
+static bool
+assembler_complete(fmp4_assembler_t    *assembler,
+                   const uint8_t      **ptr,
+                   const uint8_t       *end,
+                   bool                 final,
+                   fmp4box_function_t   callback,
+                   void                *userdata,
+                   error_context_t     *errctx)
+{
+    fmp4_box_iter_t  iter = {};
+    fmp4_box_t      *box  = NULL;
+
+    /* Parse staged box header, which may need up to a largesize field */
+    while (!assembler->expected && !assembler->unbounded)
+    {
+        fmp4_box_iter_init(&iter, assembler->buffer, assembler->length);
+        fmp4_box_iter_next(&iter);
+        error_save_retval_if(iter.errnum == EBADMSG, errctx, EBADMSG, false);
+        if (iter.errnum == ENODATA)
+        {
+            if (!assembler_append(assembler, ptr, end, iter.header, errctx))
+                return false;
+            if (assembler->length < iter.header)
+                return true;
+            continue;
+        }
+
+        /* Size staging buffer once the box header is complete */
+        error_save_retval_if(iter.size > ASSEMBLER_MAX_BOX_SIZE, errctx,
+                EMSGSIZE, false);
+        assembler->unbounded = iter.unbounded;
+        assembler->expected = iter.unbounded ? 0 : iter.size;
+    }
+
+    /* Stage box body, unbounded boxes take everything up to message end */
+    if (!assembler_append(assembler, ptr, end, assembler->unbounded ?
+                assembler->length + (size_t)(end - *ptr) :
+                assembler->expected, errctx))
+        return false;
+    if (assembler->unbounded ? !final : assembler->length < assembler->expected)
+        return true;
+
+    /* Rewrite unbounded box size so the callback sees its actual length */
+    box = (fmp4_box_t *)(assembler->buffer);
+    if (assembler->unbounded)
+    {
+        error_save_retval_if(assembler->length > UINT32_MAX, errctx,
+                EMSGSIZE, false);
+        box->size = htonl((uint32_t)(assembler->length));
+    }
+
+    /* Track staged box sizes, an 1/8 weighted moving average */
+    assembler->average = assembler->average ?
+        assembler->average - assembler->average / 8 + assembler->length / 8 :
+        assembler->length;
+
+    /* Invoke user-provided callback with the reassembled FMP4 box, its
+     * buffer is set aside so that staging more of this feed goes to a new
+     * one, at most one box is staged after another in a feed */
+    assembler->length = 0;
+    assembler->expected = 0;
+    assembler->unbounded = false;
+    if (!assembler->retired)
+    {
+        assembler->retired = assembler->buffer;
+        assembler->retired_capacity = assembler->capacity;
+        assembler->buffer = NULL;
+        assembler->capacity = 0;
+    }
+    if (!callback(box, userdata, errctx))
+        error_save_retval(errctx, errno, false);
+
+    return true;
+}
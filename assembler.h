@@ -0,0 +1,52 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   assembler.h
+ * Desc:   Streaming FMP4 box assembler interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    #define ASSEMBLER_MAX_CONTROL_MESSAGE_LENGTH 1024
+    #define ASSEMBLER_MAX_BOX_SIZE (256 * 1024 * 1024)
+
+    #define ASSEMBLER_SHRINK_FACTOR 4
+
+    /* Streaming box assembler, boxes are valid until the next feed */
+    typedef struct fmp4_assembler_t
+    {
+        uint8_t *buffer;       // staging buffer, from the slab pool
+        size_t   length;       // staged byte count
+        size_t   capacity;     // staging buffer capacity
+        uint8_t *retired;      // buffer of a staged box handed out this feed
+        size_t   retired_capacity;
+        size_t   average;      // running average of staged box sizes
+        size_t   expected;     // staged box size, 0 if header incomplete
+        bool     unbounded;    // staged box extends to end of message
+        bool     in_message;   // inside a fragmented WebSocket message
+        bool     skip_message; // current message is a control message
+
+    } fmp4_assembler_t;
+
+    /* Assembler public functions */
+    bool fmp4_assembler_feed(fmp4_assembler_t *assembler, const uint8_t *data,
+            size_t length, bool final, size_t remaining,
+            fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+    void fmp4_assembler_reset(fmp4_assembler_t *assembler);
+    void fmp4_assembler_fini(fmp4_assembler_t *assembler);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_box_iter.c
+ * Desc:   FMP4 box iterator traversal microbenchmark
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "fmp4.h"
+
+#define BENCH_BUFFER_SIZE (64 * 1024 * 1024)
+#define BENCH_ITERATIONS  16
+
+static double bench_seconds()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t bench_fill(uint8_t *buffer, size_t length, size_t box_size)
+{
+    fmp4_box_t *box  = NULL;
+    size_t      used = 0;
+
+    /* Fill buffer with back-to-back boxes of the given size */
+    memset(buffer, 0xA5, length);
+    for (used = 0; used + box_size <= length; used += box_size)
+    {
+        box = (fmp4_box_t *)(buffer + used);
+        box->size = htonl((uint32_t)(box_size));
+        memcpy(box->body - sizeof(uint32_t), "mdat", sizeof(uint32_t));
+    }
+
+    return used;
+}
+
+static double bench_memory_bandwidth(const uint8_t *buffer, size_t length)
+{
+    const uint64_t *ptr   = (const uint64_t *)(buffer);
+    volatile uint64_t sum = 0;
+    uint64_t        acc   = 0;
+    double          start = 0;
+    size_t          idx   = 0;
+    int             iter  = 0;
+
+    /* Reference: sequential read of every word in the buffer */
+    start = bench_seconds();
+    for (iter = 0; iter < BENCH_ITERATIONS; iter++)
+        for (idx = 0; idx < length / sizeof(uint64_t); idx++)
+            acc += ptr[idx];
+    sum = acc;
+    (void)(sum);
+
+    return (double)(length) * BENCH_ITERATIONS /
+        (bench_seconds() - start) / 1e9;
+}
+
+int main()
+{
+    static const size_t sizes[] = { 16, 64, 256, 4096, 65536, 1048576 };
+    fmp4_box_iter_t     iter    = {};
+    volatile uint64_t   sink    = 0;
+    uint8_t            *buffer  = NULL;
+    size_t              length  = 0;
+    size_t              boxes   = 0;
+    size_t              idx     = 0;
+    double              start   = 0;
+    double              elapsed = 0;
+    int                 loop    = 0;
+
+    buffer = (uint8_t *)(malloc(BENCH_BUFFER_SIZE));
+    if (!buffer)
+        return EXIT_FAILURE;
+
+    printf("memory read bandwidth: %.2f GB/s\n",
+            bench_memory_bandwidth(buffer, BENCH_BUFFER_SIZE));
+
+    for (idx = 0; idx < sizeof(sizes) / sizeof(sizes[0]); idx++)
+    {
+        length = bench_fill(buffer, BENCH_BUFFER_SIZE, sizes[idx]);
+
+        /* Walk the whole buffer box by box */
+        boxes = 0;
+        start = bench_seconds();
+        for (loop = 0; loop < BENCH_ITERATIONS; loop++)
+        {
+            fmp4_box_iter_init(&iter, buffer, length);
+            while (fmp4_box_iter_next(&iter))
+            {
+                sink += iter.box->type;
+                boxes++;
+            }
+            if (iter.errnum)
+                return EXIT_FAILURE;
+        }
+        elapsed = bench_seconds() - start;
+
+        printf("box size %8zu: %10.2f Mboxes/s %8.2f GB/s\n", sizes[idx],
+                boxes / elapsed / 1e6,
+                (double)(length) * BENCH_ITERATIONS / elapsed / 1e9);
+    }
+
+    FREE_AND_NULLIFY(buffer);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_engine.c
+ * Desc:   Aggregate ingest throughput of the sharded engine per worker count
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+#include "bench_server.h"
+#include "common.h"
+#include "engine.h"
+#include "fmp4.h"
+
+#define BENCH_DEFAULT_PORT    7691
+#define BENCH_DEFAULT_STREAMS 64
+#define BENCH_DEFAULT_SECONDS 5
+#define BENCH_MAX_SERVERS     16
+
+static uint64_t bench_bytes = 0;
+
+static bool
+bench_callback(const fmp4_box_t *box,
+               void             *userdata,
+               error_context_t  *errctx)
+{
+    __atomic_add_fetch(&bench_bytes, fmp4_box_size(box), __ATOMIC_RELAXED);
+    return true;
+}
+
+static double
+bench_run(int      port,
+          size_t   servers,
+          size_t   streams,
+          size_t   workers,
+          unsigned seconds)
+{
+    fmp4_engine_options_t  options = {};
+    error_context_t        errors  = {};
+    error_context_t       *errctx  = &errors;
+    error_context_t       *errctxs = NULL;
+    fmp4_engine_t          engine  = NULL;
+    fmp4_t                *fmp4s   = NULL;
+    char                   url[64] = {};
+    uint64_t               bytes   = 0;
+    size_t                 idx     = 0;
+
+    fmp4s = (fmp4_t *)(calloc(streams, sizeof(fmp4_t)));
+    errctxs = (error_context_t *)(calloc(streams, sizeof(error_context_t)));
+    if (!fmp4s || !errctxs)
+        return -1;
+
+    /* Spread all streams over the given number of workers & the servers */
+    options.workers = workers;
+    options.pin = true;
+    engine = fmp4_engine_create(&options, errctx);
+    for (idx = 0; engine && idx < streams; idx++)
+    {
+        snprintf(url, sizeof(url), "ws://127.0.0.1:%d/bench.mp4",
+                port + (int)(idx % servers));
+        fmp4s[idx] = fmp4_create(url, errctx);
+        if (fmp4s[idx])
+            fmp4_engine_add(engine, fmp4s[idx], bench_callback, NULL,
+                    &(errctxs[idx]));
+    }
+    error_log_saved(errctx, "Failed to setup benchmark streams");
+
+    /* Warm up for a second, then measure */
+    sleep(1);
+    bytes = __atomic_load_n(&bench_bytes, __ATOMIC_RELAXED);
+    sleep(seconds);
+    bytes = __atomic_load_n(&bench_bytes, __ATOMIC_RELAXED) - bytes;
+
+    for (idx = 0; idx < streams; idx++)
+    {
+        fmp4_engine_remove(engine, fmp4s[idx]);
+        fmp4_destroy(&(fmp4s[idx]));
+    }
+    fmp4_engine_destroy(&engine);
+    FREE_AND_NULLIFY(errctxs);
+    FREE_AND_NULLIFY(fmp4s);
+
+    return (double)(bytes) / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_server_t servers[BENCH_MAX_SERVERS] = {};
+    size_t         count   = 0;
+    size_t         streams = 0;
+    size_t         workers = 0;
+    size_t         max     = 0;
+    size_t         idx     = 0;
+    unsigned       seconds = 0;
+    int            port    = 0;
+    long           cpus    = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (argc > 1 && !strcmp(argv[1], "-h"))
+    {
+        fprintf(stderr, "Usage: %s [streams] [seconds] [max workers] [port]\n"
+                "Streams receive unpaced from loopback servers on the ports "
+                "from port on\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    streams = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_STREAMS;
+    seconds = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_SECONDS;
+    max = argc > 3 ? strtoul(argv[3], NULL, 10) : (size_t)(MAX(cpus, 1));
+    port = argc > 4 ? atoi(argv[4]) : BENCH_DEFAULT_PORT;
+    lws_set_log_level(LLL_ERR, NULL);
+
+    /* Serve from half the CPUs, each server is one thread on its own port */
+    count = MIN(MAX((size_t)(MAX(cpus, 1)) / 2, 1), BENCH_MAX_SERVERS);
+    for (idx = 0; idx < count; idx++)
+    {
+        if (!bench_server_start(&(servers[idx]), port + (int)(idx), NULL,
+                    NULL, 0))
+        {
+            fprintf(stderr, "Failed to start loopback server on port %d\n",
+                    port + (int)(idx));
+            while (idx-- > 0)
+                bench_server_stop(&(servers[idx]));
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Aggregate throughput for doubling worker counts */
+    printf("{\n  \"engine\": {\"streams\": %zu, \"servers\": %zu, "
+            "\"fragment_size\": %d, \"runs\": [", streams, count,
+            BENCH_MOOF_SIZE + BENCH_FRAGMENT_SIZE);
+    for (workers = 1; workers <= max; workers = workers < max ?
+            MIN(workers * 2, max) : max + 1)
+        printf("%s\n    {\"workers\": %zu, \"bytes_per_sec\": %.0f}",
+                workers > 1 ? "," : "", workers,
+                bench_run(port, count, streams, workers, seconds));
+    printf("\n  ]}\n}\n");
+
+    for (idx = 0; idx < count; idx++)
+        bench_server_stop(&(servers[idx]));
+
+    return EXIT_SUCCESS;
+}
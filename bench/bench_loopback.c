@@ -0,0 +1,192 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_loopback.c
+ * Desc:   End-to-end receive benchmark against a loopback WebSocket server
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+#include "bench_server.h"
+#include "common.h"
+#include "fmp4.h"
+
+#define BENCH_DEFAULT_PORT     7681
+#define BENCH_DEFAULT_SECONDS  5
+#define BENCH_PACED_RATE       1000
+#define BENCH_MAX_SAMPLES      (4 * 1024 * 1024)
+#define BENCH_BATCH_VIEWS      256
+
+/* Client side measurements */
+typedef struct bench_client_t
+{
+    uint64_t  boxes;
+    uint64_t  bytes;
+    int64_t  *samples;
+    size_t    count;
+
+} bench_client_t;
+
+static bool
+bench_client_callback(const fmp4_box_t *box,
+                      void             *userdata,
+                      error_context_t  *errctx)
+{
+    bench_client_t *client = (bench_client_t *)(userdata);
+    int64_t         sent   = 0;
+
+    /* Receive latency from the send time stamped into each mdat */
+    client->boxes++;
+    client->bytes += fmp4_box_size(box);
+    if (ntohl(box->type) == FMP4_FOURCC('m', 'd', 'a', 't') &&
+        client->count < BENCH_MAX_SAMPLES)
+    {
+        memcpy(&sent, box->body, sizeof(sent));
+        (client->samples)[(client->count)++] =
+            current_monotonic_microseconds() - sent;
+    }
+
+    return true;
+}
+
+static int bench_compare(const void *lhs, const void *rhs)
+{
+    int64_t a = *(const int64_t *)(lhs);
+    int64_t b = *(const int64_t *)(rhs);
+
+    return (a > b) - (a < b);
+}
+
+static void
+bench_run(const char *protocol,
+          const char *mode,
+          const char *url,
+          unsigned    seconds,
+          bool        batch,
+          bool        last)
+{
+    fmp4_box_view_t  views[BENCH_BATCH_VIEWS] = {};
+    error_context_t  errors  = {};
+    error_context_t *errctx  = &errors;
+    bench_client_t   client  = {};
+    fmp4_t           fmp4    = NULL;
+    int64_t          start   = 0;
+    double           elapsed = 0;
+    size_t           count   = 0;
+    size_t           idx     = 0;
+
+    /* Receive for the given duration through fmp4_recv(), or through
+     * fmp4_recv_batch() with the same work done in a loop over the views */
+    client.samples = (int64_t *)(malloc(BENCH_MAX_SAMPLES * sizeof(int64_t)));
+    fmp4 = client.samples ? fmp4_create(url, errctx) : NULL;
+    if (fmp4 && fmp4_connect(fmp4, errctx))
+    {
+        start = current_monotonic_microseconds();
+        while (current_monotonic_microseconds() - start < seconds * 1000000LL)
+        {
+            count = BENCH_BATCH_VIEWS;
+            if (!batch && !fmp4_recv(fmp4, bench_client_callback, &client,
+                        errctx))
+                break;
+            if (batch && !fmp4_recv_batch(fmp4, views, &count, errctx))
+                break;
+            for (idx = 0; batch && idx < count; idx++)
+                bench_client_callback(views[idx].box, &client, errctx);
+        }
+        elapsed = (current_monotonic_microseconds() - start) / 1e6;
+    }
+    fmp4_destroy(&fmp4);
+
+    /* Report throughput & latency percentiles */
+    printf("    {\"protocol\": \"%s\", \"mode\": \"%s\", \"receive\": \"%s\", ",
+            protocol, mode, batch ? "fmp4_recv_batch" : "fmp4_recv");
+    if (errors.errnum || !client.count)
+        printf("\"error\": %d}", errors.errnum ? errors.errnum : ENODATA);
+    else
+    {
+        qsort(client.samples, client.count, sizeof(int64_t), bench_compare);
+        printf("\"boxes_per_sec\": %.0f, \"bytes_per_sec\": %.0f, "
+                "\"p50_us\": %" PRId64 ", \"p99_us\": %" PRId64 ", "
+                "\"max_us\": %" PRId64 "}", client.boxes / elapsed,
+                client.bytes / elapsed, (client.samples)[client.count / 2],
+                (client.samples)[client.count * 99 / 100],
+                (client.samples)[client.count - 1]);
+    }
+    printf("%s\n", last ? "" : ",");
+    FREE_AND_NULLIFY(client.samples);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *modes[] = { "throughput", "paced" };
+    bench_server_t     server  = {};
+    char               plain[128] = {};
+    char               evo[128] = {};
+    char               certpath[sizeof(BENCH_CERT_PATTERN)] = {};
+    char               keypath[sizeof(BENCH_KEY_PATTERN)] = {};
+    const char        *cert    = NULL;
+    const char        *key     = NULL;
+    unsigned           seconds = 0;
+    int                port    = 0;
+    int                mode    = 0;
+
+    if (argc > 1 && !strcmp(argv[1], "-h"))
+    {
+        fprintf(stderr, "Usage: %s [seconds] [port] [cert.pem key.pem]\n"
+                "The evowebsocket protocol runs over TLS, with a throwaway "
+                "self-signed certificate unless one is given\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_SECONDS;
+    port = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_PORT;
+    cert = argc > 4 ? argv[3] : NULL;
+    key = argc > 4 ? argv[4] : NULL;
+    if (!cert && !bench_server_certificate(certpath, keypath))
+    {
+        fprintf(stderr, "Failed to generate a self-signed certificate\n");
+        return EXIT_FAILURE;
+    }
+    if (!cert)
+    {
+        cert = certpath;
+        key = keypath;
+    }
+    snprintf(plain, sizeof(plain), "ws://127.0.0.1:%d/bench.mp4", port);
+    snprintf(evo, sizeof(evo), "wss://127.0.0.1:%d/websocketstream", port);
+    lws_set_log_level(LLL_ERR, NULL);
+
+    /* Unthrottled throughput, per box callback & batched for WebSocket,
+     * then latency at a paced fragment rate, ws:// & wss:// share a port */
+    printf("{\n  \"loopback\": [\n");
+    for (mode = 0; mode < 2; mode++)
+    {
+        if (!bench_server_start(&server, port, cert, key,
+                    mode ? 1000000 / BENCH_PACED_RATE : 0))
+        {
+            fprintf(stderr, "Failed to start loopback server on port %d\n",
+                    port);
+            break;
+        }
+        bench_run("websocket", modes[mode], plain, seconds, false, false);
+        if (!mode)
+            bench_run("websocket", modes[mode], plain, seconds, true, false);
+        bench_run("evowebsocket", modes[mode], evo, seconds, false,
+                mode == 1);
+        bench_server_stop(&server);
+    }
+    printf("  ]\n}\n");
+
+    /* Remove a generated certificate */
+    if (certpath[0])
+    {
+        unlink(certpath);
+        unlink(keypath);
+    }
+
+    return mode == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,285 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_server.c
+ * Desc:   In-process loopback WebSocket server shared by the benchmarks
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include "bench_server.h"
+#include "fmp4.h"
+
+/* Per-connection server state */
+typedef struct bench_session_t
+{
+    bool     playing;
+    bool     pong;
+    uint64_t sent; // last paced tick sent in
+
+} bench_session_t;
+
+static int bench_server_handler(struct lws *wsi,
+        enum lws_callback_reasons reason, void *user, void *in, size_t length);
+static void *bench_server_run(void *arg);
+static bool bench_server_write(char *path, bool (*write)(FILE *, void *),
+        void *object);
+static bool bench_server_write_cert(FILE *file, void *cert);
+static bool bench_server_write_key(FILE *file, void *key);
+
+bool
+bench_server_start(bench_server_t *server,
+                   int             port,
+                   const char     *cert,
+                   const char     *key,
+                   int64_t         interval)
+{
+    fmp4_box_t *box = NULL;
+
+    /* Build the fragment frame once */
+    memset(server, 0, sizeof(bench_server_t));
+    server->length = BENCH_MOOF_SIZE + BENCH_FRAGMENT_SIZE;
+    server->frame = (uint8_t *)(calloc(1, LWS_PRE + server->length));
+    if (!server->frame)
+        return false;
+    box = (fmp4_box_t *)(server->frame + LWS_PRE);
+    box->size = htonl(BENCH_MOOF_SIZE);
+    memcpy(box->body - sizeof(uint32_t), "moof", sizeof(uint32_t));
+    box = (fmp4_box_t *)(server->frame + LWS_PRE + BENCH_MOOF_SIZE);
+    box->size = htonl(BENCH_FRAGMENT_SIZE);
+    memcpy(box->body - sizeof(uint32_t), "mdat", sizeof(uint32_t));
+    server->interval = interval;
+
+    /* Listen on loopback, taking TLS too when a certificate is given */
+    (server->protocols)[0].name = "";
+    (server->protocols)[0].callback = bench_server_handler;
+    (server->protocols)[0].per_session_data_size = sizeof(bench_session_t);
+    (server->protocols)[0].rx_buffer_size = 4096;
+    (server->info).port = port;
+    (server->info).iface = "127.0.0.1";
+    (server->info).protocols = server->protocols;
+    (server->info).user = server;
+    (server->info).gid = -1;
+    (server->info).uid = -1;
+    if (cert && key)
+    {
+        (server->info).options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT |
+            LWS_SERVER_OPTION_ALLOW_NON_SSL_ON_SSL_PORT;
+        (server->info).ssl_cert_filepath = cert;
+        (server->info).ssl_private_key_filepath = key;
+    }
+    server->lwsctx = lws_create_context(&(server->info));
+    if (!server->lwsctx)
+    {
+        FREE_AND_NULLIFY(server->frame);
+        return false;
+    }
+    if (pthread_create(&(server->thread), NULL, bench_server_run, server))
+    {
+        lws_context_destroy(server->lwsctx);
+        FREE_AND_NULLIFY(server->frame);
+        return false;
+    }
+
+    return true;
+}
+
+void bench_server_stop(bench_server_t *server)
+{
+    server->stop = true;
+    lws_cancel_service(server->lwsctx);
+    pthread_join(server->thread, NULL);
+    lws_context_destroy(server->lwsctx);
+    FREE_AND_NULLIFY(server->frame);
+}
+
+bool
+bench_server_certificate(char cert[sizeof(BENCH_CERT_PATTERN)],
+                         char key[sizeof(BENCH_KEY_PATTERN)])
+{
+    EVP_PKEY_CTX *keyctx = NULL;
+    EVP_PKEY     *pkey   = NULL;
+    X509         *x509   = NULL;
+    X509_NAME    *name   = NULL;
+    bool          result = false;
+
+    /* RSA key & a certificate for 127.0.0.1 signed by it, valid a day */
+    cert[0] = key[0] = '\0';
+    keyctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    if (!keyctx || EVP_PKEY_keygen_init(keyctx) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_keygen_bits(keyctx, 2048) <= 0 ||
+        EVP_PKEY_keygen(keyctx, &pkey) <= 0)
+        goto CLEANUP;
+    x509 = X509_new();
+    if (!x509 || !X509_set_version(x509, 2) ||
+        !ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) ||
+        !X509_gmtime_adj(X509_getm_notBefore(x509), 0) ||
+        !X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 60 * 60) ||
+        !X509_set_pubkey(x509, pkey))
+        goto CLEANUP;
+    name = X509_get_subject_name(x509);
+    if (!X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                (const unsigned char *)("127.0.0.1"), -1, -1, 0) ||
+        !X509_set_issuer_name(x509, name) ||
+        !X509_sign(x509, pkey, EVP_sha256()))
+        goto CLEANUP;
+
+    /* Write both as PEM files for the server context to load */
+    strcpy(cert, BENCH_CERT_PATTERN);
+    strcpy(key, BENCH_KEY_PATTERN);
+    result = bench_server_write(cert, bench_server_write_cert, x509) &&
+        bench_server_write(key, bench_server_write_key, pkey);
+
+CLEANUP:
+
+    if (!result && cert[0])
+        unlink(cert);
+    if (!result)
+        cert[0] = key[0] = '\0';
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_CTX_free(keyctx);
+
+    return result;
+}
+
+static int
+bench_server_handler(struct lws                *wsi,
+                     enum lws_callback_reasons  reason,
+                     void                      *user,
+                     void                      *in,
+                     size_t                     length)
+{
+    static const char  pong[]  = "{\"eventType\":\"PONG\",\"requestId\":0}";
+    bench_session_t   *session = (bench_session_t *)(user);
+    bench_server_t    *server  = NULL;
+    uint8_t            text[LWS_PRE + sizeof(pong)] = {};
+    char               uri[256] = {};
+    char               event[128] = {};
+    int64_t            now     = 0;
+
+    server = (bench_server_t *)(lws_context_user(lws_get_context(wsi)));
+    switch (reason)
+    {
+        case LWS_CALLBACK_ESTABLISHED:
+            /* Plain WebSocket streams start right away, evowebsocket on PLAY */
+            lws_hdr_copy(wsi, uri, sizeof(uri), WSI_TOKEN_GET_URI);
+            session->playing = strstr(uri, ".mp4") != NULL;
+            session->sent = server->ticks;
+            if (session->playing)
+                lws_callback_on_writable(wsi);
+        break;
+        case LWS_CALLBACK_RECEIVE:
+            memcpy(event, in, MIN(length, sizeof(event) - 1));
+            if (strstr(event, "\"PLAY\"") && !session->playing)
+            {
+                session->playing = true;
+                session->sent = server->ticks;
+            }
+            if (strstr(event, "\"PING\""))
+                session->pong = true;
+            lws_callback_on_writable(wsi);
+        break;
+        case LWS_CALLBACK_SERVER_WRITEABLE:
+            if (session->pong)
+            {
+                memcpy(text + LWS_PRE, pong, sizeof(pong) - 1);
+                if (lws_write(wsi, text + LWS_PRE, sizeof(pong) - 1,
+                            LWS_WRITE_TEXT) < 0)
+                    return -1;
+                session->pong = false;
+                lws_callback_on_writable(wsi);
+                break;
+            }
+
+            /* Writable callbacks also follow PLAY, PING & PONG, paced
+             * streams send once per tick & do not make up missed ones */
+            if (!session->playing ||
+                (server->interval && session->sent >= server->ticks))
+                break;
+            session->sent = server->ticks;
+
+            /* Stamp & send one moof+mdat fragment per frame */
+            now = current_monotonic_microseconds();
+            memcpy(server->frame + LWS_PRE + BENCH_MOOF_SIZE + 8, &now,
+                    sizeof(now));
+            if (lws_write(wsi, server->frame + LWS_PRE, server->length,
+                        LWS_WRITE_BINARY) < 0)
+                return -1;
+            if (!server->interval)
+                lws_callback_on_writable(wsi);
+        break;
+        default: break;
+    }
+
+    return 0;
+}
+
+static void *bench_server_run(void *arg)
+{
+    bench_server_t *server = (bench_server_t *)(arg);
+    int64_t         due    = current_monotonic_microseconds();
+
+    /* Service connections, waking writers at the paced rate if any */
+    while (!server->stop)
+    {
+        lws_service(server->lwsctx, server->interval ? 1 : 10);
+        if (server->interval && current_monotonic_microseconds() >= due)
+        {
+            server->ticks++;
+            lws_callback_on_writable_all_protocol(server->lwsctx,
+                    &((server->protocols)[0]));
+            due += server->interval;
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+bench_server_write(char  *path,
+                   bool (*write)(FILE *, void *),
+                   void  *object)
+{
+    FILE *file = NULL;
+    int   fd   = -1;
+    bool  ok   = false;
+
+    /* Create the file from its pattern, removing it again on failure */
+    fd = mkstemp(path);
+    file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(path);
+        }
+        return false;
+    }
+    ok = write(file, object);
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        unlink(path);
+
+    return ok;
+}
+
+static bool bench_server_write_cert(FILE *file, void *cert)
+{
+    return PEM_write_X509(file, (X509 *)(cert)) == 1;
+}
+
+static bool bench_server_write_key(FILE *file, void *key)
+{
+    return PEM_write_PrivateKey(file, (EVP_PKEY *)(key), NULL, NULL, 0,
+            NULL, NULL) == 1;
+}
@@ -0,0 +1,56 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_server.h
+ * Desc:   In-process loopback WebSocket server shared by the benchmarks
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libwebsockets.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    #define BENCH_FRAGMENT_SIZE (64 * 1024)
+    #define BENCH_MOOF_SIZE     256
+    #define BENCH_CERT_PATTERN  "/tmp/bench_cert.XXXXXX"
+    #define BENCH_KEY_PATTERN   "/tmp/bench_key.XXXXXX"
+
+    /* Loopback server, fragments carry their send time in the mdat body */
+    typedef struct bench_server_t
+    {
+        struct lws_context_creation_info  info;
+        struct lws_protocols              protocols[2];
+        struct lws_context               *lwsctx;
+        pthread_t                         thread;
+        uint8_t                          *frame;    // LWS_PRE + moof + mdat
+        size_t                            length;   // moof + mdat
+        int64_t                           interval; // pacing in us, 0 = none
+        uint64_t                          ticks;    // paced sends due so far
+        volatile bool                     stop;
+
+    } bench_server_t;
+
+    /* Serve ws:// & given a certificate wss:// too on 127.0.0.1:port until
+     * stopped, sending fragments back to back or one per interval us */
+    bool bench_server_start(bench_server_t *server, int port, const char *cert,
+            const char *key, int64_t interval);
+    void bench_server_stop(bench_server_t *server);
+
+    /* Throwaway self-signed certificate for 127.0.0.1 & its key, written to
+     * temporary PEM files named after the patterns, unlinked by the caller */
+    bool bench_server_certificate(char cert[sizeof(BENCH_CERT_PATTERN)],
+            char key[sizeof(BENCH_KEY_PATTERN)]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   bench_traverse.c
+ * Desc:   Box assembler & callback dispatch benchmarks with JSON output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "common.h"
+#include "fmp4.h"
+
+#define BENCH_FRAME_BYTES  (64 * 1024 * 1024)
+#define BENCH_MIN_BOXES    (4 * 1024 * 1024)
+#define BENCH_MAX_BYTES    (1024 * 1024 * 1024ULL)
+#define BENCH_FILE_BOXES   (1024 * 1024)
+#define BENCH_FILE_PATTERN "/tmp/bench_traverse.XXXXXX"
+#define BENCH_BATCH_VIEWS  256
+#define BENCH_MOOF_BYTES   1024
+
+typedef struct bench_result_t
+{
+    uint64_t boxes;
+    uint64_t bytes;
+    double   seconds;
+
+} bench_result_t;
+
+static volatile uint64_t bench_sink = 0;
+
+static double bench_seconds()
+{
+    return current_monotonic_microseconds() / 1e6;
+}
+
+static bool
+bench_callback(const fmp4_box_t *box,
+               void             *userdata,
+               error_context_t  *errctx)
+{
+    bench_sink += box->type;
+    return true;
+}
+
+static size_t
+bench_fill(uint8_t    *buffer,
+           size_t      boxes,
+           size_t      box_size,
+           const char *type)
+{
+    fmp4_box_t *box  = NULL;
+    size_t      idx  = 0;
+
+    /* Fill buffer with back-to-back boxes of the given size */
+    memset(buffer, 0xA5, boxes * box_size);
+    for (idx = 0; idx < boxes; idx++)
+    {
+        box = (fmp4_box_t *)(buffer + idx * box_size);
+        box->size = htonl((uint32_t)(box_size));
+        memcpy(box->body - sizeof(uint32_t), type, sizeof(uint32_t));
+    }
+
+    return boxes * box_size;
+}
+
+static bool
+bench_traverse(uint8_t        *frame,
+               size_t          boxes,
+               size_t          box_size,
+               bool            split,
+               bench_result_t *result)
+{
+    fmp4_assembler_t  assembler = {};
+    error_context_t   errors    = {};
+    error_context_t  *errctx    = &errors;
+    size_t            length    = 0;
+    size_t            half      = 0;
+    size_t            frames    = 0;
+    size_t            idx       = 0;
+    double            start     = 0;
+
+    /* One WebSocket frame of back-to-back boxes, optionally received in
+     * two fragments cut in the middle of a box */
+    length = bench_fill(frame, boxes, box_size, "mdat");
+    half = split ? (boxes / 2) * box_size + box_size / 2 : length;
+    frames = MAX(MIN(BENCH_MIN_BOXES / boxes, BENCH_MAX_BYTES / length), 1);
+
+    start = bench_seconds();
+    for (idx = 0; idx < frames; idx++)
+    {
+        if (!fmp4_assembler_feed(&assembler, frame, half, !split,
+                    length - half, bench_callback, NULL, errctx))
+            break;
+        if (split && !fmp4_assembler_feed(&assembler, frame + half,
+                    length - half, true, 0, bench_callback, NULL, errctx))
+            break;
+    }
+    result->seconds = bench_seconds() - start;
+    result->boxes = (uint64_t)(idx) * boxes;
+    result->bytes = (uint64_t)(idx) * length;
+    fmp4_assembler_fini(&assembler);
+    error_log_saved(errctx, "Traversal failed");
+
+    return idx == frames;
+}
+
+static bool
+bench_rx(uint8_t        *frame,
+         size_t          fragment,
+         size_t          rx_size,
+         bench_result_t *result)
+{
+    fmp4_assembler_t  assembler = {};
+    error_context_t   errors    = {};
+    error_context_t  *errctx    = &errors;
+    size_t            frames    = 0;
+    size_t            offset    = 0;
+    size_t            chunk     = 0;
+    size_t            idx       = 0;
+    double            start     = 0;
+    bool              ok        = true;
+
+    /* One fragment per WebSocket frame, a moof & its mdat, handed over in
+     * rx buffer sized pieces the way lws reads them, frames larger than
+     * the buffer are staged by the assembler */
+    bench_fill(frame, 1, BENCH_MOOF_BYTES, "moof");
+    bench_fill(frame + BENCH_MOOF_BYTES, 1, fragment - BENCH_MOOF_BYTES,
+            "mdat");
+    frames = MAX(BENCH_MAX_BYTES / 4 / fragment, 1);
+
+    start = bench_seconds();
+    for (idx = 0; ok && idx < frames; idx++)
+    {
+        for (offset = 0; ok && offset < fragment; offset += chunk)
+        {
+            chunk = MIN(rx_size, fragment - offset);
+            ok = fmp4_assembler_feed(&assembler, frame + offset, chunk,
+                    offset + chunk == fragment, fragment - offset - chunk,
+                    bench_callback, NULL, errctx);
+        }
+    }
+    result->seconds = bench_seconds() - start;
+    result->boxes = (uint64_t)(idx) * 2;
+    result->bytes = (uint64_t)(idx) * fragment;
+    fmp4_assembler_fini(&assembler);
+    error_log_saved(errctx, "Rx buffer run failed");
+
+    return ok;
+}
+
+static bool bench_dispatch_direct(bench_result_t *result)
+{
+    fmp4box_function_t volatile  callback = bench_callback;
+    fmp4_box_t                   box      = {};
+    error_context_t              errctx   = {};
+    uint64_t                     idx      = 0;
+    double                       start    = 0;
+
+    /* Reference: an indirect call per box and nothing else */
+    start = bench_seconds();
+    for (idx = 0; idx < BENCH_MIN_BOXES; idx++)
+        callback(&box, NULL, &errctx);
+    result->seconds = bench_seconds() - start;
+    result->boxes = BENCH_MIN_BOXES;
+    result->bytes = 0;
+
+    return true;
+}
+
+static bool
+bench_dispatch_recv(uint8_t        *buffer,
+                    bool            batch,
+                    bench_result_t *result)
+{
+    fmp4_box_view_t  views[BENCH_BATCH_VIEWS] = {};
+    error_context_t  errors = {};
+    error_context_t *errctx = &errors;
+    fmp4_t           fmp4   = NULL;
+    char             path[] = BENCH_FILE_PATTERN;
+    char             url[sizeof("file://") + sizeof(path)] = {};
+    size_t           length = 0;
+    size_t           count  = 0;
+    size_t           idx    = 0;
+    double           start  = 0;
+    FILE            *file   = NULL;
+    int              fd     = -1;
+
+    /* Record small boxes, an mdat closes every 16 so that each receive
+     * of the file transport delivers a fragment's worth */
+    length = bench_fill(buffer, BENCH_FILE_BOXES, 64, "moof");
+    for (idx = 15; idx < BENCH_FILE_BOXES; idx += 16)
+        memcpy(buffer + idx * 64 + 4, "mdat", 4);
+    fd = mkstemp(path);
+    file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file || fwrite(buffer, length, 1, file) != 1)
+        return false;
+    fclose(file);
+    snprintf(url, sizeof(url), "file://%s", path);
+
+    /* Receive the whole recording through fmp4_recv(), or through
+     * fmp4_recv_batch() with the same work done in a loop over the views */
+    fmp4 = fmp4_create(url, errctx);
+    if (fmp4 && fmp4_connect(fmp4, errctx))
+    {
+        bench_sink = 0;
+        start = bench_seconds();
+        while (!batch && fmp4_recv(fmp4, bench_callback, NULL, errctx));
+        while (batch)
+        {
+            count = BENCH_BATCH_VIEWS;
+            if (!fmp4_recv_batch(fmp4, views, &count, errctx))
+                break;
+            for (idx = 0; idx < count; idx++)
+                bench_sink += views[idx].box->type;
+        }
+        result->seconds = bench_seconds() - start;
+        result->boxes = BENCH_FILE_BOXES;
+        result->bytes = length;
+    }
+    fmp4_destroy(&fmp4);
+    unlink(path);
+
+    return errors.errnum == ENODATA;
+}
+
+static void
+bench_print(const char           *name,
+            const bench_result_t *result,
+            bool                  last)
+{
+    printf("    \"%s\": {\"boxes_per_sec\": %.0f, \"bytes_per_sec\": %.0f, "
+            "\"ns_per_box\": %.2f}%s\n", name,
+            result->boxes / result->seconds, result->bytes / result->seconds,
+            result->seconds * 1e9 / result->boxes, last ? "" : ",");
+}
+
+int main()
+{
+    static const size_t sizes[]  = { 64, 1024, 16384, 262144 };
+    static const size_t counts[] = { 1, 8, 64 };
+    static const size_t frags[]  = { 65536, 262144, 1048576, 4194304 };
+    static const size_t rxs[]    = { 4096, 65536, 1048576, 4194304 };
+    bench_result_t      result   = {};
+    uint8_t            *buffer   = NULL;
+    size_t              size     = 0;
+    size_t              count    = 0;
+    size_t              frag     = 0;
+    size_t              rx       = 0;
+    int                 split    = 0;
+    bool                first    = true;
+
+    buffer = (uint8_t *)(malloc(BENCH_FRAME_BYTES));
+    if (!buffer)
+        return EXIT_FAILURE;
+
+    /* Box assembler feed for varied box sizes, box counts & fragmentation,
+     * websocket_traverse_frame() adds only its lws receive callback */
+    printf("{\n  \"assembler_feed\": [");
+    for (size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++)
+    {
+        for (count = 0; count < sizeof(counts) / sizeof(counts[0]); count++)
+        {
+            for (split = 0; split < 2; split++)
+            {
+                if (sizes[size] * counts[count] > BENCH_FRAME_BYTES ||
+                    !bench_traverse(buffer, counts[count], sizes[size],
+                        split, &result))
+                    continue;
+                printf("%s\n    {\"box_size\": %zu, \"boxes_per_frame\": %zu, "
+                        "\"split\": %s, \"boxes_per_sec\": %.0f, "
+                        "\"bytes_per_sec\": %.0f}", first ? "" : ",",
+                        sizes[size], counts[count], split ? "true" : "false",
+                        result.boxes / result.seconds,
+                        result.bytes / result.seconds);
+                first = false;
+            }
+        }
+    }
+    printf("\n  ],\n");
+
+    /* Cost of the lws rx buffer size, FMP4_OPTION_RX_BUFFER_SIZE, on
+     * fragments up to & past it, a staged fragment is copied once more */
+    printf("  \"rx_buffer\": [");
+    first = true;
+    for (frag = 0; frag < sizeof(frags) / sizeof(frags[0]); frag++)
+    {
+        for (rx = 0; rx < sizeof(rxs) / sizeof(rxs[0]); rx++)
+        {
+            if (!bench_rx(buffer, frags[frag], rxs[rx], &result))
+                continue;
+            printf("%s\n    {\"fragment_size\": %zu, \"rx_buffer_size\": %zu, "
+                    "\"staged\": %s, \"bytes_per_sec\": %.0f}",
+                    first ? "" : ",", frags[frag], rxs[rx],
+                    frags[frag] > rxs[rx] ? "true" : "false",
+                    result.bytes / result.seconds);
+            first = false;
+        }
+    }
+    printf("\n  ],\n");
+
+    /* Callback dispatch cost, bare indirect call versus fmp4_recv() &
+     * fmp4_recv_batch() of the file transport, no WebSocket involved */
+    printf("  \"dispatch\": {\n    \"timed\": \"per box callback, "
+            "indirect call alone or boxes received from a file:// "
+            "recording\",\n");
+    if (bench_dispatch_direct(&result))
+        bench_print("direct", &result, false);
+    if (bench_dispatch_recv(buffer, false, &result))
+        bench_print("fmp4_recv_file", &result, false);
+    else
+        printf("    \"fmp4_recv_file\": null,\n");
+    if (bench_dispatch_recv(buffer, true, &result))
+        bench_print("fmp4_recv_batch_file", &result, true);
+    else
+        printf("    \"fmp4_recv_batch_file\": null\n");
+    printf("  }\n}\n");
+
+    FREE_AND_NULLIFY(buffer);
+
+    return EXIT_SUCCESS;
+}
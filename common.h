@@ -29,6 +29,30 @@ extern "C"
         return tv.tv_sec * 1000LL + tv.tv_usec / 1000LL;
     }
 
+    /* Return the current system timestamp in microseconds */
+    static inline int64_t current_time_microseconds()
+    {
+        struct timeval tv = {};
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+
+    /* Return a monotonic timestamp in microseconds, for measuring intervals */
+    static inline int64_t current_monotonic_microseconds()
+    {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+    }
+
+    /* Return a monotonic timestamp in nanoseconds, for timing hot paths */
+    static inline int64_t current_monotonic_nanoseconds()
+    {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
 #ifdef __cplusplus
 }
 #endif
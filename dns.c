@@ -0,0 +1,224 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   dns.c
+ * Desc:   Process-wide host name resolution cache implementation
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+
+/* Cached address of a host name, errnum is EINPROGRESS while its lookup
+ * runs & the reason of a failed lookup until it expires */
+typedef struct dns_entry_t
+{
+    char               *host;
+    char                address[NI_MAXHOST];
+    int64_t             expires; // monotonic ms
+    int                 errnum;
+    struct dns_entry_t *next;
+
+} dns_entry_t;
+
+static pthread_mutex_t  dns_lock    = PTHREAD_MUTEX_INITIALIZER;
+static dns_entry_t     *dns_entries = NULL;
+static size_t           dns_count   = 0;
+
+static dns_entry_t *dns_find(const char *host);
+static dns_entry_t *dns_insert(const char *host);
+static bool dns_numeric(const char *host);
+static void *dns_lookup_run(void *arg);
+
+bool
+dns_resolve(const char      *host,
+            char            *address,
+            size_t           size,
+            error_context_t *errctx)
+{
+    pthread_attr_t  attr   = {};
+    dns_entry_t    *entry  = NULL;
+    char           *lookup = NULL;
+    pthread_t       thread;
+    int64_t         now    = current_monotonic_microseconds() / 1000;
+    int             errnum = 0;
+
+    /* Sanity checks */
+    if (!host || !address || !size || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Numeric hosts take no lookup */
+    if (dns_numeric(host))
+    {
+        error_save_retval_if(strlen(host) >= size, errctx, ENAMETOOLONG,
+                false);
+        strcpy(address, host);
+        return true;
+    }
+
+    /* Answer from the cache while the entry is fresh or being resolved */
+    pthread_mutex_lock(&dns_lock);
+    entry = dns_find(host);
+    if (entry && (entry->errnum == EINPROGRESS || entry->expires > now))
+    {
+        errnum = entry->errnum;
+        if (!errnum && strlen(entry->address) >= size)
+            errnum = ENAMETOOLONG;
+        if (!errnum)
+            strcpy(address, entry->address);
+        pthread_mutex_unlock(&dns_lock);
+        error_save_retval_if(errnum, errctx, errnum, false);
+        return true;
+    }
+
+    /* Start a lookup off the caller's thread, the entry answers once done */
+    if (!entry)
+        entry = dns_insert(host);
+    lookup = entry ? strdup(host) : NULL;
+    if (lookup)
+        entry->errnum = EINPROGRESS;
+    pthread_mutex_unlock(&dns_lock);
+    error_save_retval_if(!lookup, errctx, ENOMEM, false);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, dns_lookup_run, lookup))
+    {
+        pthread_mutex_lock(&dns_lock);
+        entry = dns_find(host);
+        if (entry && entry->errnum == EINPROGRESS)
+        {
+            entry->errnum = EAGAIN;
+            entry->expires = now;
+        }
+        pthread_mutex_unlock(&dns_lock);
+        FREE_AND_NULLIFY(lookup);
+        errnum = EAGAIN;
+    }
+    pthread_attr_destroy(&attr);
+    error_save_retval(errctx, errnum ? errnum : EINPROGRESS, false);
+}
+
+void dns_evict(const char *host, const char *address)
+{
+    dns_entry_t **link  = NULL;
+    dns_entry_t  *evict = NULL;
+
+    /* Sanity checks */
+    if (!host || !address)
+        return;
+
+    /* Only the failed address goes, a newer lookup result stays */
+    pthread_mutex_lock(&dns_lock);
+    for (link = &dns_entries; *link; link = &((*link)->next))
+    {
+        if (strcmp((*link)->host, host))
+            continue;
+        if (!(*link)->errnum && !strcmp((*link)->address, address))
+        {
+            evict = *link;
+            *link = evict->next;
+            dns_count--;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&dns_lock);
+
+    if (evict)
+    {
+        FREE_AND_NULLIFY(evict->host);
+        FREE_AND_NULLIFY(evict);
+    }
+}
+
+static dns_entry_t *dns_find(const char *host)
+{
+    dns_entry_t *entry = NULL;
+
+    for (entry = dns_entries; entry; entry = entry->next)
+        if (!strcmp(entry->host, host))
+            break;
+
+    return entry;
+}
+
+static dns_entry_t *dns_insert(const char *host)
+{
+    dns_entry_t  *entry = NULL;
+    dns_entry_t **link  = NULL;
+    dns_entry_t  *evict = NULL;
+
+    /* Insert at the head, called with dns_lock held */
+    entry = (dns_entry_t *)(calloc(1, sizeof(dns_entry_t)));
+    if (entry)
+        entry->host = strdup(host);
+    if (!entry || !entry->host)
+    {
+        FREE_AND_NULLIFY(entry);
+        return NULL;
+    }
+    entry->next = dns_entries;
+    dns_entries = entry;
+    dns_count++;
+
+    /* Bound the cache by evicting the oldest host, a lookup still running
+     * for it finds no entry to complete */
+    if (dns_count > DNS_CACHE_MAX)
+    {
+        for (link = &dns_entries; (*link)->next; link = &((*link)->next));
+        evict = *link;
+        *link = NULL;
+        dns_count--;
+        FREE_AND_NULLIFY(evict->host);
+        FREE_AND_NULLIFY(evict);
+    }
+
+    return entry;
+}
+
+static bool dns_numeric(const char *host)
+{
+    struct in6_addr addr = {};
+
+    return inet_pton(AF_INET, host, &addr) == 1 ||
+        inet_pton(AF_INET6, host, &addr) == 1;
+}
+
+static void *dns_lookup_run(void *arg)
+{
+    struct addrinfo  hints  = {};
+    struct addrinfo *addrs  = NULL;
+    dns_entry_t     *entry  = NULL;
+    char            *host   = (char *)(arg);
+    char             address[NI_MAXHOST] = {};
+    int              errnum = 0;
+
+    /* Blocking lookup, the first address is the one connected to */
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &addrs))
+        errnum = EHOSTUNREACH;
+    else if (getnameinfo(addrs->ai_addr, addrs->ai_addrlen, address,
+                sizeof(address), NULL, 0, NI_NUMERICHOST))
+        errnum = ENAMETOOLONG;
+    if (addrs)
+        freeaddrinfo(addrs);
+
+    /* Complete the entry, failures are answered briefly before a retry */
+    pthread_mutex_lock(&dns_lock);
+    entry = dns_find(host);
+    if (entry && entry->errnum == EINPROGRESS)
+    {
+        snprintf(entry->address, sizeof(entry->address), "%s", address);
+        entry->errnum = errnum;
+        entry->expires = current_monotonic_microseconds() / 1000 +
+            (errnum ? DNS_FAILURE_TTL : DNS_CACHE_TTL);
+    }
+    pthread_mutex_unlock(&dns_lock);
+    FREE_AND_NULLIFY(host);
+
+    return NULL;
+}
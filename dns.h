@@ -0,0 +1,34 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   dns.h
+ * Desc:   Process-wide host name resolution cache interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    #define DNS_CACHE_MAX   1024
+    #define DNS_CACHE_TTL   30000 // ms, getaddrinfo() tells no record TTL
+    #define DNS_FAILURE_TTL 1000  // ms a failed lookup is answered for
+
+    /* Non-blocking cached resolve, EINPROGRESS while looking up */
+    bool dns_resolve(const char *host, char *address, size_t size,
+            error_context_t *errctx);
+
+    /* Forget a cached address after a failed connect */
+    void dns_evict(const char *host, const char *address);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,553 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   engine.c
+ * Desc:   Sharded multi-core FMP4 ingest engine implementation
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "engine.h"
+
+#define ENGINE_DEFAULT_TIMEOUT            10
+#define ENGINE_DEFAULT_REBALANCE_INTERVAL 5000
+#define ENGINE_DEFAULT_REBALANCE_RATIO    0.25
+#define ENGINE_NO_WORKER                  SIZE_MAX
+
+typedef struct engine_internal_t engine_internal_t;
+typedef struct engine_worker_t engine_worker_t;
+typedef struct engine_stream_t engine_stream_t;
+
+typedef enum engine_command_type_t
+{
+    ENGINE_COMMAND_ATTACH,
+    ENGINE_COMMAND_DETACH,
+
+} engine_command_type_t;
+
+/* Worker command, executed on the worker thread owning the event loop */
+typedef struct engine_command_t
+{
+    engine_command_type_t    type;
+    engine_stream_t         *stream;
+    size_t                   target; // worker to migrate to after detach
+    bool                     done;
+    struct engine_command_t *next;
+
+} engine_command_t;
+
+struct engine_stream_t
+{
+    /* Stream & user callback context */
+    fmp4_t              fmp4;
+    fmp4box_function_t  callback;
+    void               *userdata;
+    error_context_t    *errctx;
+
+    /* Load accounting, bytes is only written by the owning worker */
+    uint64_t bytes;
+    uint64_t bytes_last;
+    double   rate;
+    size_t   worker;
+    bool     attached;
+    bool     migrating;
+
+    engine_command_t command;
+};
+
+struct engine_worker_t
+{
+    engine_internal_t *engine;
+    size_t             index;
+    pthread_t          thread;
+    pthread_cond_t     wake;
+    engine_command_t  *commands;
+    size_t             count;
+    double             rate;
+    bool               started;
+};
+
+struct engine_internal_t
+{
+    fmp4_engine_options_t options;
+
+    /* Workers & streams, guarded by lock */
+    pthread_mutex_t    lock;
+    pthread_cond_t     done;
+    engine_worker_t   *workers;
+    size_t             worker_count;
+    engine_stream_t  **streams;
+    size_t             count;
+    size_t             capacity;
+
+    /* Rebalancer thread */
+    pthread_t      balancer;
+    pthread_cond_t balance;
+    bool           balancer_started;
+    bool           stop;
+};
+
+static void *engine_worker_run(void *arg);
+static void *engine_balancer_run(void *arg);
+static void engine_post(engine_internal_t *engine, size_t worker,
+        engine_command_t *command);
+static size_t engine_least_loaded(const engine_internal_t *engine);
+static void engine_rebalance(engine_internal_t *engine, double elapsed);
+static bool engine_dispatch(const fmp4_box_t *box, void *userdata,
+        error_context_t *errctx);
+
+fmp4_engine_t
+fmp4_engine_create(const fmp4_engine_options_t *options,
+                   error_context_t             *errctx)
+{
+    engine_internal_t *engine = NULL;
+    engine_worker_t   *worker = NULL;
+    long               cpus   = 0;
+    size_t             idx    = 0;
+    bool               result = false;
+
+    /* Sanity checks */
+    if (!errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal engine context */
+    engine = (engine_internal_t *)(calloc(1, sizeof(engine_internal_t)));
+    error_save_retval_if(!engine, errctx, errno, NULL);
+    pthread_mutex_init(&(engine->lock), NULL);
+    pthread_cond_init(&(engine->done), NULL);
+    pthread_cond_init(&(engine->balance), NULL);
+
+    /* Apply options & defaults */
+    if (options)
+        engine->options = *options;
+    if (!(engine->options).workers)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        (engine->options).workers = cpus > 0 ? (size_t)(cpus) : 1;
+    }
+    if (!(engine->options).timeout)
+        (engine->options).timeout = ENGINE_DEFAULT_TIMEOUT;
+    if (!(engine->options).rebalance_interval)
+        (engine->options).rebalance_interval = ENGINE_DEFAULT_REBALANCE_INTERVAL;
+    if ((engine->options).rebalance_ratio <= 0)
+        (engine->options).rebalance_ratio = ENGINE_DEFAULT_REBALANCE_RATIO;
+
+    /* Start one worker thread per event loop */
+    engine->worker_count = (engine->options).workers;
+    engine->workers = (engine_worker_t *)(calloc(engine->worker_count,
+                sizeof(engine_worker_t)));
+    error_save_jump_if(!engine->workers, errctx, ENOMEM, CLEANUP);
+    for (idx = 0; idx < engine->worker_count; idx++)
+    {
+        worker = &((engine->workers)[idx]);
+        worker->engine = engine;
+        worker->index = idx;
+        pthread_cond_init(&(worker->wake), NULL);
+        if (pthread_create(&(worker->thread), NULL, engine_worker_run, worker))
+            error_save_jump(errctx, EAGAIN, CLEANUP);
+        worker->started = true;
+    }
+
+    /* Start rebalancer thread */
+    if ((engine->options).rebalance && engine->worker_count > 1)
+    {
+        if (pthread_create(&(engine->balancer), NULL, engine_balancer_run, engine))
+            error_save_jump(errctx, EAGAIN, CLEANUP);
+        engine->balancer_started = true;
+    }
+
+    result = true;
+
+CLEANUP:
+
+    if (!result)
+        fmp4_engine_destroy((fmp4_engine_t *)(&engine));
+
+    return (fmp4_engine_t)(engine);
+}
+
+bool
+fmp4_engine_add(fmp4_engine_t        engine,
+                fmp4_t               fmp4,
+                fmp4box_function_t   callback,
+                void                *userdata,
+                error_context_t     *errctx)
+{
+    engine_internal_t  *enginectx = (engine_internal_t *)(engine);
+    engine_stream_t    *stream    = NULL;
+    engine_stream_t   **streams   = NULL;
+    size_t              capacity  = 0;
+    bool                result    = false;
+
+    /* Sanity checks */
+    if (!enginectx || !fmp4 || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Setup stream record */
+    stream = (engine_stream_t *)(calloc(1, sizeof(engine_stream_t)));
+    error_save_retval_if(!stream, errctx, errno, false);
+    stream->fmp4 = fmp4;
+    stream->callback = callback;
+    stream->userdata = userdata;
+    stream->errctx = errctx;
+
+    pthread_mutex_lock(&(enginectx->lock));
+
+    /* Grow stream array */
+    if (enginectx->count == enginectx->capacity)
+    {
+        capacity = MAX(enginectx->capacity * 2, 64);
+        streams = (engine_stream_t **)(realloc(enginectx->streams,
+                    capacity * sizeof(engine_stream_t *)));
+        error_save_jump_if(!streams, errctx, ENOMEM, CLEANUP);
+        enginectx->streams = streams;
+        enginectx->capacity = capacity;
+    }
+    (enginectx->streams)[(enginectx->count)++] = stream;
+
+    /* Hand stream to the least loaded worker */
+    stream->worker = engine_least_loaded(enginectx);
+    (stream->command).type = ENGINE_COMMAND_ATTACH;
+    (stream->command).stream = stream;
+    engine_post(enginectx, stream->worker, &(stream->command));
+
+    result = true;
+
+CLEANUP:
+
+    pthread_mutex_unlock(&(enginectx->lock));
+
+    if (!result)
+        FREE_AND_NULLIFY(stream);
+
+    return result;
+}
+
+void fmp4_engine_remove(fmp4_engine_t engine, fmp4_t fmp4)
+{
+    engine_internal_t *enginectx = (engine_internal_t *)(engine);
+    engine_stream_t   *stream    = NULL;
+    engine_command_t   command   = {};
+    size_t             idx       = 0;
+
+    /* Sanity checks */
+    if (!enginectx || !fmp4)
+        return;
+
+    pthread_mutex_lock(&(enginectx->lock));
+
+    /* Find and unlink stream record */
+    for (idx = 0; idx < enginectx->count; idx++)
+    {
+        if ((enginectx->streams)[idx]->fmp4 != fmp4)
+            continue;
+        stream = (enginectx->streams)[idx];
+        (enginectx->streams)[idx] = (enginectx->streams)[--(enginectx->count)];
+        break;
+    }
+
+    /* Wait for any migration, then for the owning worker to detach it */
+    while (stream && stream->migrating && !enginectx->stop)
+        pthread_cond_wait(&(enginectx->done), &(enginectx->lock));
+    if (stream && !enginectx->stop)
+    {
+        command.type = ENGINE_COMMAND_DETACH;
+        command.stream = stream;
+        command.target = ENGINE_NO_WORKER;
+        engine_post(enginectx, stream->worker, &command);
+        while (!command.done)
+            pthread_cond_wait(&(enginectx->done), &(enginectx->lock));
+    }
+
+    pthread_mutex_unlock(&(enginectx->lock));
+
+    FREE_AND_NULLIFY(stream);
+}
+
+size_t fmp4_engine_workers(fmp4_engine_t engine)
+{
+    engine_internal_t *enginectx = (engine_internal_t *)(engine);
+
+    return enginectx ? enginectx->worker_count : 0;
+}
+
+void fmp4_engine_destroy(fmp4_engine_t *engine)
+{
+    engine_internal_t *enginectx = NULL;
+    engine_worker_t   *worker    = NULL;
+    size_t             idx       = 0;
+
+    /* Sanity checks */
+    if (!engine || !*engine)
+        return;
+
+    /* Cast to internal engine context */
+    enginectx = (engine_internal_t *)(*engine);
+
+    /* Stop threads, workers detach their streams when exiting */
+    pthread_mutex_lock(&(enginectx->lock));
+    enginectx->stop = true;
+    pthread_cond_broadcast(&(enginectx->balance));
+    pthread_cond_broadcast(&(enginectx->done));
+    for (idx = 0; enginectx->workers && idx < enginectx->worker_count; idx++)
+        pthread_cond_broadcast(&((enginectx->workers)[idx].wake));
+    pthread_mutex_unlock(&(enginectx->lock));
+    if (enginectx->balancer_started)
+        pthread_join(enginectx->balancer, NULL);
+    for (idx = 0; enginectx->workers && idx < enginectx->worker_count; idx++)
+    {
+        worker = &((enginectx->workers)[idx]);
+        if (worker->started)
+            pthread_join(worker->thread, NULL);
+        pthread_cond_destroy(&(worker->wake));
+    }
+
+    /* Free & clear allocated resources */
+    for (idx = 0; idx < enginectx->count; idx++)
+        FREE_AND_NULLIFY((enginectx->streams)[idx]);
+    FREE_AND_NULLIFY(enginectx->streams);
+    FREE_AND_NULLIFY(enginectx->workers);
+    pthread_cond_destroy(&(enginectx->balance));
+    pthread_cond_destroy(&(enginectx->done));
+    pthread_mutex_destroy(&(enginectx->lock));
+    FREE_AND_NULLIFY(*engine);
+}
+
+static void *engine_worker_run(void *arg)
+{
+    engine_worker_t   *worker   = (engine_worker_t *)(arg);
+    engine_internal_t *engine   = worker->engine;
+    engine_command_t  *commands = NULL;
+    engine_command_t  *command  = NULL;
+    error_context_t    errors   = {};
+    error_context_t   *errctx   = &errors;
+    fmp4_pool_t        pool     = NULL;
+    bool               stop     = false;
+
+    /* Pin worker to its own CPU core if requested */
+#ifdef __linux__
+    if ((engine->options).pin)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->index % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+#endif
+
+    /* Setup the event loop owned by this worker */
+    pool = fmp4_pool_create(errctx);
+    error_log_saved(errctx, "Failed to create engine worker pool");
+
+    while (!stop)
+    {
+        /* Grab pending commands, sleep while there is nothing to service */
+        pthread_mutex_lock(&(engine->lock));
+        while (!engine->stop && !worker->commands && !worker->count)
+            pthread_cond_wait(&(worker->wake), &(engine->lock));
+        commands = worker->commands;
+        worker->commands = NULL;
+        stop = engine->stop;
+        pthread_mutex_unlock(&(engine->lock));
+
+        /* Execute commands against the event loop */
+        while ((command = commands))
+        {
+            commands = command->next;
+            if (command->type == ENGINE_COMMAND_ATTACH)
+            {
+                command->stream->attached = pool && fmp4_pool_attach(pool,
+                        command->stream->fmp4, engine_dispatch, command->stream,
+                        command->stream->errctx);
+                pthread_mutex_lock(&(engine->lock));
+                if (command->stream->attached)
+                    (worker->count)++;
+                command->stream->migrating = false;
+                pthread_cond_broadcast(&(engine->done));
+                pthread_mutex_unlock(&(engine->lock));
+                continue;
+            }
+
+            /* Detach, then either hand over to the target or signal done */
+            fmp4_pool_detach(pool, command->stream->fmp4);
+            pthread_mutex_lock(&(engine->lock));
+            if (command->stream->attached)
+                (worker->count)--;
+            command->stream->attached = false;
+            if (command->target != ENGINE_NO_WORKER && !engine->stop)
+            {
+                command->stream->worker = command->target;
+                (command->stream->command).type = ENGINE_COMMAND_ATTACH;
+                engine_post(engine, command->target, &(command->stream->command));
+            }
+            else
+            {
+                command->stream->migrating = false;
+                command->done = true;
+                pthread_cond_broadcast(&(engine->done));
+            }
+            pthread_mutex_unlock(&(engine->lock));
+        }
+
+        /* Execute one iteration of the event loop */
+        if (!stop && pool && !fmp4_pool_service(pool, (engine->options).timeout,
+                    errctx))
+            error_log_saved(errctx, "Engine worker event loop failed");
+    }
+
+    /* Detaches all remaining streams */
+    fmp4_pool_destroy(&pool);
+
+    return NULL;
+}
+
+static void *engine_balancer_run(void *arg)
+{
+    engine_internal_t *engine   = (engine_internal_t *)(arg);
+    struct timespec    deadline = {};
+    int64_t            last     = current_time_milliseconds();
+    int64_t            now      = 0;
+
+    pthread_mutex_lock(&(engine->lock));
+    while (!engine->stop)
+    {
+        /* Sleep for one rebalance interval */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (engine->options).rebalance_interval / 1000;
+        deadline.tv_nsec += ((engine->options).rebalance_interval % 1000) *
+            1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&(engine->balance), &(engine->lock), &deadline);
+        if (engine->stop)
+            break;
+
+        /* Measure stream rates and migrate at most one stream */
+        now = current_time_milliseconds();
+        if (now > last)
+            engine_rebalance(engine, (now - last) / 1000.0);
+        last = now;
+    }
+    pthread_mutex_unlock(&(engine->lock));
+
+    return NULL;
+}
+
+static void
+engine_post(engine_internal_t *engine,
+            size_t             worker,
+            engine_command_t  *command)
+{
+    engine_command_t **tail = &((engine->workers)[worker].commands);
+
+    /* Append command to the worker queue, caller holds the engine lock */
+    command->next = NULL;
+    while (*tail)
+        tail = &((*tail)->next);
+    *tail = command;
+    pthread_cond_signal(&((engine->workers)[worker].wake));
+}
+
+static size_t engine_least_loaded(const engine_internal_t *engine)
+{
+    const engine_worker_t *worker = NULL;
+    size_t                 best   = 0;
+    size_t                 idx    = 0;
+
+    /* Prefer lowest measured rate, then lowest stream count */
+    for (idx = 1; idx < engine->worker_count; idx++)
+    {
+        worker = &((engine->workers)[idx]);
+        if (worker->rate < (engine->workers)[best].rate ||
+            (worker->rate == (engine->workers)[best].rate &&
+             worker->count < (engine->workers)[best].count))
+            best = idx;
+    }
+
+    return best;
+}
+
+static void engine_rebalance(engine_internal_t *engine, double elapsed)
+{
+    engine_stream_t *stream    = NULL;
+    engine_stream_t *candidate = NULL;
+    engine_worker_t *hot       = NULL;
+    engine_worker_t *cold      = NULL;
+    uint64_t         bytes     = 0;
+    double           gap       = 0;
+    double           distance  = 0;
+    double           best      = 0;
+    size_t           idx       = 0;
+
+    /* Measure bytes/sec per stream and aggregate per worker */
+    for (idx = 0; idx < engine->worker_count; idx++)
+        (engine->workers)[idx].rate = 0;
+    for (idx = 0; idx < engine->count; idx++)
+    {
+        stream = (engine->streams)[idx];
+        bytes = __atomic_load_n(&(stream->bytes), __ATOMIC_RELAXED);
+        stream->rate = (bytes - stream->bytes_last) / elapsed;
+        stream->bytes_last = bytes;
+        (engine->workers)[stream->worker].rate += stream->rate;
+    }
+
+    /* Find the hottest and coldest workers */
+    hot = cold = &((engine->workers)[0]);
+    for (idx = 1; idx < engine->worker_count; idx++)
+    {
+        if ((engine->workers)[idx].rate > hot->rate)
+            hot = &((engine->workers)[idx]);
+        if ((engine->workers)[idx].rate < cold->rate)
+            cold = &((engine->workers)[idx]);
+    }
+    if (hot == cold || hot->count < 2 ||
+        hot->rate <= cold->rate * (1 + (engine->options).rebalance_ratio))
+        return;
+
+    /* Migrate the stream that best halves the gap, which reconnects it */
+    gap = (hot->rate - cold->rate) / 2;
+    for (idx = 0; idx < engine->count; idx++)
+    {
+        stream = (engine->streams)[idx];
+        if (stream->worker != hot->index || stream->migrating ||
+            stream->rate <= 0 || stream->rate >= 2 * gap)
+            continue;
+        distance = stream->rate > gap ? stream->rate - gap : gap - stream->rate;
+        if (!candidate || distance < best)
+        {
+            candidate = stream;
+            best = distance;
+        }
+    }
+    if (!candidate)
+        return;
+
+    candidate->migrating = true;
+    (candidate->command).type = ENGINE_COMMAND_DETACH;
+    (candidate->command).target = cold->index;
+    engine_post(engine, hot->index, &(candidate->command));
+    hot->rate -= candidate->rate;
+    cold->rate += candidate->rate;
+}
+
+static bool
+engine_dispatch(const fmp4_box_t *box,
+                void             *userdata,
+                error_context_t  *errctx)
+{
+    engine_stream_t *stream = (engine_stream_t *)(userdata);
+
+    /* Account received bytes, then invoke user-provided callback */
+    __atomic_store_n(&(stream->bytes), stream->bytes + fmp4_box_size(box),
+            __ATOMIC_RELAXED);
+
+    return stream->callback(box, stream->userdata, errctx);
+}
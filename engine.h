@@ -0,0 +1,51 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   engine.h
+ * Desc:   Sharded multi-core FMP4 ingest engine interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* FMP4 ingest engine object, one pooled event loop per worker thread */
+    typedef void * fmp4_engine_t;
+
+    /* Engine options, zeroed fields select the defaults */
+    typedef struct fmp4_engine_options_t
+    {
+        size_t   workers;            // worker count, default online CPUs
+        bool     pin;                // pin worker N to CPU N
+        int      timeout;            // event loop timeout in ms, default 10
+        uint32_t rebalance_interval; // rebalance period in ms, default 5000
+        double   rebalance_ratio;    // load imbalance tolerated, default 0.25
+        bool     rebalance;          // migrate streams off busy workers,
+                                     // reconnecting them, off by default
+
+    } fmp4_engine_options_t;
+
+    /* Engine public functions, streams are connected when added and their
+     * errors saved to the errctx given when adding them, which must stay
+     * valid until they are removed */
+    fmp4_engine_t fmp4_engine_create(const fmp4_engine_options_t *options,
+            error_context_t *errctx);
+    bool fmp4_engine_add(fmp4_engine_t engine, fmp4_t fmp4,
+            fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+    void fmp4_engine_remove(fmp4_engine_t engine, fmp4_t fmp4);
+    size_t fmp4_engine_workers(fmp4_engine_t engine);
+    void fmp4_engine_destroy(fmp4_engine_t *engine);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,23 +7,30 @@
 
 #include <stdio.h>
 
-#include <cJSON.h>
 #include <librtmp/rtmp.h>
 #include <libwebsockets.h>
 
 #include "common.h"
+#include "dns.h"
 #include "error.h"
 #include "transport.h"
 #include "websocket.h"
 
 static fmp4_transport_context_t fmp4_transport_evowebsocket_context(
-        error_context_t *errctx);
+        fmp4_arena_t *arena, error_context_t *errctx);
 static bool fmp4_transport_evowebsocket_probe(const char *url);
 static int evowebsocket_event_handler(struct lws *wsi,
         enum lws_callback_reasons reason, void *data, void *in, size_t length);
-static bool evowebsocket_send_event(const context_t *evowsctx,
+static bool evowebsocket_option(fmp4_transport_context_t ctx,
+        fmp4_option_t option, int64_t *value, bool set,
+        error_context_t *errctx);
+static bool evowebsocket_send_pending(context_t *evowsctx, struct lws *wsi,
+        error_context_t *errctx);
+static bool evowebsocket_send_event(context_t *evowsctx, struct lws *wsi,
         const char *event_type, error_context_t *errctx);
-static bool evowebsocket_traverse_frame(const context_t *evowsctx,
+static void evowebsocket_parse_response(context_t *evowsctx,
+        struct lws *wsi, const uint8_t *frame, size_t length);
+static bool evowebsocket_traverse_frame(context_t *evowsctx, struct lws *wsi,
         const uint8_t *frame, size_t length, error_context_t *errctx);
 
 static fmp4_transport_t evowebsocket =
@@ -36,26 +43,48 @@ static fmp4_transport_t evowebsocket =
     .connect = fmp4_transport_websocket_connect,
     .recv    = fmp4_transport_websocket_recv,
     .fini    = fmp4_transport_websocket_fini,
+
+    .loop_create  = fmp4_transport_websocket_loop_create,
+    .loop_service = fmp4_transport_websocket_loop_service,
+    .loop_destroy = fmp4_transport_websocket_loop_destroy,
+    .attach       = fmp4_transport_websocket_attach,
+    .detach       = fmp4_transport_websocket_detach,
+
+    .pollfds      = fmp4_transport_websocket_pollfds,
+    .next_timeout = fmp4_transport_websocket_next_timeout,
+    .service_fd   = fmp4_transport_websocket_service_fd,
+
+    /* Handshakes need the exact poll events only lws' poll fd callbacks
+     * tell, without them fmp4_connect_many() connects on threads */
+#ifdef LWS_WITH_EXTERNAL_POLL
+    .connect_start   = fmp4_transport_websocket_connect_start,
+    .connect_service = fmp4_transport_websocket_connect_service,
+#endif
+
+    .option       = evowebsocket_option,
+    .flow         = fmp4_transport_websocket_flow,
+    .prewarm      = fmp4_transport_websocket_prewarm,
 };
 
 REGISTER_TRANSPORT(evowebsocket);
 
 static fmp4_transport_context_t
-fmp4_transport_evowebsocket_context(error_context_t *errctx)
+fmp4_transport_evowebsocket_context(fmp4_arena_t    *arena,
+                                    error_context_t *errctx)
 {
-    /* Allocate WebSocket context */
-    context_t *wsctx = (context_t *)(calloc(1, sizeof(context_t)));
-    error_save_retval_if(!wsctx, errctx, errno, NULL);
+    /* Allocate WebSocket context from the stream arena */
+    context_t *wsctx = (context_t *)(fmp4_arena_alloc(arena,
+                sizeof(context_t), errctx));
+    if (!wsctx)
+        return NULL;
 
     /* Setup WebSocket protocols */
-    (wsctx->protocols)[0].name = "";
-    (wsctx->protocols)[0].callback = evowebsocket_event_handler;
-    (wsctx->protocols)[0].per_session_data_size = sizeof(context_t);
-    (wsctx->protocols)[0].rx_buffer_size = 4 * 1024 * 1024;
-    (wsctx->protocols)[0].id = 0;
-    (wsctx->protocols)[0].user = NULL;
-    (wsctx->protocols)[0].tx_packet_size = 0;
-    (wsctx->protocols)[0].user = wsctx;
+    websocket_setup_protocols(wsctx->protocols, evowebsocket_event_handler,
+            wsctx);
+
+    /* Setup keepalive defaults */
+    wsctx->ping_interval = WEBSOCKET_DEFAULT_PING_INTERVAL * 1000LL;
+    wsctx->ping_rtt = -1;
 
     return (fmp4_transport_context_t)(wsctx);
 }
@@ -96,39 +125,76 @@ evowebsocket_event_handler(struct lws                *wsi,
     if (!wsi)
         return 0;
 
+    /* Socket events of the private event loop carry no stream */
+    if (websocket_track_pollfd(wsi, reason, in))
+        return 0;
+
     /* Obtain WebSocket protocol context */
     protocol = lws_get_protocol(wsi);
     if (!protocol)
         return 0;
 
-    /* Obtain WebSocket internal user context */
-    evowsctx = (context_t *)(protocol->user);
+    /* Obtain WebSocket internal user context, from the wsi if bound */
+    evowsctx = (context_t *)(data ? data : protocol->user);
     if (!evowsctx)
         return 0;
 
+    /* Connections closed for a reconnect were unbound, their late events
+     * must not reach the stream, even while the next one awaits its host */
+    if (!data && evowsctx->wsi != wsi && reason != LWS_CALLBACK_PROTOCOL_DESTROY)
+        return 0;
+
     /* Handle WebSocket event based on reason */
     switch (reason)
     {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
-            if (!evowebsocket_send_event(evowsctx, "PLAY", evowsctx->errctx))
-                return -1;
-            (evowsctx->request_count)++;
+            memset(evowsctx->ping_sent, 0, sizeof(evowsctx->ping_sent));
+            evowsctx->play_pending = true;
+            evowsctx->ping_pending = false;
             evowsctx->connected = true;
+            lws_callback_on_writable(wsi);
+            if (evowsctx->ping_interval)
+                lws_set_timer_usecs(wsi, evowsctx->ping_interval);
         break;
         case LWS_CALLBACK_CLIENT_WRITEABLE:
-            if (!evowebsocket_send_event(evowsctx, "PING", evowsctx->errctx))
+            if (!evowebsocket_send_pending(evowsctx, wsi, evowsctx->errctx))
                 return -1;
-            (evowsctx->request_count)++;
+        break;
+        case LWS_CALLBACK_TIMER:
+            evowsctx->ping_pending = true;
+            lws_callback_on_writable(wsi);
+            if (evowsctx->ping_interval)
+                lws_set_timer_usecs(wsi, evowsctx->ping_interval);
         break;
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            if (!evowebsocket_traverse_frame(evowsctx, frame, length, evowsctx->errctx))
+            if (!lws_frame_is_binary(wsi))
+                evowebsocket_parse_response(evowsctx, wsi, frame, length);
+            else if (!evowebsocket_traverse_frame(evowsctx, wsi, frame, length,
+                        evowsctx->errctx))
                 return -1;
             (evowsctx->response_count)++;
         break;
-        case LWS_CALLBACK_CLOSED:
-        case LWS_CALLBACK_PROTOCOL_DESTROY:
         case LWS_CALLBACK_WSI_DESTROY:
+            if (evowsctx->wsi == wsi)
+                evowsctx->wsi = NULL;
+            evowsctx->connected = false;
+            evowsctx->error = true;
+            if (evowsctx->pooled)
+                error_save(evowsctx->errctx, ECONNRESET);
+            return -1;
+        case LWS_CALLBACK_CLOSED:
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            /* Pooled streams are not waited on, their errctx tells the
+             * owner the connection dropped. A cached address which could
+             * not be connected to is looked up again next time */
+            evowsctx->error = true;
+            if (reason == LWS_CALLBACK_CLIENT_CONNECTION_ERROR)
+                dns_evict(evowsctx->hostname, evowsctx->address);
+            if (evowsctx->pooled)
+                error_save(evowsctx->errctx, reason == LWS_CALLBACK_CLOSED ?
+                        ECONNRESET : ECONNREFUSED);
+            return -1;
+        case LWS_CALLBACK_PROTOCOL_DESTROY:
             evowsctx->error = true;
             return -1;
         default: break;
@@ -138,83 +204,177 @@ evowebsocket_event_handler(struct lws                *wsi,
 }
 
 static bool
-evowebsocket_send_event(const context_t *evowsctx,
-                        const char      *event_type,
-                        error_context_t *errctx)
+evowebsocket_option(fmp4_transport_context_t  ctx,
+                    fmp4_option_t             option,
+                    int64_t                  *value,
+                    bool                      set,
+                    error_context_t          *errctx)
 {
-    /* JSON instances & flag */
-    const cJSON *node     = NULL;
-    cJSON       *root     = NULL;
-    uint8_t     *buffer   = NULL;
-    char        *json     = NULL;
-    size_t       json_len = 0;
-    int          ret      = 0;
-    bool         result   = false;
+    context_t *evowsctx = (context_t *)(ctx);
 
     /* Sanity checks */
-    if (!evowsctx || !event_type || !errctx || !evowsctx->wsi)
-        error_save_jump(errctx, EINVAL, CLEANUP);
-
-    /* Compose & serialize event JSON object */
-    root = cJSON_CreateObject();
-    error_save_jump_if(!root, errctx, ENOMEM, CLEANUP);
-    node = cJSON_AddStringToObject(root, "eventType", event_type);
-    error_save_jump_if(!node, errctx, ENOMEM, CLEANUP);
-    node = cJSON_AddNumberToObject(root, "requestId", evowsctx->request_count);
-    error_save_jump_if(!node, errctx, ENOMEM, CLEANUP);
-    node = cJSON_AddNumberToObject(root, "timeStamp", current_time_milliseconds());
-    error_save_jump_if(!node, errctx, ENOMEM, CLEANUP);
-    json = cJSON_PrintUnformatted(root);
-    error_save_jump_if(!json, errctx, ENOMEM, CLEANUP);
+    if (!evowsctx || !value || !errctx)
+        error_save_retval(errctx, EINVAL, false);
 
-    /* Send the JSON event object */
-    json_len = strnlen(json, MAX_STR_LEN);
-    buffer = (uint8_t *)(calloc(1, LWS_PRE + json_len));
-    error_save_jump_if(!buffer, errctx, ENOMEM, CLEANUP);
-    memcpy(buffer + LWS_PRE, json, json_len);
-    ret = lws_write(evowsctx->wsi, buffer + LWS_PRE, json_len, LWS_WRITE_TEXT);
-    error_save_jump_if(ret < 0, errctx, ENOMEM, CLEANUP);
+    switch (option)
+    {
+        case FMP4_OPTION_PING_INTERVAL:
+            if (!set)
+            {
+                *value = evowsctx->ping_interval / 1000;
+                return true;
+            }
+            error_save_retval_if(*value < 0 || *value > INT32_MAX, errctx,
+                    EINVAL, false);
+            evowsctx->ping_interval = *value * 1000;
+
+            /* Rearm the timer of a live connection right away */
+            if (evowsctx->wsi && evowsctx->connected)
+                lws_set_timer_usecs(evowsctx->wsi, evowsctx->ping_interval ?
+                        evowsctx->ping_interval : LWS_SET_TIMER_USEC_CANCEL);
+            return true;
+        case FMP4_OPTION_PING_RTT:
+            error_save_retval_if(set, errctx, EINVAL, false);
+            *value = evowsctx->ping_rtt;
+            return true;
+        default: break;
+    }
+
+    /* The rest are common to WebSocket transports */
+    return fmp4_transport_websocket_option(ctx, option, value, set, errctx);
+}
+
+static bool
+evowebsocket_send_pending(context_t       *evowsctx,
+                          struct lws      *wsi,
+                          error_context_t *errctx)
+{
+    const char *event_type = NULL;
 
-    result = true;
+    /* Only one write is allowed per writable callback, PLAY goes first */
+    if (evowsctx->play_pending)
+    {
+        event_type = "PLAY";
+        evowsctx->play_pending = false;
+    }
+    else if (evowsctx->ping_pending)
+    {
+        event_type = "PING";
+        evowsctx->ping_pending = false;
+    }
+    else
+        return true;
 
-CLEANUP:
+    if (!evowebsocket_send_event(evowsctx, wsi, event_type, errctx))
+        return false;
+    (evowsctx->request_count)++;
 
-    FREE_AND_NULLIFY(buffer);
-    FREE_AND_NULLIFY(json);
-    cJSON_Delete(root); // null check inside
-    root = NULL;
+    /* Ask for another writable callback for a PING queued behind PLAY */
+    if (evowsctx->ping_pending)
+        lws_callback_on_writable(wsi);
 
-    return result;
+    return true;
 }
 
 static bool
-evowebsocket_traverse_frame(const context_t *evowsctx,
-                            const uint8_t   *frame,
-                            size_t           length,
-                            error_context_t *errctx)
+evowebsocket_send_event(context_t       *evowsctx,
+                        struct lws      *wsi,
+                        const char      *event_type,
+                        error_context_t *errctx)
 {
-    const fmp4_box_t *box = NULL;
-    const uint8_t   *end = frame + length;
+    char   *message = NULL;
+    size_t  slot    = 0;
+    int     length  = 0;
+    int     ret     = 0;
 
     /* Sanity checks */
-    if (!evowsctx || !frame || !evowsctx->errctx || !evowsctx->callback)
+    if (!evowsctx || !wsi || !event_type || !errctx)
         error_save_retval(errctx, EINVAL, false);
 
-    /* Check whether the frame is an event response or a FMP4 frame */
-    if (*frame == '{' && length < WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH)
-        return true;
-
-    /* Parse all FMP4 boxes in this WebSocket frame */
-    #define NEXT_BOX_ADDRESS() ((const uint8_t *)(box) + ntohl(box->size))
-    for (box = (const fmp4_box_t *)(frame);
-         box < (const fmp4_box_t *)(end);
-         box = (const fmp4_box_t *)(NEXT_BOX_ADDRESS()))
+    /* Compose the event JSON object in place, after the LWS_PRE headroom */
+    message = (char *)(evowsctx->control + LWS_PRE);
+    length = snprintf(message, WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH,
+            "{\"eventType\":\"%s\",\"requestId\":%u,\"timeStamp\":%lld}",
+            event_type, evowsctx->request_count,
+            (long long)(current_time_milliseconds()));
+    error_save_retval_if(length < 0 ||
+            length >= WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH, errctx, EMSGSIZE,
+            false);
+
+    /* Remember when a PING left, to time its response */
+    if (strcmp(event_type, "PING") == 0)
     {
-        /* Invoke user-provided callback with FMP4 box */
-        if (!evowsctx->callback(box, evowsctx->userdata, evowsctx->errctx))
-            error_save_retval(evowsctx->errctx, errno, false);
+        slot = evowsctx->request_count % WEBSOCKET_PING_SLOTS;
+        (evowsctx->ping_ids)[slot] = evowsctx->request_count;
+        (evowsctx->ping_sent)[slot] = current_monotonic_microseconds();
+        (evowsctx->ping_count)++;
     }
 
+    /* Send the JSON event object */
+    ret = lws_write(wsi, (uint8_t *)(message), (size_t)(length),
+            LWS_WRITE_TEXT);
+    error_save_retval_if(ret < 0, errctx, EIO, false);
+
     return true;
 }
 
+static void
+evowebsocket_parse_response(context_t     *evowsctx,
+                            struct lws    *wsi,
+                            const uint8_t *frame,
+                            size_t         length)
+{
+    static const char  key[] = "\"requestId\"";
+    const uint8_t     *end   = frame + length;
+    const uint8_t     *ptr   = NULL;
+    uint64_t           id    = 0;
+    size_t             slot  = 0;
+    bool               digit = false;
+
+    /* Responses are small, fragmented text frames are not control ones */
+    if (!frame || !lws_is_first_fragment(wsi) || !lws_is_final_fragment(wsi))
+        return;
+
+    /* Locate the requestId member & parse its value */
+    for (ptr = frame; ptr + sizeof(key) - 1 <= end; ptr++)
+        if (memcmp(ptr, key, sizeof(key) - 1) == 0)
+            break;
+    if (ptr + sizeof(key) - 1 > end)
+        return;
+    for (ptr += sizeof(key) - 1; ptr < end && (*ptr == ' ' || *ptr == ':');
+            ptr++);
+    for (; ptr < end && *ptr >= '0' && *ptr <= '9' && id <= UINT32_MAX; ptr++)
+    {
+        id = id * 10 + (uint64_t)(*ptr - '0');
+        digit = true;
+    }
+    if (!digit || id > UINT32_MAX)
+        return;
+
+    /* Match the response to a PING in flight */
+    slot = id % WEBSOCKET_PING_SLOTS;
+    if (!(evowsctx->ping_sent)[slot] || (evowsctx->ping_ids)[slot] != id)
+        return;
+    evowsctx->ping_rtt = current_monotonic_microseconds() -
+        (evowsctx->ping_sent)[slot];
+    (evowsctx->ping_sent)[slot] = 0;
+}
+
+static bool
+evowebsocket_traverse_frame(context_t       *evowsctx,
+                            struct lws      *wsi,
+                            const uint8_t   *frame,
+                            size_t           length,
+                            error_context_t *errctx)
+{
+    /* Sanity checks */
+    if (!evowsctx || !wsi || !frame || !evowsctx->errctx || !evowsctx->callback)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Feed frame to the box assembler, which dispatches completed boxes */
+    return fmp4_assembler_feed(&(evowsctx->assembler), frame, length,
+            lws_is_final_fragment(wsi), lws_remaining_packet_payload(wsi),
+            evowsctx->callback, evowsctx->userdata, evowsctx->errctx) &&
+        websocket_throttle(evowsctx, wsi);
+}
+
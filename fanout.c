@@ -0,0 +1,511 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   fanout.c
+ * Desc:   Single-upstream FMP4 fan-out implementation
+ */
+
+#include "fanout.h"
+
+#define FANOUT_GOP_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct fanout_internal_t fanout_internal_t;
+typedef struct fanout_upstream_t fanout_upstream_t;
+
+typedef struct fanout_subscriber_t
+{
+    /* Upstream & index in its subscriber array */
+    fanout_upstream_t *upstream;
+    size_t             index;
+
+    /* User callback & context */
+    fmp4_buffer_function_t  callback;
+    void                   *userdata;
+    error_context_t        *errctx;
+    bool                    failed;
+
+} fanout_subscriber_t;
+
+struct fanout_upstream_t
+{
+    /* Upstream stream, serviced by the pool unless its transport can't */
+    fanout_internal_t *fanout;
+    size_t             index;
+    char              *url;
+    fmp4_t             fmp4;
+    error_context_t    errctx;
+    bool               pooled;
+    bool               failed;
+
+    /* Subscribers */
+    fanout_subscriber_t **subscribers;
+    size_t                count;
+    size_t                capacity;
+
+    /* GOP cache, init segment & every box since the last keyframe fragment,
+     * replayed to late subscribers */
+    fmp4_buffer_t  *ftyp;
+    fmp4_buffer_t  *moov;
+    fmp4_buffer_t **gop;
+    size_t          gop_count;
+    size_t          gop_capacity;
+    size_t          gop_tail;  // boxes up to & including the last mdat
+    size_t          gop_bytes;
+    bool            keyed;     // gop starts with a keyframe fragment
+
+};
+
+struct fanout_internal_t
+{
+    /* Shared event loop of pooled upstreams */
+    fmp4_pool_t pool;
+
+    /* Upstreams, one per source URL */
+    fanout_upstream_t **upstreams;
+    size_t              count;
+    size_t              capacity;
+
+};
+
+static fanout_upstream_t *fanout_upstream_open(fanout_internal_t *fanout,
+        const char *url, error_context_t *errctx);
+static void fanout_upstream_close(fanout_upstream_t *upstream);
+static void fanout_upstream_check(fanout_upstream_t *upstream);
+static bool fanout_grow(void ***array, size_t *capacity, size_t count,
+        error_context_t *errctx);
+static bool fanout_dispatch(const fmp4_box_t *box, void *userdata,
+        error_context_t *errctx);
+static void fanout_cache(fanout_upstream_t *upstream, fmp4_buffer_t *buffer);
+static void fanout_cache_drop(fanout_upstream_t *upstream, size_t count);
+static void fanout_cache_replay(fanout_subscriber_t *subscriber);
+
+fmp4_fanout_t fmp4_fanout_create(error_context_t *errctx)
+{
+    fanout_internal_t *fanout = NULL;
+
+    /* Sanity checks */
+    if (!errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal fan-out context */
+    fanout = (fanout_internal_t *)(calloc(1, sizeof(fanout_internal_t)));
+    error_save_retval_if(!fanout, errctx, errno, NULL);
+    fanout->pool = fmp4_pool_create(errctx);
+    if (!fanout->pool)
+    {
+        FREE_AND_NULLIFY(fanout);
+        error_save_retval(errctx, errno, NULL);
+    }
+
+    return (fmp4_fanout_t)(fanout);
+}
+
+fmp4_subscription_t
+fmp4_fanout_subscribe(fmp4_fanout_t           fanout,
+                      const char             *url,
+                      fmp4_buffer_function_t  callback,
+                      void                   *userdata,
+                      error_context_t        *errctx)
+{
+    fanout_internal_t   *fanoutctx  = (fanout_internal_t *)(fanout);
+    fanout_upstream_t   *upstream   = NULL;
+    fanout_subscriber_t *subscriber = NULL;
+    size_t               idx        = 0;
+
+    /* Sanity checks */
+    if (!fanoutctx || !url || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Share the upstream of this URL, opening it for the first subscriber */
+    for (idx = 0; idx < fanoutctx->count; idx++)
+    {
+        if (!strcmp((fanoutctx->upstreams)[idx]->url, url))
+        {
+            upstream = (fanoutctx->upstreams)[idx];
+            break;
+        }
+    }
+    if (!upstream)
+        upstream = fanout_upstream_open(fanoutctx, url, errctx);
+    if (!upstream)
+        return NULL;
+
+    /* Setup subscriber */
+    subscriber = (fanout_subscriber_t *)(calloc(1,
+                sizeof(fanout_subscriber_t)));
+    if (!subscriber || !fanout_grow((void ***)(&(upstream->subscribers)),
+                &(upstream->capacity), upstream->count, errctx))
+    {
+        FREE_AND_NULLIFY(subscriber);
+        if (!upstream->count)
+            fanout_upstream_close(upstream);
+        error_save_retval(errctx, ENOMEM, NULL);
+    }
+    subscriber->upstream = upstream;
+    subscriber->index = upstream->count;
+    subscriber->callback = callback;
+    subscriber->userdata = userdata;
+    subscriber->errctx = errctx;
+    (upstream->subscribers)[(upstream->count)++] = subscriber;
+
+    /* Late subscribers of a failed upstream learn about it right away,
+     * the others start at the last keyframe instead of the next one */
+    if (upstream->failed)
+        error_save(errctx, upstream->errctx.errnum);
+    else
+        fanout_cache_replay(subscriber);
+
+    return (fmp4_subscription_t)(subscriber);
+}
+
+void
+fmp4_fanout_unsubscribe(fmp4_fanout_t        fanout,
+                        fmp4_subscription_t *subscription)
+{
+    fanout_subscriber_t *subscriber = NULL;
+    fanout_subscriber_t *last       = NULL;
+    fanout_upstream_t   *upstream   = NULL;
+
+    /* Sanity checks */
+    if (!fanout || !subscription || !*subscription)
+        return;
+
+    /* Cast to internal subscriber context */
+    subscriber = (fanout_subscriber_t *)(*subscription);
+    upstream = subscriber->upstream;
+
+    /* Swap-remove subscriber, closing the upstream after the last one */
+    last = (upstream->subscribers)[--(upstream->count)];
+    (upstream->subscribers)[subscriber->index] = last;
+    last->index = subscriber->index;
+    if (!upstream->count)
+        fanout_upstream_close(upstream);
+
+    FREE_AND_NULLIFY(*subscription);
+}
+
+bool
+fmp4_fanout_service(fmp4_fanout_t    fanout,
+                    int              timeout,
+                    error_context_t *errctx)
+{
+    fanout_internal_t *fanoutctx = (fanout_internal_t *)(fanout);
+    fanout_upstream_t *upstream  = NULL;
+    size_t             idx       = 0;
+
+    /* Sanity checks */
+    if (!fanoutctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Service pooled upstreams, then those which receive on their own */
+    if (!fmp4_pool_service(fanoutctx->pool, timeout, errctx))
+        error_save_retval(errctx, errno, false);
+    for (idx = 0; idx < fanoutctx->count; idx++)
+    {
+        upstream = (fanoutctx->upstreams)[idx];
+        if (!upstream->pooled && !upstream->failed)
+            fmp4_recv(upstream->fmp4, fanout_dispatch, upstream,
+                    &(upstream->errctx));
+        fanout_upstream_check(upstream);
+    }
+
+    return true;
+}
+
+void fmp4_fanout_destroy(fmp4_fanout_t *fanout)
+{
+    fanout_internal_t *fanoutctx = NULL;
+    fanout_upstream_t *upstream  = NULL;
+
+    /* Sanity checks */
+    if (!fanout || !*fanout)
+        return;
+
+    /* Cast to internal fan-out context */
+    fanoutctx = (fanout_internal_t *)(*fanout);
+
+    /* Free remaining subscriptions along with their upstreams */
+    while (fanoutctx->count)
+    {
+        upstream = (fanoutctx->upstreams)[fanoutctx->count - 1];
+        for (; upstream->count; upstream->count--)
+            FREE_AND_NULLIFY((upstream->subscribers)[upstream->count - 1]);
+        fanout_upstream_close(upstream);
+    }
+
+    /* Free & clear allocated resources */
+    fmp4_pool_destroy(&(fanoutctx->pool));
+    FREE_AND_NULLIFY(fanoutctx->upstreams);
+    FREE_AND_NULLIFY(*fanout);
+}
+
+fmp4_buffer_t *fmp4_buffer_ref(fmp4_buffer_t *buffer)
+{
+    /* Sanity checks */
+    if (!buffer)
+        return NULL;
+
+    __atomic_add_fetch(&(buffer->refs), 1, __ATOMIC_RELAXED);
+
+    return buffer;
+}
+
+void fmp4_buffer_unref(fmp4_buffer_t *buffer)
+{
+    /* Sanity checks */
+    if (!buffer)
+        return;
+
+    /* Free buffer with its last reference */
+    if (__atomic_sub_fetch(&(buffer->refs), 1, __ATOMIC_ACQ_REL) == 0)
+        free(buffer);
+}
+
+static fanout_upstream_t *
+fanout_upstream_open(fanout_internal_t *fanout,
+                     const char        *url,
+                     error_context_t   *errctx)
+{
+    fanout_upstream_t *upstream = NULL;
+    bool               result   = false;
+
+    /* Setup upstream */
+    if (!fanout_grow((void ***)(&(fanout->upstreams)), &(fanout->capacity),
+                fanout->count, errctx))
+        return NULL;
+    upstream = (fanout_upstream_t *)(calloc(1, sizeof(fanout_upstream_t)));
+    error_save_jump_if(!upstream, errctx, ENOMEM, CLEANUP);
+    upstream->fanout = fanout;
+    upstream->url = strdup(url);
+    error_save_jump_if(!upstream->url, errctx, ENOMEM, CLEANUP);
+    upstream->fmp4 = fmp4_create(url, errctx);
+    error_save_jump_if(!upstream->fmp4, errctx, errno, CLEANUP);
+
+    /* Prefer the shared event loop, fall back to receiving directly */
+    upstream->pooled = fmp4_pool_attach(fanout->pool, upstream->fmp4,
+            fanout_dispatch, upstream, &(upstream->errctx));
+    if (!upstream->pooled)
+    {
+        error_save_jump_if(upstream->errctx.errnum != EPROTONOSUPPORT,
+                errctx, upstream->errctx.errnum, CLEANUP);
+        error_clear(&(upstream->errctx));
+        if (!fmp4_connect(upstream->fmp4, &(upstream->errctx)))
+            error_save_jump(errctx, upstream->errctx.errnum, CLEANUP);
+    }
+
+    upstream->index = fanout->count;
+    (fanout->upstreams)[(fanout->count)++] = upstream;
+    result = true;
+
+CLEANUP:
+
+    if (!result && upstream)
+    {
+        fmp4_destroy(&(upstream->fmp4));
+        FREE_AND_NULLIFY(upstream->url);
+        FREE_AND_NULLIFY(upstream);
+    }
+
+    return upstream;
+}
+
+static void fanout_upstream_close(fanout_upstream_t *upstream)
+{
+    fanout_internal_t *fanout = upstream->fanout;
+    fanout_upstream_t *last   = NULL;
+
+    /* Destroying the stream detaches it from the pool */
+    fmp4_destroy(&(upstream->fmp4));
+
+    /* Swap-remove upstream from the fan-out */
+    last = (fanout->upstreams)[--(fanout->count)];
+    (fanout->upstreams)[upstream->index] = last;
+    last->index = upstream->index;
+
+    /* Free allocated resources */
+    fanout_cache_drop(upstream, upstream->gop_count);
+    fmp4_buffer_unref(upstream->ftyp);
+    fmp4_buffer_unref(upstream->moov);
+    FREE_AND_NULLIFY(upstream->gop);
+    FREE_AND_NULLIFY(upstream->subscribers);
+    FREE_AND_NULLIFY(upstream->url);
+    FREE_AND_NULLIFY(upstream);
+}
+
+static void fanout_upstream_check(fanout_upstream_t *upstream)
+{
+    size_t idx = 0;
+
+    /* Hand a new upstream failure to every subscriber */
+    if (upstream->failed || !upstream->errctx.errnum)
+        return;
+    upstream->failed = true;
+    for (idx = 0; idx < upstream->count; idx++)
+        error_save((upstream->subscribers)[idx]->errctx,
+                upstream->errctx.errnum);
+}
+
+static bool
+fanout_grow(void            ***array,
+            size_t            *capacity,
+            size_t             count,
+            error_context_t   *errctx)
+{
+    void   **grown  = NULL;
+    size_t   target = 0;
+
+    /* Grow pointer array geometrically */
+    if (count < *capacity)
+        return true;
+    target = MAX(*capacity * 2, 16);
+    grown = (void **)(realloc(*array, target * sizeof(void *)));
+    error_save_retval_if(!grown, errctx, ENOMEM, false);
+    *array = grown;
+    *capacity = target;
+
+    return true;
+}
+
+static bool
+fanout_dispatch(const fmp4_box_t *box,
+                void             *userdata,
+                error_context_t  *errctx)
+{
+    fanout_upstream_t   *upstream   = (fanout_upstream_t *)(userdata);
+    fanout_subscriber_t *subscriber = NULL;
+    fmp4_buffer_t       *buffer     = NULL;
+    uint64_t             size       = fmp4_box_size(box);
+    size_t               idx        = 0;
+
+    /* Copy the box once into a buffer shared by all subscribers */
+    buffer = (fmp4_buffer_t *)(malloc(sizeof(fmp4_buffer_t) + size));
+    error_save_retval_if(!buffer, errctx, ENOMEM, false);
+    buffer->refs = 1;
+    buffer->size = size;
+    memcpy(buffer->data, box, size);
+
+    /* Invoke subscriber callbacks, a failing subscriber gets no more boxes */
+    for (idx = 0; idx < upstream->count; idx++)
+    {
+        subscriber = (upstream->subscribers)[idx];
+        if (subscriber->failed)
+            continue;
+        if (!subscriber->callback(buffer, subscriber->userdata,
+                    subscriber->errctx))
+        {
+            subscriber->failed = true;
+            error_save(subscriber->errctx, errno ? errno : ECANCELED);
+        }
+    }
+    fanout_cache(upstream, buffer);
+    fmp4_buffer_unref(buffer);
+
+    return true;
+}
+
+static void fanout_cache(fanout_upstream_t *upstream, fmp4_buffer_t *buffer)
+{
+    const fmp4_box_t *box      = (const fmp4_box_t *)(buffer->data);
+    error_context_t   errctx   = {};
+    bool              keyframe = false;
+
+    switch (ntohl(box->type))
+    {
+        /* A new init segment invalidates everything cached before it */
+        case FMP4_FOURCC('f', 't', 'y', 'p'):
+            fmp4_buffer_unref(upstream->ftyp);
+            fmp4_buffer_unref(upstream->moov);
+            upstream->ftyp = fmp4_buffer_ref(buffer);
+            upstream->moov = NULL;
+            fanout_cache_drop(upstream, upstream->gop_count);
+            upstream->keyed = false;
+        return;
+        case FMP4_FOURCC('m', 'o', 'o', 'v'):
+            fmp4_buffer_unref(upstream->moov);
+            upstream->moov = fmp4_buffer_ref(buffer);
+            fanout_cache_drop(upstream, upstream->gop_count);
+            upstream->keyed = false;
+        return;
+
+        /* A keyframe fragment restarts the cache, keeping the boxes which
+         * lead it, e.g. styp or prft, fragments ahead of the first keyframe
+         * are not cached at all */
+        case FMP4_FOURCC('m', 'o', 'o', 'f'):
+            if (fmp4_parse_keyframe(box, fmp4_get_init(upstream->fmp4),
+                        &keyframe, &errctx) && keyframe)
+            {
+                fanout_cache_drop(upstream, upstream->gop_tail);
+                upstream->keyed = true;
+            }
+            else if (!upstream->keyed)
+            {
+                fanout_cache_drop(upstream, upstream->gop_count);
+                return;
+            }
+        break;
+        case FMP4_FOURCC('m', 'd', 'a', 't'):
+            if (!upstream->keyed)
+            {
+                fanout_cache_drop(upstream, upstream->gop_count);
+                return;
+            }
+        break;
+        default: break;
+    }
+
+    /* Streams without keyframes in sight are not cached past the budget */
+    error_clear(&errctx);
+    if (upstream->gop_bytes + buffer->size > FANOUT_GOP_MAX_BYTES ||
+        !fanout_grow((void ***)(&(upstream->gop)), &(upstream->gop_capacity),
+            upstream->gop_count, &errctx))
+    {
+        fanout_cache_drop(upstream, upstream->gop_count);
+        upstream->keyed = false;
+        return;
+    }
+    (upstream->gop)[(upstream->gop_count)++] = fmp4_buffer_ref(buffer);
+    upstream->gop_bytes += buffer->size;
+    if (ntohl(box->type) == FMP4_FOURCC('m', 'd', 'a', 't'))
+        upstream->gop_tail = upstream->gop_count;
+}
+
+static void fanout_cache_drop(fanout_upstream_t *upstream, size_t count)
+{
+    size_t idx = 0;
+
+    /* Release the oldest cached boxes & move the others to the front */
+    for (idx = 0; idx < count; idx++)
+    {
+        upstream->gop_bytes -= (upstream->gop)[idx]->size;
+        fmp4_buffer_unref((upstream->gop)[idx]);
+    }
+    upstream->gop_count -= count;
+    if (upstream->gop_count)
+        memmove(upstream->gop, upstream->gop + count,
+                upstream->gop_count * sizeof(fmp4_buffer_t *));
+    upstream->gop_tail = upstream->gop_tail > count ?
+        upstream->gop_tail - count : 0;
+}
+
+static void fanout_cache_replay(fanout_subscriber_t *subscriber)
+{
+    fanout_upstream_t *upstream = subscriber->upstream;
+    fmp4_buffer_t     *buffer   = NULL;
+    size_t             idx      = 0;
+
+    /* Init segment first, then the cached fragments in receive order */
+    for (idx = 0; idx < upstream->gop_count + 2; idx++)
+    {
+        buffer = idx == 0 ? upstream->ftyp : idx == 1 ? upstream->moov :
+            (upstream->gop)[idx - 2];
+        if (!buffer)
+            continue;
+        if (!subscriber->callback(buffer, subscriber->userdata,
+                    subscriber->errctx))
+        {
+            subscriber->failed = true;
+            error_save(subscriber->errctx, errno ? errno : ECANCELED);
+            return;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   fanout.h
+ * Desc:   Single-upstream FMP4 fan-out interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Refcounted immutable copy of a received box, shared by every
+     * subscriber of the upstream it was received from */
+    typedef struct fmp4_buffer_t
+    {
+        uint32_t refs;   // use fmp4_buffer_ref() & fmp4_buffer_unref()
+        size_t   size;   // box size
+        uint8_t  data[]; // box, never to be modified
+
+    } fmp4_buffer_t;
+
+    /* Callback for shared box buffers, the buffer is released after the
+     * callback returns unless the callback took a reference on it */
+    typedef bool (*fmp4_buffer_function_t)(fmp4_buffer_t *buffer,
+            void *userdata, error_context_t *errctx);
+
+    /* FMP4 fan-out object, keeps one upstream stream per source URL and
+     * hands every box it receives to all subscribers of that URL */
+    typedef void * fmp4_fanout_t;
+
+    /* FMP4 fan-out subscription object */
+    typedef void * fmp4_subscription_t;
+
+    /* Fan-out public functions, all but the buffer functions must be called
+     * from the thread servicing the fan-out, not from within callbacks,
+     * upstream & callback errors are saved to the subscriber errctx which
+     * must stay valid until unsubscribing, subscribers joining a running
+     * upstream first get its init segment & the fragments since the last
+     * keyframe from within fmp4_fanout_subscribe() */
+    fmp4_fanout_t fmp4_fanout_create(error_context_t *errctx);
+    fmp4_subscription_t fmp4_fanout_subscribe(fmp4_fanout_t fanout,
+            const char *url, fmp4_buffer_function_t callback, void *userdata,
+            error_context_t *errctx);
+    void fmp4_fanout_unsubscribe(fmp4_fanout_t fanout,
+            fmp4_subscription_t *subscription);
+    bool fmp4_fanout_service(fmp4_fanout_t fanout, int timeout,
+            error_context_t *errctx);
+    void fmp4_fanout_destroy(fmp4_fanout_t *fanout);
+
+    /* Shared box buffer public functions, safe from any thread */
+    fmp4_buffer_t *fmp4_buffer_ref(fmp4_buffer_t *buffer);
+    void fmp4_buffer_unref(fmp4_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
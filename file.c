@@ -0,0 +1,224 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   file.c
+ * Desc:   FMP4 stream from memory-mapped file transport implementation
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "error.h"
+#include "file.h"
+#include "transport.h"
+
+static fmp4_transport_context_t fmp4_transport_file_context(
+        fmp4_arena_t *arena, error_context_t *errctx);
+static bool fmp4_transport_file_probe(const char *url);
+static void file_unmap(file_context_t *filectx);
+
+static fmp4_transport_t file =
+{
+    .name    = "file",
+    .desc    = "FMP4-from-file",
+    .context = fmp4_transport_file_context,
+    .probe   = fmp4_transport_file_probe,
+    .init    = fmp4_transport_file_init,
+    .connect = fmp4_transport_file_connect,
+    .recv    = fmp4_transport_file_recv,
+    .fini    = fmp4_transport_file_fini,
+
+    .stable_boxes = true,
+};
+
+REGISTER_TRANSPORT(file);
+
+bool
+fmp4_transport_file_init(fmp4_transport_context_t  ctx,
+                         const char               *url,
+                         fmp4_arena_t             *arena,
+                         error_context_t          *errctx)
+{
+    file_context_t *filectx = NULL;
+
+    /* Sanity checks */
+    if (!ctx || !url || !arena || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+
+    /* Copy URL string into the stream arena, the path follows the scheme */
+    filectx->url = fmp4_arena_strndup(arena, url, MAX_STR_LEN, errctx);
+    if (!filectx->url)
+        return false;
+    filectx->path = strstr(filectx->url, "://");
+    filectx->path = filectx->path ? filectx->path + sizeof("://") - 1 : NULL;
+    if (!filectx->path || !*(filectx->path))
+    {
+        filectx->url = filectx->path = NULL;
+        error_save_retval(errctx, EINVAL, false);
+    }
+
+    return true;
+}
+
+bool
+fmp4_transport_file_connect(fmp4_transport_context_t  ctx,
+                            error_context_t          *errctx)
+{
+    file_context_t *filectx = NULL;
+    struct stat     st      = {};
+    void           *map     = NULL;
+
+    /* Sanity checks */
+    if (!ctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+    error_save_retval_if(!filectx->path, errctx, EINVAL, false);
+
+    /* Reconnecting replays the recording from its beginning */
+    file_unmap(filectx);
+
+    /* Open and map the recording, the mapping is private and writable so
+     * that size 0 boxes can be given their actual size in place */
+    filectx->fd = open(filectx->path, O_RDONLY);
+    error_save_retval_if(filectx->fd < 0, errctx, errno, false);
+    if (fstat(filectx->fd, &st) < 0)
+    {
+        error_save(errctx, errno);
+        file_unmap(filectx);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode) || !st.st_size)
+    {
+        file_unmap(filectx);
+        error_save_retval(errctx, ENODATA, false);
+    }
+    map = mmap(NULL, (size_t)(st.st_size), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, filectx->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        error_save(errctx, errno);
+        file_unmap(filectx);
+        return false;
+    }
+    filectx->map = (uint8_t *)(map);
+    filectx->size = (size_t)(st.st_size);
+    filectx->offset = 0;
+
+    /* Boxes are consumed front to back, let the kernel read ahead */
+    madvise(filectx->map, filectx->size, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+bool
+fmp4_transport_file_recv(fmp4_transport_context_t  ctx,
+                         fmp4box_function_t        callback,
+                         void                     *userdata,
+                         error_context_t          *errctx)
+{
+    file_context_t  *filectx   = NULL;
+    fmp4_box_iter_t  iter      = {};
+    fmp4_box_t      *box       = NULL;
+    size_t           delivered = 0;
+
+    /* Sanity checks */
+    if (!ctx || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+    error_save_retval_if(!filectx->map, errctx, ENOTCONN, false);
+    error_save_retval_if(filectx->offset >= filectx->size, errctx,
+            ENODATA, false);
+
+    /* Hand boxes straight out of the mapping, up to a fragment per call */
+    fmp4_box_iter_init(&iter, filectx->map + filectx->offset,
+            filectx->size - filectx->offset);
+    while (delivered < FILE_MAX_RECV_LENGTH && fmp4_box_iter_next(&iter))
+    {
+        /* Give a box running to the end of file its actual size */
+        box = (fmp4_box_t *)(filectx->map + filectx->offset);
+        if (iter.unbounded)
+        {
+            error_save_retval_if(iter.size > UINT32_MAX, errctx,
+                    EMSGSIZE, false);
+            box->size = htonl((uint32_t)(iter.size));
+        }
+        filectx->offset += iter.size;
+        delivered += iter.size;
+
+        /* Invoke user-provided callback with FMP4 box */
+        if (!callback(box, userdata, errctx))
+            error_save_retval(errctx, errno, false);
+        if (ntohl(box->type) == FMP4_FOURCC('m', 'd', 'a', 't'))
+            break;
+    }
+
+    /* A box cut short by an interrupted recording ends the stream */
+    error_save_retval_if(iter.errnum == EBADMSG, errctx, EBADMSG, false);
+    if (iter.errnum)
+    {
+        filectx->offset = filectx->size;
+        error_save_retval(errctx, ENODATA, false);
+    }
+
+    return true;
+}
+
+void fmp4_transport_file_fini(fmp4_transport_context_t ctx)
+{
+    file_context_t *filectx = NULL;
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+    if (!filectx)
+        return;
+
+    /* Free allocated resources, the URL goes with the stream arena */
+    file_unmap(filectx);
+    filectx->url = filectx->path = NULL;
+}
+
+static fmp4_transport_context_t
+fmp4_transport_file_context(fmp4_arena_t    *arena,
+                            error_context_t *errctx)
+{
+    /* Allocate file context from the stream arena */
+    file_context_t *filectx = (file_context_t *)(fmp4_arena_alloc(arena,
+                sizeof(file_context_t), errctx));
+    if (!filectx)
+        return NULL;
+    filectx->fd = -1;
+
+    return (fmp4_transport_context_t)(filectx);
+}
+
+static bool fmp4_transport_file_probe(const char *url)
+{
+    /* Sanity checks */
+    if (!url)
+        return false;
+
+    /* Check if URL begins with file protocol scheme */
+    return strncmp(url, "file://", sizeof("file://") - 1) == 0;
+}
+
+static void file_unmap(file_context_t *filectx)
+{
+    /* Release mapping & descriptor of the recording */
+    if (filectx->map)
+        munmap(filectx->map, filectx->size);
+    if (filectx->fd >= 0)
+        close(filectx->fd);
+    filectx->map = NULL;
+    filectx->size = 0;
+    filectx->offset = 0;
+    filectx->fd = -1;
+}
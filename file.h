@@ -0,0 +1,69 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   file.h
+ * Desc:   FMP4 stream from memory-mapped file transports public shared function headers
+ */
+
+#pragma once
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Bytes of boxes delivered per receive, a receive always stops after
+     * the mdat box closing a fragment */
+    #define FILE_MAX_RECV_LENGTH (4 * 1024 * 1024)
+
+    /* Internal file transport context */
+    typedef struct file_context_t
+    {
+        /* Mapped recording */
+        int      fd;
+        uint8_t *map;
+        size_t   size;
+        size_t   offset; // first box not yet delivered
+
+        /* URL context */
+        char *url;
+        char *path;
+
+        /* Replay pacing, media & wall-clock times are in microseconds */
+        fmp4_init_t init;           // timescales of the recording
+        double      speed;          // media time per wall-clock time
+        bool        loop;           // restart at the first fragment on EOF
+        bool        anchored;
+        size_t      first_fragment; // offset of the first moof box
+        int64_t     anchor_wall;    // monotonic due time of anchor fragment
+        int64_t     anchor_media;   // media time of anchor fragment
+        int64_t     last_due;
+        int64_t     last_gap;
+        int64_t     last_media;     // media time of last released fragment
+
+    } file_context_t;
+
+    /* Fragments further apart than this in media time restart pacing from
+     * the next one, whatever the speed */
+    #define REPLAY_MAX_GAP_US (10 * 1000000LL)
+
+    /* Longest sleep of a paced receive, so callers stay responsive */
+    #define REPLAY_MAX_SLEEP_US (10 * 1000LL)
+
+    /* Public exported functions */
+    bool fmp4_transport_file_init(fmp4_transport_context_t ctx,
+            const char *url, fmp4_arena_t *arena, error_context_t *errctx);
+    bool fmp4_transport_file_connect(fmp4_transport_context_t ctx,
+            error_context_t *errctx);
+    bool fmp4_transport_file_recv(fmp4_transport_context_t ctx,
+            fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+    void fmp4_transport_file_fini(fmp4_transport_context_t ctx);
+
+#ifdef __cplusplus
+}
+#endif
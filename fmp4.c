@@ -5,19 +5,215 @@
  * Desc:   Source FMP4 interface header
  */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
 #include "fmp4.h"
+#include "slab.h"
 #include "transport.h"
 
+#define FMP4_INIT_CACHE_MAX 4096
+#define FMP4_NTP_UNIX_OFFSET 2208988800ULL // seconds from 1900 to 1970
+#define FMP4_RECONNECT_BASE  100   // ms
+#define FMP4_RECONNECT_CAP   30000 // ms
+
+typedef struct fmp4_pool_internal_t fmp4_pool_internal_t;
+
+/* Parsed init segment shared by every stream of the same source URL,
+ * entries are immutable once published and freed with their last user */
+typedef struct fmp4_init_entry_t
+{
+    char                     *url;
+    uint8_t                  *moov;    // copy the track configs point into
+    size_t                    moov_size;
+    fmp4_init_t               init;
+    size_t                    refs;
+    bool                      cached;  // still reachable from the cache
+    struct fmp4_init_entry_t *next;
+
+} fmp4_init_entry_t;
+
 typedef struct fmp4_internal_t
 {
     const fmp4_transport_t   *transport;
     fmp4_transport_context_t  context;
+    char                     *url;
+    fmp4_arena_t             *memory; // holds this context, transport's & URL
+
+    /* User callback, boxes are dispatched through fmp4_dispatch() */
+    fmp4box_function_t  callback;
+    void               *userdata;
+
+    /* Init segment of this stream, the ftyp box is kept to tell whether
+     * the source resent it unchanged after a reconnect */
+    fmp4_init_entry_t *init;
+    uint8_t           *ftyp;
+    size_t             ftyp_size;
+    bool               resumed;  // reconnected, no media box received yet
+
+    /* Reconnect backoff */
+    uint32_t reconnect_attempts; // since media last flowed
+    int64_t  reconnect_at;       // monotonic us the next attempt is due, 0
+                                 // if none is scheduled
+    int64_t  reconnect_base;     // ms
+    int64_t  reconnect_cap;      // ms
+    uint64_t random;             // xorshift state for the jitter
+
+    /* Bytes dispatched so far, the stream offset of the next box */
+    uint64_t offset;
+
+    /* Stream counters, updated by the receiving thread */
+    fmp4_stats_t stats;
+    int64_t      fragment_time; // monotonic ns of the last moof, 0 if none
+    bool         timing;        // time callbacks & fragment gaps
+
+    /* Latency tracking, arrival wall clock is anchored to the monotonic one
+     * at the first prft box */
+    int64_t                 wall_anchor;      // us since the Unix epoch
+    int64_t                 monotonic_anchor; // us, 0 until anchored
+    int64_t                 alert_threshold;  // us
+    fmp4_latency_function_t alert_callback;
+    void                   *alert_userdata;
+    bool                    alerting;         // latency above the threshold
+
+    /* Batch receive, boxes are collected into the caller's views & past
+     * their capacity into pending ones, handed out by the next calls */
+    fmp4_box_view_t *views;
+    size_t           views_capacity;
+    size_t           views_count;
+    fmp4_box_view_t *pending;
+    size_t           pending_count;
+    size_t           pending_capacity;
+    size_t           pending_next;
+    bool             held;   // reads stopped past the frame of a batch
+
+    /* Receive flow control, reads are stopped until drained says so */
+    bool                     paused;
+    fmp4_drained_function_t  drained;
+    void                    *drained_userdata;
+
+    /* Pool this stream is attached to */
+    fmp4_pool_internal_t *pool;
+    size_t                pool_index;
 
 } fmp4_internal_t;
 
+struct fmp4_pool_internal_t
+{
+    /* Shared event loop & the transport owning it */
+    const fmp4_transport_t *transport;
+    fmp4_transport_loop_t   loop;
+
+    /* Attached streams */
+    fmp4_internal_t **streams;
+    size_t            count;
+    size_t            capacity;
+    size_t            paused;   // attached streams with reads stopped
+
+};
+
+/* Blocking connect of a stream without background connect, run on its
+ * own thread, which signals the wake pipe once done */
+typedef struct fmp4_connect_job_t
+{
+    fmp4_internal_t *fmp4ctx;
+    pthread_t        thread;
+    int              wake;
+    int              errnum;
+    bool             done;
+
+} fmp4_connect_job_t;
+
+/* Stream in flight in fmp4_connect_many() & its slice of the pollfds */
+typedef struct fmp4_connecting_t
+{
+    fmp4_internal_t    *fmp4ctx;
+    fmp4_connect_job_t *job;
+    size_t              first;
+    size_t              count;
+
+} fmp4_connecting_t;
+
+/* Track fragment header state while parsing a traf box */
+typedef struct fmp4_traf_t
+{
+    uint32_t track_id;
+    uint32_t default_duration;
+    uint32_t default_size;
+    uint32_t default_flags;
+    uint64_t base;        // data offset base, relative to the moof
+    uint64_t cursor;      // next sample data offset, relative to the moof
+    uint64_t decode_time;
+
+} fmp4_traf_t;
+
+static pthread_mutex_t    fmp4_init_lock  = PTHREAD_MUTEX_INITIALIZER;
+static fmp4_init_entry_t *fmp4_init_cache = NULL;
+static size_t             fmp4_init_count = 0;
+
+static bool fmp4_dispatch(const fmp4_box_t *box, void *userdata,
+        error_context_t *errctx);
+static bool fmp4_batch_collect(const fmp4_box_t *box, void *userdata,
+        error_context_t *errctx);
+static bool fmp4_resume_filter(fmp4_internal_t *fmp4ctx,
+        const fmp4_box_t *box, uint64_t size);
+static void fmp4_flow_poll(fmp4_internal_t *fmp4ctx);
+static void fmp4_flow_reset(fmp4_internal_t *fmp4ctx);
+static bool fmp4_connect_begin(fmp4_connecting_t *connecting, int *wake,
+        int *errnum);
+static bool fmp4_connect_poll(fmp4_connecting_t *connecting,
+        struct pollfd *pollfds, int *errnum);
+static void *fmp4_connect_run(void *arg);
+static void fmp4_reconnect_schedule(fmp4_internal_t *fmp4ctx, int64_t now);
+static void fmp4_stats_box(fmp4_internal_t *fmp4ctx, const fmp4_box_t *box,
+        uint64_t size, int64_t now);
+static fmp4_box_stats_t *fmp4_stats_slot(fmp4_stats_t *stats, uint32_t type);
+static void fmp4_stats_latency(fmp4_internal_t *fmp4ctx, const fmp4_box_t *box,
+        uint64_t size, int64_t now);
+static uint64_t fmp4_count_samples(const fmp4_box_t *moof, uint64_t size);
+static void fmp4_stats_merge(fmp4_stats_t *into, const fmp4_stats_t *from);
+static void fmp4_init_update(fmp4_internal_t *fmp4ctx,
+        const fmp4_box_t *moov);
+static fmp4_init_entry_t *fmp4_init_lookup(const char *url);
+static void fmp4_init_publish(fmp4_init_entry_t *entry);
+static void fmp4_init_release(fmp4_init_entry_t *entry);
+static void fmp4_init_free(fmp4_init_entry_t *entry);
+static const uint8_t *fmp4_find_box(const uint8_t *body, size_t length,
+        uint32_t type, size_t *size);
+static bool fmp4_parse_trak(const uint8_t *body, size_t length,
+        fmp4_track_t *track, error_context_t *errctx);
+static bool fmp4_parse_traf(const uint8_t *body, size_t length,
+        uint64_t moof_size, const fmp4_init_t *init, uint64_t *data_end,
+        fmp4_samples_t *samples, error_context_t *errctx);
+static bool fmp4_parse_trun(const uint8_t *body, size_t length,
+        uint64_t moof_size, fmp4_traf_t *traf, fmp4_samples_t *samples,
+        error_context_t *errctx);
+
+static inline uint32_t fmp4_read_u32(const uint8_t *ptr)
+{
+    uint32_t val = 0;
+    memcpy(&val, ptr, sizeof(uint32_t));
+    return ntohl(val);
+}
+
+static inline uint64_t fmp4_read_u64(const uint8_t *ptr)
+{
+    return (uint64_t)(fmp4_read_u32(ptr)) << 32 | fmp4_read_u32(ptr + 4);
+}
+
 
 fmp4_t fmp4_create(const char *url, error_context_t *errctx)
 {
+    return fmp4_create_with_allocator(url, NULL, errctx);
+}
+
+fmp4_t
+fmp4_create_with_allocator(const char             *url,
+                           const fmp4_allocator_t *allocator,
+                           error_context_t        *errctx)
+{
+    fmp4_arena_t    *memory  = NULL;
     fmp4_internal_t *fmp4ctx = NULL;
     bool            result = false;
 
@@ -25,30 +221,48 @@ fmp4_t fmp4_create(const char *url, error_context_t *errctx)
     if (!url || !errctx)
         error_save_jump(errctx, EINVAL, CLEANUP);
 
-    /* Setup internal fmp4 context */
-    fmp4ctx = (fmp4_internal_t *)(calloc(sizeof(fmp4_internal_t), 1));
-    error_save_jump_if(!fmp4ctx, errctx, errno, CLEANUP);
+    /* Setup internal fmp4 context at the head of the stream arena */
+    memory = fmp4_arena_create(allocator, errctx);
+    if (!memory)
+        goto CLEANUP;
+    fmp4ctx = (fmp4_internal_t *)(fmp4_arena_alloc(memory,
+                sizeof(fmp4_internal_t), errctx));
+    if (!fmp4ctx)
+        goto CLEANUP;
+    fmp4ctx->memory = memory;
+    fmp4ctx->url = fmp4_arena_strndup(memory, url, MAX_STR_LEN, errctx);
+    if (!fmp4ctx->url)
+        goto CLEANUP;
 
     /* Get transport class for this URL */
     fmp4ctx->transport = fmp4_transport_class(url);
     error_save_jump_if(!fmp4ctx->transport, errctx, EPROTONOSUPPORT, CLEANUP);
 
     /* Create context for the transport class */
-    fmp4ctx->context = fmp4ctx->transport->context(errctx);
+    fmp4ctx->context = fmp4ctx->transport->context(memory, errctx);
     error_save_jump_if(!fmp4ctx->context, errctx, errno, CLEANUP);
 
     /* Initialize transport context */
-    if (!fmp4ctx->transport->init(fmp4ctx->context, url, errctx))
+    if (!fmp4ctx->transport->init(fmp4ctx->context, url, memory, errctx))
         error_save_jump(errctx, errno, CLEANUP);
 
+    /* Pick up the init segment already parsed for this source */
+    fmp4ctx->init = fmp4_init_lookup(url);
+    fmp4ctx->timing = true;
+    fmp4ctx->reconnect_base = FMP4_RECONNECT_BASE;
+    fmp4ctx->reconnect_cap = FMP4_RECONNECT_CAP;
+    fmp4ctx->random = (uint64_t)(uintptr_t)(fmp4ctx) ^
+        (uint64_t)(current_monotonic_nanoseconds()) ^ 0x9E3779B97F4A7C15ULL;
+
     result = true;
 
 CLEANUP:
 
-    if (!result && fmp4ctx)
-        FREE_AND_NULLIFY(fmp4ctx->context);
     if (!result)
-        FREE_AND_NULLIFY(fmp4ctx);
+    {
+        fmp4_arena_destroy(&memory);
+        fmp4ctx = NULL;
+    }
 
     return (fmp4_t)(fmp4ctx);
 }
@@ -67,8 +281,222 @@ bool fmp4_connect(fmp4_t fmp4, error_context_t *errctx)
         error_save_retval(errctx, EINVAL, false);
 
     /* Connect to the FMP4 stream source */
+    fmp4_flow_reset(fmp4ctx);
     if (!fmp4ctx->transport->connect(fmp4ctx->context, errctx))
         error_save_retval(errctx, errno, false);
+    (fmp4ctx->stats).reconnects += ((fmp4ctx->stats).connects++ > 0);
+
+    return true;
+}
+
+bool
+fmp4_connect_many(fmp4_t                  *streams,
+                  size_t                   count,
+                  size_t                   inflight,
+                  int                      timeout,
+                  fmp4_connect_function_t  callback,
+                  void                    *userdata,
+                  error_context_t         *errctx)
+{
+    fmp4_connecting_t *connecting = NULL;
+    fmp4_internal_t   *fmp4ctx    = NULL;
+    struct pollfd     *pollfds    = NULL;
+    struct pollfd     *grown      = NULL;
+    error_context_t    pollctx    = {};
+    size_t             active     = 0;
+    size_t             next       = 0;
+    size_t             used       = 0;
+    size_t             capacity   = 0;
+    size_t             available  = 0;
+    size_t             idx        = 0;
+    int64_t            deadline   = 0;
+    int64_t            now        = 0;
+    int                wake[2]    = { -1, -1 };
+    int                wait       = 0;
+    int                errnum     = 0;
+    char               drain[64]  = {};
+    bool               result     = false;
+
+    /* Sanity checks */
+    if ((!streams && count) || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    if (!count)
+        return true;
+
+    /* Setup in-flight set & an initial pollfds array, grown on demand */
+    inflight = (inflight && inflight < count) ? inflight : count;
+    capacity = inflight * 2 + 1;
+    connecting = (fmp4_connecting_t *)(calloc(inflight,
+                sizeof(fmp4_connecting_t)));
+    pollfds = (struct pollfd *)(calloc(capacity, sizeof(struct pollfd)));
+    error_save_jump_if(!connecting || !pollfds, errctx, ENOMEM, CLEANUP);
+    if (timeout >= 0)
+        deadline = current_monotonic_microseconds() + timeout * 1000LL;
+
+    while (next < count || active)
+    {
+        /* Start streams up to the in-flight cap, past the deadline they
+         * are not started at all */
+        while (next < count && active < inflight)
+        {
+            fmp4ctx = (fmp4_internal_t *)(streams[next++]);
+            (connecting[active]).fmp4ctx = fmp4ctx;
+            if (deadline && current_monotonic_microseconds() >= deadline)
+                callback((fmp4_t)(fmp4ctx), ETIMEDOUT, userdata);
+            else if (fmp4_connect_begin(&(connecting[active]), wake, &errnum))
+                active++;
+            else
+                callback((fmp4_t)(fmp4ctx), errnum, userdata);
+        }
+        if (!active)
+            continue;
+
+        /* Gather the wake pipe of the connect threads, the sockets of the
+         * other streams in flight & the earliest due timer of them, bounded
+         * by the deadline */
+        wait = -1;
+        if (deadline)
+            wait = (int)(MAX(deadline - current_monotonic_microseconds() +
+                        999, 0) / 1000);
+        used = 0;
+        if (wake[0] >= 0)
+        {
+            (pollfds[used]).fd = wake[0];
+            (pollfds[used++]).events = POLLIN;
+        }
+        for (idx = 0; idx < active; idx++)
+        {
+            fmp4ctx = (connecting[idx]).fmp4ctx;
+            (connecting[idx]).first = used;
+            (connecting[idx]).count = 0;
+            if ((connecting[idx]).job)
+                continue;
+            available = capacity - used;
+            error_clear(&pollctx);
+            while (!fmp4ctx->transport->pollfds(fmp4ctx->context,
+                        pollfds + used, &available, &pollctx))
+            {
+                if (pollctx.errnum != ENOBUFS)
+                {
+                    available = 0;
+                    break;
+                }
+                capacity = MAX(capacity * 2, used + available);
+                grown = (struct pollfd *)(realloc(pollfds,
+                            capacity * sizeof(struct pollfd)));
+                error_save_jump_if(!grown, errctx, ENOMEM, CLEANUP);
+                pollfds = grown;
+                available = capacity - used;
+                error_clear(&pollctx);
+            }
+            (connecting[idx]).count = available;
+            used += available;
+            wait = fmp4ctx->transport->next_timeout(fmp4ctx->context, wait);
+        }
+
+        /* Wait for any handshake to progress */
+        if (poll(pollfds, used, wait) < 0 && errno != EINTR)
+            error_save_jump(errctx, errno, CLEANUP);
+        while (wake[0] >= 0 && read(wake[0], drain, sizeof(drain)) > 0);
+
+        /* Service the streams in flight, finished ones leave the set, the
+         * blocking connects of threads past the deadline are waited on */
+        now = current_monotonic_microseconds();
+        for (idx = 0; idx < active;)
+        {
+            fmp4ctx = (connecting[idx]).fmp4ctx;
+            if (!fmp4_connect_poll(&(connecting[idx]),
+                        pollfds + (connecting[idx]).first, &errnum))
+            {
+                if (!deadline || now < deadline || (connecting[idx]).job)
+                {
+                    idx++;
+                    continue;
+                }
+                errnum = ETIMEDOUT;
+            }
+            connecting[idx] = connecting[--active];
+            callback((fmp4_t)(fmp4ctx), errnum, userdata);
+        }
+    }
+
+    result = true;
+
+CLEANUP:
+
+    /* Connect threads still own their stream, wait for them on failure */
+    for (idx = 0; connecting && idx < active; idx++)
+    {
+        if (!(connecting[idx]).job)
+            continue;
+        pthread_join((connecting[idx]).job->thread, NULL);
+        FREE_AND_NULLIFY((connecting[idx]).job);
+    }
+    if (wake[0] >= 0)
+        close(wake[0]);
+    if (wake[1] >= 0)
+        close(wake[1]);
+    FREE_AND_NULLIFY(pollfds);
+    FREE_AND_NULLIFY(connecting);
+
+    return result;
+}
+
+bool fmp4_prewarm(const char *url, error_context_t *errctx)
+{
+    const fmp4_transport_t *transport = NULL;
+
+    /* Sanity checks */
+    if (!url || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Get transport class for this URL */
+    transport = fmp4_transport_class(url);
+    error_save_retval_if(!transport, errctx, EPROTONOSUPPORT, false);
+    if (!transport->prewarm)
+        return true;
+
+    return transport->prewarm(url, errctx);
+}
+
+bool fmp4_reconnect(fmp4_t fmp4, error_context_t *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+    int64_t          now     = current_monotonic_microseconds();
+    bool             result  = false;
+
+    /* Sanity checks */
+    if (!fmp4ctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    if (!fmp4ctx->transport || !fmp4ctx->context)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Even the first attempt waits for its jitter, spreading the
+     * reconnects of streams which dropped together */
+    if (!fmp4ctx->reconnect_at)
+        fmp4_reconnect_schedule(fmp4ctx, now);
+    error_save_retval_if(now < fmp4ctx->reconnect_at, errctx, EAGAIN, false);
+    fmp4ctx->reconnect_at = 0;
+    (fmp4ctx->reconnect_attempts)++;
+
+    /* Reconnect over the transport's existing event loop, reading again */
+    fmp4_flow_reset(fmp4ctx);
+    if (fmp4ctx->pool)
+    {
+        fmp4ctx->transport->detach(fmp4ctx->context);
+        result = fmp4ctx->transport->attach(fmp4ctx->context,
+                fmp4ctx->pool->loop, fmp4_dispatch, fmp4ctx, errctx);
+    }
+    else
+        result = fmp4ctx->transport->connect(fmp4ctx->context, errctx);
+    if (!result)
+        error_save_retval(errctx, errno, false);
+
+    /* Drop staged batch views of the previous connection */
+    fmp4ctx->pending_count = fmp4ctx->pending_next = 0;
+    fmp4ctx->fragment_time = 0;
+    fmp4ctx->resumed = true;
+    (fmp4ctx->stats).reconnects += ((fmp4ctx->stats).connects++ > 0);
 
     return true;
 }
@@ -90,16 +518,72 @@ fmp4_recv(fmp4_t              fmp4,
     if (!fmp4ctx->transport || !fmp4ctx->context)
         error_save_retval(errctx, EINVAL, false);
 
-    /* Connect to the FMP4 stream source */
-    if (!fmp4ctx->transport->recv(fmp4ctx->context, callback, userdata, errctx))
+    /* Receive from the FMP4 stream source */
+    fmp4ctx->callback = callback;
+    fmp4ctx->userdata = userdata;
+    fmp4_flow_poll(fmp4ctx);
+    if (!fmp4ctx->transport->recv(fmp4ctx->context, fmp4_dispatch, fmp4ctx,
+                errctx))
         error_save_retval(errctx, errno, false);
 
     return true;
 }
 
+bool
+fmp4_recv_batch(fmp4_t           fmp4,
+                fmp4_box_view_t *views,
+                size_t          *count,
+                error_context_t *errctx)
+{
+    fmp4_internal_t *fmp4ctx = NULL;
+    fmp4_box_view_t *source  = NULL;
+    bool             result  = true;
+
+    /* Sanity checks */
+    if (!fmp4 || !views || !count || !*count || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast to internal FMP4 context */
+    fmp4ctx = (fmp4_internal_t *)(fmp4);
+    if (!fmp4ctx->transport || !fmp4ctx->context)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!fmp4ctx->transport->stable_boxes &&
+            !fmp4ctx->transport->flow, errctx, EPROTONOSUPPORT, false);
+
+    /* Hand out boxes left over from the previous receive first */
+    if (fmp4ctx->pending_next < fmp4ctx->pending_count)
+    {
+        source = fmp4ctx->pending + fmp4ctx->pending_next;
+        *count = MIN(*count, fmp4ctx->pending_count - fmp4ctx->pending_next);
+        memcpy(views, source, *count * sizeof(fmp4_box_view_t));
+        fmp4ctx->pending_next += *count;
+    }
+    else
+    {
+        /* Receive straight into the caller's views */
+        fmp4_flow_poll(fmp4ctx);
+        fmp4ctx->views = views;
+        fmp4ctx->views_capacity = *count;
+        fmp4ctx->views_count = 0;
+        fmp4ctx->pending_count = 0;
+        fmp4ctx->pending_next = 0;
+        if (!fmp4ctx->transport->recv(fmp4ctx->context, fmp4_batch_collect,
+                    fmp4ctx, errctx))
+        {
+            error_save(errctx, errno);
+            result = false;
+        }
+        *count = fmp4ctx->views_count;
+        fmp4ctx->views = NULL;
+    }
+
+    return result;
+}
+
 void fmp4_destroy(fmp4_t *fmp4)
 {
     fmp4_internal_t *fmp4ctx = NULL;
+    fmp4_arena_t    *memory  = NULL;
 
     /* Sanity checks */
     if (!fmp4 || !*fmp4)
@@ -108,14 +592,1653 @@ void fmp4_destroy(fmp4_t *fmp4)
     /* Cast to internal FMP4 context */
     fmp4ctx = (fmp4_internal_t *)(*fmp4);
 
+    /* Detach from the pool servicing this stream */
+    if (fmp4ctx->pool)
+        fmp4_pool_detach((fmp4_pool_t)(fmp4ctx->pool), *fmp4);
+
     /* Deinitialize transport context */
     fmp4ctx->transport->fini(fmp4ctx->context);
 
-    /* Free & clear allocated resources */
-    FREE_AND_NULLIFY(fmp4ctx->context);
-    FREE_AND_NULLIFY(*fmp4);
+    /* Free & clear allocated resources, the context itself, the
+     * transport's & the URL go at once with the stream arena */
+    fmp4_init_release(fmp4ctx->init);
+    FREE_AND_NULLIFY(fmp4ctx->ftyp);
+    FREE_AND_NULLIFY(fmp4ctx->pending);
+    memory = fmp4ctx->memory;
+    *fmp4 = NULL;
+    fmp4_arena_destroy(&memory);
+}
+
+bool
+fmp4_pollfds(fmp4_t           fmp4,
+             struct pollfd   *pollfds,
+             size_t          *count,
+             error_context_t *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !count || (!pollfds && *count) || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!fmp4ctx->transport->pollfds, errctx,
+            EPROTONOSUPPORT, false);
+    error_save_retval_if(fmp4ctx->pool, errctx, EINVAL, false);
+
+    /* List the sockets of the stream & the events they wait for */
+    return fmp4ctx->transport->pollfds(fmp4ctx->context, pollfds, count,
+            errctx);
+}
+
+int fmp4_next_timeout(fmp4_t fmp4, int timeout)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+    int64_t          due     = 0;
+
+    /* Sanity checks */
+    if (!fmp4ctx)
+        return timeout;
+
+    /* A scheduled reconnect is due in whole ms, rounded up */
+    if (fmp4ctx->reconnect_at)
+    {
+        due = MAX(fmp4ctx->reconnect_at - current_monotonic_microseconds() +
+                999, 0) / 1000;
+        if (timeout < 0 || due < timeout)
+            timeout = (int)(MIN(due, INT32_MAX));
+    }
+    /* A paused stream polls its consumer for having drained */
+    if (fmp4ctx->paused && (timeout < 0 || timeout > FMP4_FLOW_POLL_INTERVAL))
+        timeout = FMP4_FLOW_POLL_INTERVAL;
+    if (!fmp4ctx->transport->next_timeout || fmp4ctx->pool)
+        return timeout;
+
+    return fmp4ctx->transport->next_timeout(fmp4ctx->context, timeout);
+}
+
+bool
+fmp4_service_fd(fmp4_t              fmp4,
+                struct pollfd      *pollfd,
+                fmp4box_function_t  callback,
+                void               *userdata,
+                error_context_t    *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!fmp4ctx->transport->service_fd, errctx,
+            EPROTONOSUPPORT, false);
+    error_save_retval_if(fmp4ctx->pool, errctx, EINVAL, false);
+
+    /* Service the ready socket, boxes go through fmp4_dispatch() */
+    fmp4ctx->callback = callback;
+    fmp4ctx->userdata = userdata;
+    fmp4_flow_poll(fmp4ctx);
+    if (!fmp4ctx->transport->service_fd(fmp4ctx->context, pollfd,
+                fmp4_dispatch, fmp4ctx, errctx))
+        error_save_retval(errctx, errno, false);
+
+    return true;
+}
+
+bool
+fmp4_set_option(fmp4_t           fmp4,
+                fmp4_option_t    option,
+                int64_t          value,
+                error_context_t *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Stream options are handled here, the rest by the transport */
+    switch (option)
+    {
+        case FMP4_OPTION_CALLBACK_TIMING:
+            fmp4ctx->timing = (value != 0);
+            return true;
+        case FMP4_OPTION_RECONNECT_BASE:
+            error_save_retval_if(value < 0 || value > INT32_MAX, errctx,
+                    EINVAL, false);
+            fmp4ctx->reconnect_base = value;
+            return true;
+        case FMP4_OPTION_RECONNECT_CAP:
+            error_save_retval_if(value < 0 || value > INT32_MAX, errctx,
+                    EINVAL, false);
+            fmp4ctx->reconnect_cap = value;
+            return true;
+        default: break;
+    }
+    error_save_retval_if(!fmp4ctx->transport->option, errctx, ENOPROTOOPT,
+            false);
+
+    return fmp4ctx->transport->option(fmp4ctx->context, option, &value, true,
+            errctx);
+}
+
+bool
+fmp4_get_option(fmp4_t           fmp4,
+                fmp4_option_t    option,
+                int64_t         *value,
+                error_context_t *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !value || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Stream options are handled here, the rest by the transport */
+    switch (option)
+    {
+        case FMP4_OPTION_CALLBACK_TIMING:
+            *value = fmp4ctx->timing;
+            return true;
+        case FMP4_OPTION_RECONNECT_BASE:
+            *value = fmp4ctx->reconnect_base;
+            return true;
+        case FMP4_OPTION_RECONNECT_CAP:
+            *value = fmp4ctx->reconnect_cap;
+            return true;
+        default: break;
+    }
+    error_save_retval_if(!fmp4ctx->transport->option, errctx, ENOPROTOOPT,
+            false);
+
+    return fmp4ctx->transport->option(fmp4ctx->context, option, value, false,
+            errctx);
+}
+
+void fmp4_set_memory_budget(size_t budget)
+{
+    slab_set_budget(budget);
+}
+
+size_t fmp4_memory_used(void)
+{
+    return slab_used();
+}
+
+const fmp4_init_t *fmp4_get_init(fmp4_t fmp4)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !fmp4ctx->init)
+        return NULL;
+
+    return &(fmp4ctx->init->init);
+}
+
+void fmp4_stats(fmp4_t fmp4, fmp4_stats_t *stats)
+{
+    const fmp4_internal_t *fmp4ctx = (const fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !stats)
+        return;
+
+    *stats = fmp4ctx->stats;
+    stats->pending = fmp4ctx->pending_count - fmp4ctx->pending_next;
+}
+
+void fmp4_pool_stats(fmp4_pool_t pool, fmp4_stats_t *stats)
+{
+    const fmp4_pool_internal_t *poolctx = (const fmp4_pool_internal_t *)(pool);
+    const fmp4_internal_t      *fmp4ctx = NULL;
+    size_t                      idx     = 0;
+
+    /* Sanity checks */
+    if (!poolctx || !stats)
+        return;
+
+    /* Sum the counters of every attached stream */
+    memset(stats, 0, sizeof(fmp4_stats_t));
+    for (idx = 0; idx < poolctx->count; idx++)
+    {
+        fmp4ctx = (poolctx->streams)[idx];
+        fmp4_stats_merge(stats, &(fmp4ctx->stats));
+        stats->pending += fmp4ctx->pending_count - fmp4ctx->pending_next;
+    }
+}
+
+bool fmp4_can_pause(fmp4_t fmp4)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    return fmp4ctx && fmp4ctx->transport && fmp4ctx->transport->flow;
+}
+
+bool
+fmp4_pause(fmp4_t                   fmp4,
+           fmp4_drained_function_t  drained,
+           void                    *userdata,
+           error_context_t         *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || !drained || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!fmp4ctx->transport->flow, errctx, EPROTONOSUPPORT,
+            false);
+
+    /* Stop reading once, a later pause only updates the drain check */
+    fmp4ctx->drained = drained;
+    fmp4ctx->drained_userdata = userdata;
+    if (fmp4ctx->paused)
+        return true;
+    if (!fmp4ctx->transport->flow(fmp4ctx->context, false, errctx))
+        error_save_retval(errctx, errno, false);
+    fmp4ctx->paused = true;
+    (fmp4ctx->stats).pauses++;
+    if (fmp4ctx->pool)
+        (fmp4ctx->pool->paused)++;
+
+    return true;
+}
+
+bool
+fmp4_set_latency_alert(fmp4_t                   fmp4,
+                       int64_t                  threshold,
+                       fmp4_latency_function_t  callback,
+                       void                    *userdata,
+                       error_context_t         *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(fmp4);
+
+    /* Sanity checks */
+    if (!fmp4ctx || threshold < 0 || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    fmp4ctx->alert_threshold = threshold;
+    fmp4ctx->alert_callback = callback;
+    fmp4ctx->alert_userdata = userdata;
+    fmp4ctx->alerting = false;
+
+    return true;
+}
+
+static bool
+fmp4_dispatch(const fmp4_box_t *box,
+              void             *userdata,
+              error_context_t  *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(userdata);
+    uint64_t         size    = fmp4_box_size(box);
+    int64_t          start   = 0;
+    int64_t          elapsed = 0;
+    bool             result  = false;
+
+    /* Skip an init segment resent unchanged after a reconnect, then track
+     * init segment changes before the user sees the moov box */
+    if (fmp4_resume_filter(fmp4ctx, box, size))
+        return true;
+    if (ntohl(box->type) == FMP4_FOURCC('m', 'o', 'o', 'v'))
+        fmp4_init_update(fmp4ctx, box);
+    if (fmp4ctx->timing)
+        start = current_monotonic_nanoseconds();
+    fmp4_stats_box(fmp4ctx, box, size, start);
+
+    /* Invoke user-provided callback with FMP4 box */
+    result = fmp4ctx->callback(box, fmp4ctx->userdata, errctx);
+    fmp4ctx->offset += size;
+    if (!fmp4ctx->timing)
+        return result;
+
+    /* Time the callback, the clock read before it doubles as arrival time */
+    elapsed = current_monotonic_nanoseconds() - start;
+    (fmp4ctx->stats).callback_time += (uint64_t)(elapsed);
+    fmp4_histogram_record(&((fmp4ctx->stats).callback_duration),
+            (uint64_t)(elapsed));
+
+    return result;
+}
+
+static bool
+fmp4_batch_collect(const fmp4_box_t *box,
+                   void             *userdata,
+                   error_context_t  *errctx)
+{
+    fmp4_internal_t *fmp4ctx = (fmp4_internal_t *)(userdata);
+    fmp4_box_view_t *view    = NULL;
+    void            *grown   = NULL;
+    uint64_t         size    = fmp4_box_size(box);
+    size_t           target  = 0;
+
+    /* Collecting replaces fmp4_dispatch(), saving an indirect call a box */
+    if (fmp4_resume_filter(fmp4ctx, box, size))
+        return true;
+    if (ntohl(box->type) == FMP4_FOURCC('m', 'o', 'o', 'v'))
+        fmp4_init_update(fmp4ctx, box);
+    fmp4_stats_box(fmp4ctx, box, size, 0);
+
+    /* Fill the caller's views, then pending ones kept across receives */
+    if (fmp4ctx->views_count < fmp4ctx->views_capacity)
+        view = &((fmp4ctx->views)[(fmp4ctx->views_count)++]);
+    else
+    {
+        if (fmp4ctx->pending_count == fmp4ctx->pending_capacity)
+        {
+            target = MAX(fmp4ctx->pending_capacity * 2, 64);
+            grown = realloc(fmp4ctx->pending,
+                    target * sizeof(fmp4_box_view_t));
+            error_save_retval_if(!grown, errctx, ENOMEM, false);
+            fmp4ctx->pending = (fmp4_box_view_t *)(grown);
+            fmp4ctx->pending_capacity = target;
+        }
+        view = &((fmp4ctx->pending)[(fmp4ctx->pending_count)++]);
+    }
+    view->box = box;
+    view->type = ntohl(box->type);
+    view->size = size;
+    view->offset = fmp4ctx->offset;
+    fmp4ctx->offset += size;
+
+    /* Boxes of other transports stay valid only until the next frame, so
+     * reading stops past this one until the next receive */
+    if (fmp4ctx->transport->stable_boxes || fmp4ctx->held)
+        return true;
+    if (!fmp4ctx->transport->flow(fmp4ctx->context, false, errctx))
+        error_save_retval(errctx, errno, false);
+    fmp4ctx->held = true;
+
+    return true;
+}
+
+static bool
+fmp4_resume_filter(fmp4_internal_t  *fmp4ctx,
+                   const fmp4_box_t *box,
+                   uint64_t          size)
+{
+    uint32_t  type = ntohl(box->type);
+    uint8_t  *copy = NULL;
+
+    switch (type)
+    {
+        case FMP4_FOURCC('f', 't', 'y', 'p'):
+            if (fmp4ctx->resumed && fmp4ctx->ftyp &&
+                    fmp4ctx->ftyp_size == size &&
+                    memcmp(fmp4ctx->ftyp, box, size) == 0)
+                return true;
+
+            /* Keep the ftyp box, a failed copy only costs the suppression */
+            copy = (uint8_t *)(realloc(fmp4ctx->ftyp, size));
+            if (!copy)
+            {
+                FREE_AND_NULLIFY(fmp4ctx->ftyp);
+                fmp4ctx->ftyp_size = 0;
+                return false;
+            }
+            memcpy(copy, box, size);
+            fmp4ctx->ftyp = copy;
+            fmp4ctx->ftyp_size = size;
+            return false;
+        case FMP4_FOURCC('m', 'o', 'o', 'v'):
+            return fmp4ctx->resumed && fmp4ctx->init &&
+                fmp4ctx->init->moov_size == size &&
+                memcmp(fmp4ctx->init->moov, box, size) == 0;
+        default: break;
+    }
+
+    /* Media flows again, the next drop starts a fresh backoff */
+    if (fmp4ctx->resumed)
+    {
+        fmp4ctx->resumed = false;
+        fmp4ctx->reconnect_attempts = 0;
+    }
+
+    return false;
+}
+
+static void fmp4_flow_poll(fmp4_internal_t *fmp4ctx)
+{
+    error_context_t errctx = {};
+
+    /* Read past the frame a batch stopped at, then resume reads of a
+     * paused stream whose consumer caught up, a failed resume is retried
+     * on the next poll */
+    if (fmp4ctx->held && !fmp4ctx->paused &&
+            fmp4ctx->transport->flow(fmp4ctx->context, true, &errctx))
+        fmp4ctx->held = false;
+    if (!fmp4ctx->paused || !fmp4ctx->drained(fmp4ctx->drained_userdata))
+        return;
+    if (!fmp4ctx->transport->flow(fmp4ctx->context, true, &errctx))
+        return;
+    fmp4_flow_reset(fmp4ctx);
+}
+
+static void fmp4_flow_reset(fmp4_internal_t *fmp4ctx)
+{
+    /* Forget the pause, a new connection reads from the start */
+    if (fmp4ctx->paused && fmp4ctx->pool)
+        (fmp4ctx->pool->paused)--;
+    fmp4ctx->paused = false;
+    fmp4ctx->held = false;
+}
+
+static bool
+fmp4_connect_begin(fmp4_connecting_t *connecting,
+                   int               *wake,
+                   int               *errnum)
+{
+    fmp4_internal_t    *fmp4ctx = connecting->fmp4ctx;
+    fmp4_connect_job_t *job     = NULL;
+    error_context_t     errctx  = {};
+
+    /* Pooled streams are connected by their pool */
+    *errnum = EINVAL;
+    connecting->job = NULL;
+    if (!fmp4ctx || !fmp4ctx->transport || !fmp4ctx->context ||
+            fmp4ctx->pool)
+        return false;
+
+    /* Start a background connect */
+    fmp4_flow_reset(fmp4ctx);
+    if (fmp4ctx->transport->connect_start)
+    {
+        if (fmp4ctx->transport->connect_start(fmp4ctx->context, &errctx))
+            return true;
+        *errnum = errctx.errnum ? errctx.errnum : ENOTCONN;
+        return false;
+    }
+
+    /* Or run the blocking connect on a thread, signalling the wake pipe */
+    *errnum = errno = 0;
+    if (wake[0] < 0 && pipe2(wake, O_NONBLOCK | O_CLOEXEC) < 0)
+        wake[0] = wake[1] = -1;
+    job = wake[0] >= 0 ? (fmp4_connect_job_t *)(calloc(1,
+                sizeof(fmp4_connect_job_t))) : NULL;
+    if (job)
+    {
+        job->fmp4ctx = fmp4ctx;
+        job->wake = wake[1];
+        *errnum = pthread_create(&(job->thread), NULL, fmp4_connect_run, job);
+    }
+    if (!job || *errnum)
+    {
+        *errnum = *errnum ? *errnum : (errno ? errno : ENOMEM);
+        FREE_AND_NULLIFY(job);
+        return false;
+    }
+    connecting->job = job;
+
+    return true;
 }
 
+static bool
+fmp4_connect_poll(fmp4_connecting_t *connecting,
+                  struct pollfd     *pollfds,
+                  int               *errnum)
+{
+    fmp4_internal_t *fmp4ctx = connecting->fmp4ctx;
+    error_context_t  errctx  = {};
+    size_t           count   = connecting->count;
+    size_t           idx     = 0;
+    bool             result  = false;
+
+    /* Threads are done once they said so, their stream is ours again */
+    if (connecting->job)
+    {
+        if (!__atomic_load_n(&(connecting->job->done), __ATOMIC_ACQUIRE))
+            return false;
+        pthread_join(connecting->job->thread, NULL);
+        *errnum = connecting->job->errnum;
+        FREE_AND_NULLIFY(connecting->job);
+        if (!*errnum)
+            (fmp4ctx->stats).reconnects += ((fmp4ctx->stats).connects++ > 0);
+        return true;
+    }
+
+    /* Service the ready sockets, then timers & buffered data */
+    for (idx = 0; idx <= count && !result; idx++)
+    {
+        if (idx < count && !(pollfds[idx]).revents)
+            continue;
+        error_clear(&errctx);
+        result = fmp4ctx->transport->connect_service(fmp4ctx->context,
+                idx < count ? pollfds + idx : NULL, &errctx);
+        if (!result && errctx.errnum != EINPROGRESS)
+            break;
+    }
+
+    /* Still handshaking, or finished connected or failed */
+    if (!result && errctx.errnum == EINPROGRESS)
+        return false;
+    if (result)
+        (fmp4ctx->stats).reconnects += ((fmp4ctx->stats).connects++ > 0);
+    *errnum = result ? 0 : (errctx.errnum ? errctx.errnum : ENOTCONN);
+
+    return true;
+}
+
+static void *fmp4_connect_run(void *arg)
+{
+    fmp4_connect_job_t *job     = (fmp4_connect_job_t *)(arg);
+    fmp4_internal_t    *fmp4ctx = job->fmp4ctx;
+    error_context_t     errctx  = {};
+
+    /* Connect, then publish the outcome & wake the waiting thread */
+    if (!fmp4ctx->transport->connect(fmp4ctx->context, &errctx))
+        job->errnum = errctx.errnum ? errctx.errnum : ENOTCONN;
+    __atomic_store_n(&(job->done), true, __ATOMIC_RELEASE);
+    if (write(job->wake, "", 1) < 0)
+        return NULL;
+
+    return NULL;
+}
+
+static void fmp4_reconnect_schedule(fmp4_internal_t *fmp4ctx, int64_t now)
+{
+    uint64_t window = 0;
+    uint64_t random = fmp4ctx->random;
+
+    /* Full jitter, a random delay up to the base doubled with every
+     * attempt & capped, xorshift64 is plenty for spreading retries */
+    window = (uint64_t)(fmp4ctx->reconnect_base) <<
+        MIN(fmp4ctx->reconnect_attempts, 20);
+    window = MIN(window, (uint64_t)(fmp4ctx->reconnect_cap)) * 1000;
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    fmp4ctx->random = random;
+    fmp4ctx->reconnect_at = now + (int64_t)(window ? random % (window + 1) : 0);
+}
+
+static void
+fmp4_stats_box(fmp4_internal_t  *fmp4ctx,
+               const fmp4_box_t *box,
+               uint64_t          size,
+               int64_t           now)
+{
+    fmp4_stats_t     *stats = &(fmp4ctx->stats);
+    fmp4_box_stats_t *slot  = NULL;
+    uint32_t          type  = ntohl(box->type);
+
+    /* Stream & box type counters */
+    stats->boxes++;
+    stats->bytes += size;
+    slot = fmp4_stats_slot(stats, type);
+    slot->boxes++;
+    slot->bytes += size;
+    if (type == FMP4_FOURCC('p', 'r', 'f', 't'))
+        fmp4_stats_latency(fmp4ctx, box, size, now);
+    if (type != FMP4_FOURCC('m', 'o', 'o', 'f'))
+        return;
+
+    stats->fragments++;
+    stats->frames += fmp4_count_samples(box, size);
+
+    /* Gap since the previous fragment, now is 0 when not read yet */
+    if (!fmp4ctx->timing)
+        return;
+    if (!now)
+        now = current_monotonic_nanoseconds();
+    if (fmp4ctx->fragment_time)
+        fmp4_histogram_record(&(stats->fragment_gap),
+                (uint64_t)(now - fmp4ctx->fragment_time));
+    fmp4ctx->fragment_time = now;
+}
+
+static fmp4_box_stats_t *fmp4_stats_slot(fmp4_stats_t *stats, uint32_t type)
+{
+    size_t idx = 0;
+
+    /* Box types of a stream are few, the common ones come first */
+    for (idx = 0; idx < FMP4_STATS_BOX_TYPES - 1; idx++)
+    {
+        if ((stats->types)[idx].type == type)
+            return &((stats->types)[idx]);
+        if (!(stats->types)[idx].type)
+        {
+            (stats->types)[idx].type = type;
+            return &((stats->types)[idx]);
+        }
+    }
+
+    return &((stats->types)[FMP4_STATS_BOX_TYPES - 1]);
+}
+
+static void
+fmp4_stats_latency(fmp4_internal_t  *fmp4ctx,
+                   const fmp4_box_t *box,
+                   uint64_t          size,
+                   int64_t           now)
+{
+    fmp4_stats_t    *stats   = &(fmp4ctx->stats);
+    error_context_t  errctx  = {};
+    uint64_t         clock   = 0;
+    int64_t          encoded = 0;
+    int64_t          arrived = 0;
+    int64_t          latency = 0;
+
+    /* Wall clock of the encoder, prft keeps it after version, flags &
+     * reference track, boxes too short to hold it are skipped */
+    if (ntohl(box->size) == 1 || size < sizeof(fmp4_box_t) + 16)
+        return;
+    clock = fmp4_parse_wallclock(box->body, size - sizeof(fmp4_box_t),
+            &errctx);
+    if (errctx.saved || !clock)
+        return;
+
+    /* NTP 32.32 fixed point seconds since 1900, else ms since 1970 */
+    if ((clock >> 32) >= FMP4_NTP_UNIX_OFFSET)
+        encoded = (int64_t)((clock >> 32) - FMP4_NTP_UNIX_OFFSET) * 1000000LL +
+            (int64_t)(((clock & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+    else
+        encoded = (int64_t)(clock) * 1000LL;
+
+    /* Arrival on a wall clock anchored to the monotonic one */
+    now = now ? now / 1000 : current_monotonic_microseconds();
+    if (!fmp4ctx->monotonic_anchor)
+    {
+        fmp4ctx->wall_anchor = current_time_microseconds();
+        fmp4ctx->monotonic_anchor = now;
+    }
+    arrived = fmp4ctx->wall_anchor + (now - fmp4ctx->monotonic_anchor);
+
+    /* Lower the offset of an encoder clock running ahead of ours */
+    latency = arrived - (encoded + stats->clock_offset);
+    if (latency < 0)
+    {
+        stats->clock_offset += latency;
+        latency = 0;
+    }
+    fmp4_histogram_record(&(stats->latency), (uint64_t)(latency));
+    stats->latency_last = latency;
+
+    /* Alert on the rising edge only */
+    if (!fmp4ctx->alert_callback)
+        return;
+    if (latency <= fmp4ctx->alert_threshold)
+    {
+        fmp4ctx->alerting = false;
+        return;
+    }
+    if (fmp4ctx->alerting)
+        return;
+    fmp4ctx->alerting = true;
+    stats->latency_alerts++;
+    fmp4ctx->alert_callback((fmp4_t)(fmp4ctx), latency,
+            fmp4ctx->alert_userdata);
+}
+
+static uint64_t fmp4_count_samples(const fmp4_box_t *moof, uint64_t size)
+{
+    fmp4_box_iter_t  iter   = {};
+    fmp4_box_iter_t  child  = {};
+    const uint8_t   *body   = NULL;
+    size_t           header = sizeof(fmp4_box_t);
+    uint64_t         count  = 0;
+
+    /* Sum trun sample counts only, fmp4_parse_moof() is the validating
+     * walk, malformed fragments are left to the user & count what parsed,
+     * up to FMP4_MAX_SAMPLES */
+    if (ntohl(moof->size) == 1)
+        header = sizeof(fmp4_large_box_t);
+    if (size < header)
+        return 0;
+    fmp4_box_iter_init(&iter, (const uint8_t *)(moof) + header, size - header);
+    while (fmp4_box_iter_next(&iter))
+    {
+        if (ntohl(iter.box->type) != FMP4_FOURCC('t', 'r', 'a', 'f'))
+            continue;
+        fmp4_box_iter_init(&child, (const uint8_t *)(iter.box) + iter.header,
+                iter.size - iter.header);
+        while (fmp4_box_iter_next(&child))
+        {
+            body = (const uint8_t *)(child.box) + child.header;
+            if (ntohl(child.box->type) != FMP4_FOURCC('t', 'r', 'u', 'n') ||
+                    child.size < child.header + 8)
+                continue;
+            if (fmp4_read_u32(body + 4) > FMP4_MAX_SAMPLES - count)
+                return count;
+            count += fmp4_read_u32(body + 4);
+        }
+    }
+
+    return count;
+}
+
+static void fmp4_stats_merge(fmp4_stats_t *into, const fmp4_stats_t *from)
+{
+    const fmp4_box_stats_t *source = NULL;
+    fmp4_box_stats_t       *slot   = NULL;
+    size_t                  idx    = 0;
+
+    /* Sum counters, box types by type, the catch-all slot into its own */
+    into->boxes += from->boxes;
+    into->bytes += from->bytes;
+    for (idx = 0; idx < FMP4_STATS_BOX_TYPES; idx++)
+    {
+        source = &((from->types)[idx]);
+        if (!source->boxes)
+            continue;
+        slot = (idx == FMP4_STATS_BOX_TYPES - 1) ?
+            &((into->types)[FMP4_STATS_BOX_TYPES - 1]) :
+            fmp4_stats_slot(into, source->type);
+        slot->boxes += source->boxes;
+        slot->bytes += source->bytes;
+    }
+    into->fragments += from->fragments;
+    into->frames += from->frames;
+    into->callback_time += from->callback_time;
+    into->connects += from->connects;
+    into->reconnects += from->reconnects;
+    into->pending += from->pending;
+    fmp4_histogram_merge(&(into->callback_duration),
+            &(from->callback_duration));
+    fmp4_histogram_merge(&(into->fragment_gap), &(from->fragment_gap));
+    fmp4_histogram_merge(&(into->latency), &(from->latency));
+    into->latency_last = MAX(into->latency_last, from->latency_last);
+    into->clock_offset = MIN(into->clock_offset, from->clock_offset);
+    into->latency_alerts += from->latency_alerts;
+    into->pauses += from->pauses;
+}
+
+static void fmp4_init_update(fmp4_internal_t *fmp4ctx, const fmp4_box_t *moov)
+{
+    fmp4_init_entry_t *entry  = NULL;
+    error_context_t    errctx = {};
+    uint64_t           size   = fmp4_box_size(moov);
+    bool               result = false;
+
+    /* Unchanged init segments, e.g. resent on reconnect, are not parsed */
+    if (fmp4ctx->init && fmp4ctx->init->moov_size == size &&
+        !memcmp(fmp4ctx->init->moov, moov, size))
+        return;
+
+    /* Another stream of the same source may have parsed it already */
+    entry = fmp4_init_lookup(fmp4ctx->url);
+    if (entry && entry->moov_size == size && !memcmp(entry->moov, moov, size))
+        SET_VAR_JMP_LBL(result, true, CLEANUP);
+    fmp4_init_release(entry);
+
+    /* Parse a private copy, malformed init segments are left to the user */
+    entry = (fmp4_init_entry_t *)(calloc(1, sizeof(fmp4_init_entry_t)));
+    if (!entry)
+        return;
+    entry->url = strdup(fmp4ctx->url);
+    entry->moov = (uint8_t *)(malloc(size));
+    entry->moov_size = size;
+    entry->refs = 1;
+    if (!entry->url || !entry->moov)
+        goto CLEANUP;
+    memcpy(entry->moov, moov, size);
+    if (!fmp4_parse_init((const fmp4_box_t *)(entry->moov), &(entry->init),
+                &errctx))
+        goto CLEANUP;
+    fmp4_init_publish(entry);
+
+    result = true;
+
+CLEANUP:
+
+    if (!result)
+    {
+        FREE_AND_NULLIFY(entry->url);
+        FREE_AND_NULLIFY(entry->moov);
+        FREE_AND_NULLIFY(entry);
+        return;
+    }
+
+    /* Swap the stream over to the new init segment */
+    fmp4_init_release(fmp4ctx->init);
+    fmp4ctx->init = entry;
+}
+
+static void fmp4_init_publish(fmp4_init_entry_t *entry)
+{
+    fmp4_init_entry_t **link   = NULL;
+    fmp4_init_entry_t **oldest = NULL;
+    fmp4_init_entry_t  *evict  = NULL;
+    fmp4_init_entry_t  *stale  = NULL;
+
+    pthread_mutex_lock(&fmp4_init_lock);
+
+    /* Unlink the previous entry of the same URL and find the oldest unused
+     * entry, new entries are inserted at the list head */
+    for (link = &fmp4_init_cache; *link; )
+    {
+        if (!strcmp((*link)->url, entry->url))
+        {
+            stale = *link;
+            *link = stale->next;
+            stale->cached = false;
+            fmp4_init_count--;
+            if (stale->refs)
+                stale = NULL;
+            continue;
+        }
+        if (!(*link)->refs)
+            oldest = link;
+        link = &((*link)->next);
+    }
+
+    /* Bound the cache by evicting an unused entry, then insert new entry */
+    if (fmp4_init_count >= FMP4_INIT_CACHE_MAX && oldest)
+    {
+        evict = *oldest;
+        *oldest = evict->next;
+        fmp4_init_count--;
+    }
+    entry->cached = true;
+    entry->next = fmp4_init_cache;
+    fmp4_init_cache = entry;
+    fmp4_init_count++;
+
+    pthread_mutex_unlock(&fmp4_init_lock);
+
+    /* Free entries nobody references anymore */
+    fmp4_init_free(stale);
+    fmp4_init_free(evict);
+}
+
+static fmp4_init_entry_t *fmp4_init_lookup(const char *url)
+{
+    fmp4_init_entry_t *entry = NULL;
+
+    /* Reference the cached entry of this URL */
+    pthread_mutex_lock(&fmp4_init_lock);
+    for (entry = fmp4_init_cache; entry; entry = entry->next)
+    {
+        if (!strcmp(entry->url, url))
+        {
+            entry->refs++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fmp4_init_lock);
+
+    return entry;
+}
+
+static void fmp4_init_release(fmp4_init_entry_t *entry)
+{
+    bool unused = false;
+
+    /* Sanity checks */
+    if (!entry)
+        return;
+
+    /* Cached entries stay around for later streams of the same source */
+    pthread_mutex_lock(&fmp4_init_lock);
+    unused = (--(entry->refs) == 0 && !entry->cached);
+    pthread_mutex_unlock(&fmp4_init_lock);
+
+    if (unused)
+        fmp4_init_free(entry);
+}
+
+static void fmp4_init_free(fmp4_init_entry_t *entry)
+{
+    /* Sanity checks */
+    if (!entry)
+        return;
+
+    /* Free & clear allocated resources */
+    FREE_AND_NULLIFY(entry->url);
+    FREE_AND_NULLIFY(entry->moov);
+    FREE_AND_NULLIFY(entry);
+}
+
+fmp4_pool_t fmp4_pool_create(error_context_t *errctx)
+{
+    fmp4_pool_internal_t *poolctx = NULL;
+
+    /* Sanity checks */
+    if (!errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal pool context, event loop is created on first attach */
+    poolctx = (fmp4_pool_internal_t *)(calloc(1, sizeof(fmp4_pool_internal_t)));
+    error_save_retval_if(!poolctx, errctx, errno, NULL);
+
+    return (fmp4_pool_t)(poolctx);
+}
+
+bool
+fmp4_pool_attach(fmp4_pool_t          pool,
+                 fmp4_t               fmp4,
+                 fmp4box_function_t   callback,
+                 void                *userdata,
+                 error_context_t     *errctx)
+{
+    fmp4_pool_internal_t  *poolctx  = NULL;
+    fmp4_internal_t       *fmp4ctx  = NULL;
+    fmp4_internal_t      **streams  = NULL;
+    size_t                 capacity = 0;
+
+    /* Sanity checks */
+    if (!pool || !fmp4 || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast to internal pool & FMP4 contexts */
+    poolctx = (fmp4_pool_internal_t *)(pool);
+    fmp4ctx = (fmp4_internal_t *)(fmp4);
+    if (!fmp4ctx->transport || !fmp4ctx->context || fmp4ctx->pool)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Streams can only share a loop created by the same loop functions */
+    if (!fmp4ctx->transport->attach || !fmp4ctx->transport->loop_create)
+        error_save_retval(errctx, EPROTONOSUPPORT, false);
+    if (poolctx->transport && poolctx->transport->loop_create !=
+            fmp4ctx->transport->loop_create)
+        error_save_retval(errctx, EPROTONOSUPPORT, false);
+
+    /* Create the shared event loop for the first stream */
+    if (!poolctx->loop)
+    {
+        poolctx->loop = fmp4ctx->transport->loop_create(errctx);
+        error_save_retval_if(!poolctx->loop, errctx, errno, false);
+        poolctx->transport = fmp4ctx->transport;
+    }
+
+    /* Grow attached stream array */
+    if (poolctx->count == poolctx->capacity)
+    {
+        capacity = MAX(poolctx->capacity * 2, 16);
+        streams = (fmp4_internal_t **)(realloc(poolctx->streams,
+                    capacity * sizeof(fmp4_internal_t *)));
+        error_save_retval_if(!streams, errctx, ENOMEM, false);
+        poolctx->streams = streams;
+        poolctx->capacity = capacity;
+    }
+
+    /* Bind stream to the shared loop, which starts connecting it */
+    fmp4ctx->callback = callback;
+    fmp4ctx->userdata = userdata;
+    if (!fmp4ctx->transport->attach(fmp4ctx->context, poolctx->loop,
+                fmp4_dispatch, fmp4ctx, errctx))
+        error_save_retval(errctx, errno, false);
+
+    (fmp4ctx->stats).reconnects += ((fmp4ctx->stats).connects++ > 0);
+    fmp4ctx->pool = poolctx;
+    fmp4ctx->pool_index = poolctx->count;
+    (poolctx->streams)[(poolctx->count)++] = fmp4ctx;
+
+    return true;
+}
+
+void fmp4_pool_detach(fmp4_pool_t pool, fmp4_t fmp4)
+{
+    fmp4_pool_internal_t *poolctx = NULL;
+    fmp4_internal_t      *fmp4ctx = NULL;
+    fmp4_internal_t      *last    = NULL;
+
+    /* Sanity checks */
+    if (!pool || !fmp4)
+        return;
+
+    /* Cast to internal pool & FMP4 contexts */
+    poolctx = (fmp4_pool_internal_t *)(pool);
+    fmp4ctx = (fmp4_internal_t *)(fmp4);
+    if (fmp4ctx->pool != poolctx)
+        return;
+
+    /* Unbind stream from the shared loop, closing its connection */
+    fmp4ctx->transport->detach(fmp4ctx->context);
+    fmp4_flow_reset(fmp4ctx);
+
+    /* Swap-remove stream from attached stream array */
+    last = (poolctx->streams)[--(poolctx->count)];
+    (poolctx->streams)[fmp4ctx->pool_index] = last;
+    last->pool_index = fmp4ctx->pool_index;
+    fmp4ctx->pool = NULL;
+    fmp4ctx->pool_index = 0;
+}
+
+bool
+fmp4_pool_service(fmp4_pool_t      pool,
+                  int              timeout,
+                  error_context_t *errctx)
+{
+    fmp4_pool_internal_t *poolctx = NULL;
+    size_t                idx     = 0;
+
+    /* Sanity checks */
+    if (!pool || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast to internal pool context */
+    poolctx = (fmp4_pool_internal_t *)(pool);
+    if (!poolctx->loop)
+        return true;
+
+    /* Resume streams whose consumers drained, still paused ones are polled
+     * again after FMP4_FLOW_POLL_INTERVAL ms at most */
+    for (idx = 0; poolctx->paused && idx < poolctx->count; idx++)
+        fmp4_flow_poll((poolctx->streams)[idx]);
+    if (poolctx->paused &&
+            (timeout < 0 || timeout > FMP4_FLOW_POLL_INTERVAL))
+        timeout = FMP4_FLOW_POLL_INTERVAL;
+
+    /* Execute one iteration of the shared event loop */
+    if (!poolctx->transport->loop_service(poolctx->loop, timeout, errctx))
+        error_save_retval(errctx, errno, false);
+
+    return true;
+}
+
+void fmp4_pool_destroy(fmp4_pool_t *pool)
+{
+    fmp4_pool_internal_t *poolctx = NULL;
+
+    /* Sanity checks */
+    if (!pool || !*pool)
+        return;
+
+    /* Cast to internal pool context */
+    poolctx = (fmp4_pool_internal_t *)(*pool);
+
+    /* Detach remaining streams before tearing down the shared loop */
+    while (poolctx->count)
+        fmp4_pool_detach(*pool, (fmp4_t)((poolctx->streams)[0]));
+    if (poolctx->loop)
+        poolctx->transport->loop_destroy(poolctx->loop);
+
+    /* Free & clear allocated resources */
+    FREE_AND_NULLIFY(poolctx->streams);
+    FREE_AND_NULLIFY(*pool);
+}
+
+uint64_t fmp4_box_size(const fmp4_box_t *box)
+{
+    uint64_t size = 0;
+
+    /* Sanity checks */
+    if (!box)
+        return 0;
+
+    /* Resolve 64-bit largesize boxes */
+    size = ntohl(box->size);
+    if (size == 1)
+        size = ntohu64(((const fmp4_large_box_t *)(box))->largeSize);
+
+    return size;
+}
+
+void
+fmp4_box_iter_init(fmp4_box_iter_t *iter,
+                   const uint8_t   *buffer,
+                   size_t           length)
+{
+    /* Sanity checks */
+    if (!iter)
+        return;
+
+    /* Position iterator at the beginning of the buffer */
+    memset(iter, 0, sizeof(fmp4_box_iter_t));
+    iter->cursor = buffer;
+    iter->end = buffer ? buffer + length : NULL;
+}
+
+bool fmp4_box_iter_next(fmp4_box_iter_t *iter)
+{
+    const fmp4_large_box_t *large     = NULL;
+    size_t                  available = 0;
+    uint64_t                size      = 0;
+
+    /* Sanity checks */
+    if (!iter || !iter->cursor || iter->errnum)
+        return false;
+
+    /* Reset current box state */
+    available = (size_t)(iter->end - iter->cursor);
+    iter->box = NULL;
+    iter->size = 0;
+    iter->header = sizeof(fmp4_box_t);
+    iter->unbounded = false;
+    if (!available)
+        return false;
+
+    /* Box header must be complete before its size can be trusted */
+    if (available < sizeof(fmp4_box_t))
+        SET_VAR_JMP_LBL(iter->errnum, ENODATA, END);
+    /* Read the compact size through the 8-byte header only, a wide load
+     * through the largesize layout could run past the buffer */
+    large = (const fmp4_large_box_t *)(iter->cursor);
+    size = ntohl(((const fmp4_box_t *)(iter->cursor))->size);
+
+    /* Resolve 64-bit largesize and to-end-of-buffer box sizes */
+    if (size == 1)
+    {
+        iter->header = sizeof(fmp4_large_box_t);
+        if (available < sizeof(fmp4_large_box_t))
+            SET_VAR_JMP_LBL(iter->errnum, ENODATA, END);
+        size = ntohu64(large->largeSize);
+        if (size < sizeof(fmp4_large_box_t))
+            SET_VAR_JMP_LBL(iter->errnum, EBADMSG, END);
+    }
+    else if (size == 0)
+    {
+        size = available;
+        iter->unbounded = true;
+    }
+    else if (size < sizeof(fmp4_box_t))
+        SET_VAR_JMP_LBL(iter->errnum, EBADMSG, END);
+
+    /* Reject boxes extending past the end of the buffer */
+    iter->size = size;
+    if (size > available)
+        SET_VAR_JMP_LBL(iter->errnum, EMSGSIZE, END);
+
+    iter->box = (const fmp4_box_t *)(iter->cursor);
+    iter->cursor += size;
+
+END:
+
+    return iter->box != NULL;
+}
+
+bool
+fmp4_parse_init(const fmp4_box_t *moov,
+                fmp4_init_t      *init,
+                error_context_t  *errctx)
+{
+    fmp4_box_iter_t  iter   = {};
+    fmp4_box_iter_t  child  = {};
+    const uint8_t   *body   = NULL;
+    fmp4_track_t    *track  = NULL;
+    uint64_t         size   = 0;
+    size_t           header = sizeof(fmp4_box_t);
+    size_t           mvex   = 0;
+
+    /* Sanity checks */
+    if (!moov || !init || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(ntohl(moov->type) != FMP4_FOURCC('m', 'o', 'o', 'v'),
+            errctx, EINVAL, false);
+
+    /* Walk moov children, mvex may come before or after the trak boxes */
+    size = fmp4_box_size(moov);
+    if (ntohl(moov->size) == 1)
+        header = sizeof(fmp4_large_box_t);
+    error_save_retval_if(size < header, errctx, EBADMSG, false);
+    memset(init, 0, sizeof(fmp4_init_t));
+    fmp4_box_iter_init(&iter, (const uint8_t *)(moov) + header, size - header);
+    while (fmp4_box_iter_next(&iter))
+    {
+        body = (const uint8_t *)(iter.box) + iter.header;
+        if (ntohl(iter.box->type) != FMP4_FOURCC('t', 'r', 'a', 'k'))
+            continue;
+        error_save_retval_if(init->track_count == FMP4_MAX_TRACKS, errctx,
+                ENOBUFS, false);
+        if (!fmp4_parse_trak(body, iter.size - iter.header,
+                    &((init->tracks)[init->track_count]), errctx))
+            return false;
+        init->track_count++;
+    }
+    error_save_retval_if(iter.errnum, errctx, EBADMSG, false);
+
+    /* Resolve trex sample defaults of every track */
+    body = fmp4_find_box((const uint8_t *)(moov) + header, size - header,
+            FMP4_FOURCC('m', 'v', 'e', 'x'), &mvex);
+    fmp4_box_iter_init(&child, body, body ? mvex : 0);
+    while (fmp4_box_iter_next(&child))
+    {
+        body = (const uint8_t *)(child.box) + child.header;
+        if (ntohl(child.box->type) != FMP4_FOURCC('t', 'r', 'e', 'x'))
+            continue;
+        error_save_retval_if(child.size < child.header + 24, errctx,
+                EBADMSG, false);
+        track = (fmp4_track_t *)(fmp4_init_track(init,
+                    fmp4_read_u32(body + 4)));
+        if (!track)
+            continue;
+        track->default_duration = fmp4_read_u32(body + 12);
+        track->default_size = fmp4_read_u32(body + 16);
+        track->default_flags = fmp4_read_u32(body + 20);
+    }
+    error_save_retval_if(child.errnum, errctx, EBADMSG, false);
+
+    return true;
+}
+
+const fmp4_track_t *
+fmp4_init_track(const fmp4_init_t *init,
+                uint32_t           track_id)
+{
+    size_t idx = 0;
+
+    /* Sanity checks */
+    if (!init)
+        return NULL;
+
+    /* Track counts are tiny, a linear scan beats anything fancier */
+    for (idx = 0; idx < init->track_count; idx++)
+    {
+        if ((init->tracks)[idx].track_id == track_id)
+            return &((init->tracks)[idx]);
+    }
+
+    return NULL;
+}
+
+static const uint8_t *
+fmp4_find_box(const uint8_t *body,
+              size_t         length,
+              uint32_t       type,
+              size_t        *size)
+{
+    fmp4_box_iter_t iter = {};
+
+    /* Return the body of the first child box of the given type */
+    fmp4_box_iter_init(&iter, body, length);
+    while (fmp4_box_iter_next(&iter))
+    {
+        if (ntohl(iter.box->type) != type)
+            continue;
+        *size = iter.size - iter.header;
+        return (const uint8_t *)(iter.box) + iter.header;
+    }
+
+    return NULL;
+}
+
+static bool
+fmp4_parse_trak(const uint8_t   *body,
+                size_t           length,
+                fmp4_track_t    *track,
+                error_context_t *errctx)
+{
+    fmp4_box_iter_t  iter   = {};
+    const uint8_t   *mdia   = NULL;
+    const uint8_t   *stbl   = NULL;
+    const uint8_t   *ptr    = NULL;
+    size_t           size   = 0;
+    size_t           mdsize = 0;
+    size_t           offset = 0;
+
+    /* Track ID from tkhd, whose v1 layout has 64-bit times */
+    ptr = fmp4_find_box(body, length, FMP4_FOURCC('t', 'k', 'h', 'd'), &size);
+    error_save_retval_if(!ptr || size < (*ptr ? 24 : 16), errctx,
+            EBADMSG, false);
+    track->track_id = fmp4_read_u32(ptr + (*ptr ? 20 : 12));
+
+    /* Timescale from mdhd & handler type from hdlr */
+    mdia = fmp4_find_box(body, length, FMP4_FOURCC('m', 'd', 'i', 'a'),
+            &mdsize);
+    error_save_retval_if(!mdia, errctx, EBADMSG, false);
+    ptr = fmp4_find_box(mdia, mdsize, FMP4_FOURCC('m', 'd', 'h', 'd'), &size);
+    error_save_retval_if(!ptr || size < (*ptr ? 24 : 16), errctx,
+            EBADMSG, false);
+    track->timescale = fmp4_read_u32(ptr + (*ptr ? 20 : 12));
+    ptr = fmp4_find_box(mdia, mdsize, FMP4_FOURCC('h', 'd', 'l', 'r'), &size);
+    error_save_retval_if(!ptr || size < 12, errctx, EBADMSG, false);
+    track->handler = fmp4_read_u32(ptr + 8);
+
+    /* First sample description of minf/stbl/stsd */
+    ptr = fmp4_find_box(mdia, mdsize, FMP4_FOURCC('m', 'i', 'n', 'f'), &size);
+    stbl = ptr ? fmp4_find_box(ptr, size, FMP4_FOURCC('s', 't', 'b', 'l'),
+            &size) : NULL;
+    ptr = stbl ? fmp4_find_box(stbl, size, FMP4_FOURCC('s', 't', 's', 'd'),
+            &size) : NULL;
+    if (!ptr || size < 8)
+        return true;
+    fmp4_box_iter_init(&iter, ptr + 8, size - 8);
+    if (!fmp4_box_iter_next(&iter))
+        return true;
+    track->codec = ntohl(iter.box->type);
+
+    /* Codec configuration follows the fixed visual or audio entry fields */
+    ptr = (const uint8_t *)(iter.box) + iter.header;
+    size = iter.size - iter.header;
+    if (track->handler == FMP4_FOURCC('v', 'i', 'd', 'e') && size >= 78)
+    {
+        track->width = (uint16_t)(ptr[24] << 8 | ptr[25]);
+        track->height = (uint16_t)(ptr[26] << 8 | ptr[27]);
+        offset = 78;
+    }
+    else if (track->handler == FMP4_FOURCC('s', 'o', 'u', 'n') && size >= 28)
+        offset = 28;
+    else
+        return true;
+    fmp4_box_iter_init(&iter, ptr + offset, size - offset);
+    while (fmp4_box_iter_next(&iter))
+    {
+        switch (ntohl(iter.box->type))
+        {
+            case FMP4_FOURCC('a', 'v', 'c', 'C'):
+            case FMP4_FOURCC('h', 'v', 'c', 'C'):
+            case FMP4_FOURCC('e', 's', 'd', 's'):
+                track->config_type = ntohl(iter.box->type);
+                track->config = (const uint8_t *)(iter.box) + iter.header;
+                track->config_size = iter.size - iter.header;
+                return true;
+            default: break;
+        }
+    }
+
+    return true;
+}
+
+bool
+fmp4_parse_moof(const fmp4_box_t  *moof,
+                const fmp4_init_t *init,
+                fmp4_samples_t    *samples,
+                error_context_t   *errctx)
+{
+    fmp4_box_iter_t  iter     = {};
+    const uint8_t   *body     = NULL;
+    uint64_t         size     = 0;
+    uint64_t         data_end = 0;
+    size_t           header   = sizeof(fmp4_box_t);
+
+    /* Sanity checks */
+    if (!moof || !samples || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(ntohl(moof->type) != FMP4_FOURCC('m', 'o', 'o', 'f'),
+            errctx, EINVAL, false);
+
+    /* Walk moof children */
+    size = fmp4_box_size(moof);
+    if (ntohl(moof->size) == 1)
+        header = sizeof(fmp4_large_box_t);
+    error_save_retval_if(size < header, errctx, EBADMSG, false);
+    samples->count = 0;
+    samples->sequence = 0;
+    fmp4_box_iter_init(&iter, (const uint8_t *)(moof) + header, size - header);
+    while (fmp4_box_iter_next(&iter))
+    {
+        body = (const uint8_t *)(iter.box) + iter.header;
+        switch (ntohl(iter.box->type))
+        {
+            case FMP4_FOURCC('m', 'f', 'h', 'd'):
+                error_save_retval_if(iter.size < iter.header + 8, errctx,
+                        EBADMSG, false);
+                samples->sequence = fmp4_read_u32(body + 4);
+            break;
+            case FMP4_FOURCC('t', 'r', 'a', 'f'):
+                if (!fmp4_parse_traf(body, iter.size - iter.header, size,
+                            init, &data_end, samples, errctx))
+                    return false;
+            break;
+            default: break;
+        }
+    }
+    error_save_retval_if(iter.errnum, errctx, EBADMSG, false);
+
+    /* Report the required capacity if the sample table was too small */
+    error_save_retval_if(samples->count > samples->capacity, errctx,
+            ENOBUFS, false);
+
+    return true;
+}
+
+bool
+fmp4_parse_keyframe(const fmp4_box_t  *moof,
+                    const fmp4_init_t *init,
+                    bool              *keyframe,
+                    error_context_t   *errctx)
+{
+    fmp4_box_iter_t     iter     = {};
+    fmp4_samples_t      samples  = {};
+    const fmp4_track_t *track    = NULL;
+    const uint8_t      *body     = NULL;
+    uint64_t            size     = 0;
+    uint64_t            data_end = 0;
+    size_t              header   = sizeof(fmp4_box_t);
+    size_t              idx      = 0;
+    size_t              total    = 0;
+    uint32_t            track_id = 0;
+    uint32_t            flags    = 0;
+    bool                video    = false;
+
+    /* Sanity checks */
+    if (!moof || !keyframe || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(ntohl(moof->type) != FMP4_FOURCC('m', 'o', 'o', 'f'),
+            errctx, EINVAL, false);
+
+    /* Sync decisions follow the video tracks, every track without any */
+    for (idx = 0; init && idx < init->track_count; idx++)
+        video |= (init->tracks)[idx].handler == FMP4_FOURCC('v', 'i', 'd', 'e');
+
+    /* Only the first sample of every traf matters, a one entry table
+     * spares decoding the others into memory */
+    size = fmp4_box_size(moof);
+    if (ntohl(moof->size) == 1)
+        header = sizeof(fmp4_large_box_t);
+    error_save_retval_if(size < header, errctx, EBADMSG, false);
+    samples.track_ids = &track_id;
+    samples.flags = &flags;
+    samples.capacity = 1;
+    *keyframe = false;
+    fmp4_box_iter_init(&iter, (const uint8_t *)(moof) + header, size - header);
+    while (fmp4_box_iter_next(&iter))
+    {
+        if (ntohl(iter.box->type) != FMP4_FOURCC('t', 'r', 'a', 'f'))
+            continue;
+        body = (const uint8_t *)(iter.box) + iter.header;
+        samples.count = 0;
+        if (!fmp4_parse_traf(body, iter.size - iter.header, size, init,
+                    &data_end, &samples, errctx))
+            return false;
+        total += samples.count;
+        error_save_retval_if(total > FMP4_MAX_SAMPLES, errctx, EBADMSG,
+                false);
+        track = fmp4_init_track(init, track_id);
+        if (!samples.count || (video && (!track ||
+                        track->handler != FMP4_FOURCC('v', 'i', 'd', 'e'))))
+            continue;
+
+        /* A keyframe fragment starts every such track with a sync sample */
+        if (flags & FMP4_SAMPLE_IS_NON_SYNC)
+        {
+            *keyframe = false;
+            return true;
+        }
+        *keyframe = true;
+    }
+    error_save_retval_if(iter.errnum, errctx, EBADMSG, false);
+
+    return true;
+}
+
+static bool
+fmp4_parse_traf(const uint8_t     *body,
+                size_t             length,
+                uint64_t           moof_size,
+                const fmp4_init_t *init,
+                uint64_t          *data_end,
+                fmp4_samples_t    *samples,
+                error_context_t   *errctx)
+{
+    fmp4_box_iter_t     iter  = {};
+    fmp4_traf_t         traf  = {};
+    const fmp4_track_t *track = NULL;
+    const uint8_t      *ptr   = NULL;
+    const uint8_t      *end   = NULL;
+    uint32_t            flags = 0;
+    uint32_t            type  = 0;
+    bool                tfhd  = false;
+
+    /* Without an explicit base, data follows the previous traf's data */
+    traf.base = traf.cursor = *data_end;
+
+    /* Walk traf children, tfhd & tfdt always precede trun boxes, only
+     * those full boxes carry a version & flags word, others are skipped */
+    fmp4_box_iter_init(&iter, body, length);
+    while (fmp4_box_iter_next(&iter))
+    {
+        type = ntohl(iter.box->type);
+        if (type != FMP4_FOURCC('t', 'f', 'h', 'd') &&
+            type != FMP4_FOURCC('t', 'f', 'd', 't') &&
+            type != FMP4_FOURCC('t', 'r', 'u', 'n'))
+            continue;
+        ptr = (const uint8_t *)(iter.box) + iter.header;
+        end = (const uint8_t *)(iter.box) + iter.size;
+        error_save_retval_if(ptr + 4 > end, errctx, EBADMSG, false);
+        flags = fmp4_read_u32(ptr) & 0x00FFFFFF;
+        ptr += 4;
+
+        switch (type)
+        {
+            case FMP4_FOURCC('t', 'f', 'h', 'd'):
+                /* Explicit base data offsets are absolute file offsets */
+                error_save_retval_if(flags & 0x000001, errctx, ENOTSUP, false);
+                error_save_retval_if(ptr + 4 + 4 * (!!(flags & 0x000002) +
+                            !!(flags & 0x000008) + !!(flags & 0x000010) +
+                            !!(flags & 0x000020)) > end, errctx, EBADMSG, false);
+                traf.track_id = fmp4_read_u32(ptr);
+                ptr += 4;
+
+                /* tfhd values override the trex defaults of the track */
+                track = fmp4_init_track(init, traf.track_id);
+                if (track)
+                {
+                    traf.default_duration = track->default_duration;
+                    traf.default_size = track->default_size;
+                    traf.default_flags = track->default_flags;
+                }
+                if (flags & 0x000002)
+                    ptr += 4;
+                if (flags & 0x000008)
+                {
+                    traf.default_duration = fmp4_read_u32(ptr);
+                    ptr += 4;
+                }
+                if (flags & 0x000010)
+                {
+                    traf.default_size = fmp4_read_u32(ptr);
+                    ptr += 4;
+                }
+                if (flags & 0x000020)
+                {
+                    traf.default_flags = fmp4_read_u32(ptr);
+                    ptr += 4;
+                }
+                if (flags & 0x020000)
+                    traf.base = traf.cursor = 0;
+                tfhd = true;
+            break;
+            case FMP4_FOURCC('t', 'f', 'd', 't'):
+                error_save_retval_if(ptr + (*(ptr - 4) ? 8 : 4) > end, errctx,
+                        EBADMSG, false);
+                traf.decode_time = *(ptr - 4) ? fmp4_read_u64(ptr) :
+                    fmp4_read_u32(ptr);
+            break;
+            case FMP4_FOURCC('t', 'r', 'u', 'n'):
+                error_save_retval_if(!tfhd, errctx, EBADMSG, false);
+                if (!fmp4_parse_trun(ptr - 4, (size_t)(end - ptr + 4),
+                            moof_size, &traf, samples, errctx))
+                    return false;
+            break;
+            default: break;
+        }
+    }
+    error_save_retval_if(iter.errnum, errctx, EBADMSG, false);
+
+    *data_end = traf.cursor;
+
+    return true;
+}
+
+static bool
+fmp4_parse_trun(const uint8_t   *body,
+                size_t           length,
+                uint64_t         moof_size,
+                fmp4_traf_t     *traf,
+                fmp4_samples_t  *samples,
+                error_context_t *errctx)
+{
+    const uint8_t *ptr          = body;
+    const uint8_t *end          = body + length;
+    uint32_t       version      = *body;
+    uint32_t       flags        = fmp4_read_u32(body) & 0x00FFFFFF;
+    uint32_t       count        = 0;
+    uint32_t       first_flags  = 0;
+    uint32_t       duration     = 0;
+    uint32_t       size         = 0;
+    uint32_t       sample_flags = 0;
+    int32_t        cto          = 0;
+    size_t         fields       = 0;
+    size_t         idx          = 0;
+    size_t         out          = 0;
+
+    /* Parse trun header */
+    fields = 4 * (!!(flags & 0x100) + !!(flags & 0x200) +
+            !!(flags & 0x400) + !!(flags & 0x800));
+    error_save_retval_if(ptr + 8 > end, errctx, EBADMSG, false);
+    count = fmp4_read_u32(ptr + 4);
+    ptr += 8;
+    error_save_retval_if(count > FMP4_MAX_SAMPLES - samples->count, errctx,
+            EBADMSG, false);
+    if (flags & 0x001)
+    {
+        error_save_retval_if(ptr + 4 > end, errctx, EBADMSG, false);
+        traf->cursor = traf->base + (int32_t)(fmp4_read_u32(ptr));
+        ptr += 4;
+    }
+    if (flags & 0x004)
+    {
+        error_save_retval_if(ptr + 4 > end, errctx, EBADMSG, false);
+        first_flags = fmp4_read_u32(ptr);
+        ptr += 4;
+    }
+    error_save_retval_if(fields && (size_t)(end - ptr) / fields < count,
+            errctx, EBADMSG, false);
+
+    /* Decode per-sample fields into the sample table arrays */
+    for (idx = 0; idx < count; idx++)
+    {
+        duration = traf->default_duration;
+        size = traf->default_size;
+        sample_flags = (idx == 0 && (flags & 0x004)) ? first_flags :
+            traf->default_flags;
+        cto = 0;
+        if (flags & 0x100)
+        {
+            duration = fmp4_read_u32(ptr);
+            ptr += 4;
+        }
+        if (flags & 0x200)
+        {
+            size = fmp4_read_u32(ptr);
+            ptr += 4;
+        }
+        if (flags & 0x400)
+        {
+            sample_flags = fmp4_read_u32(ptr);
+            ptr += 4;
+        }
+        if (flags & 0x800)
+        {
+            cto = version ? (int32_t)(fmp4_read_u32(ptr)) :
+                (int32_t)(MIN(fmp4_read_u32(ptr), INT32_MAX));
+            ptr += 4;
+        }
+
+        /* Sample data lives in the mdat following the moof */
+        error_save_retval_if(traf->cursor < moof_size, errctx, EBADMSG, false);
+        out = samples->count++;
+        if (out < samples->capacity)
+        {
+            if (samples->track_ids)
+                (samples->track_ids)[out] = traf->track_id;
+            if (samples->sizes)
+                (samples->sizes)[out] = size;
+            if (samples->durations)
+                (samples->durations)[out] = duration;
+            if (samples->flags)
+                (samples->flags)[out] = sample_flags;
+            if (samples->composition_offsets)
+                (samples->composition_offsets)[out] = cto;
+            if (samples->offsets)
+                (samples->offsets)[out] = traf->cursor - moof_size;
+            if (samples->decode_times)
+                (samples->decode_times)[out] = traf->decode_time;
+        }
+        traf->cursor += size;
+        traf->decode_time += duration;
+    }
+
+    return true;
+}
 
 uint64_t
 fmp4_parse_wallclock(const uint8_t   *body,
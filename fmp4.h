@@ -7,11 +7,13 @@
 
 #pragma once
 
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include "common.h"
 #include "error.h"
+#include "histogram.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -52,6 +54,124 @@ extern "C"
         uint8_t  body[];
     } __attribute__ ((__packed__)) fmp4_large_full_box_t;
 
+    /* Box type four character codes, compare against ntohl(box->type) */
+    #define FMP4_FOURCC(a, b, c, d) \
+        ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | \
+         (uint32_t)(c) <<  8 | (uint32_t)(d))
+
+    /* Sample flags bit of non-sync samples */
+    #define FMP4_SAMPLE_IS_NON_SYNC 0x00010000
+
+    /* Most samples a moof box may declare, larger counts are malformed */
+    #define FMP4_MAX_SAMPLES 65536
+
+    /* Sample table of a moof box, arrays left NULL are not filled */
+    typedef struct fmp4_samples_t
+    {
+        uint32_t *track_ids;
+        uint32_t *sizes;
+        uint32_t *durations;
+        uint32_t *flags;
+        int32_t  *composition_offsets;
+        uint64_t *offsets;      // from the first byte of the following mdat box
+        uint64_t *decode_times; // tfdt based, in track timescale units
+        size_t    capacity;     // entries in every non-NULL array
+        size_t    count;        // samples in the moof, may exceed capacity
+        uint32_t  sequence;     // mfhd sequence number
+
+    } fmp4_samples_t;
+
+    /* Track of an init segment, config points into its moov box */
+    #define FMP4_MAX_TRACKS 8
+    typedef struct fmp4_track_t
+    {
+        uint32_t       track_id;
+        uint32_t       handler;          // hdlr handler type, e.g. 'vide'
+        uint32_t       timescale;        // mdhd timescale
+        uint32_t       codec;            // sample entry type, e.g. 'avc1'
+        uint32_t       config_type;      // 'avcC', 'hvcC', 'esds' or 0
+        const uint8_t *config;           // codec configuration box body
+        size_t         config_size;
+        uint16_t       width;            // visual sample entries only
+        uint16_t       height;
+        uint32_t       default_duration; // trex sample defaults
+        uint32_t       default_size;
+        uint32_t       default_flags;
+
+    } fmp4_track_t;
+
+    /* Init segment descriptor */
+    typedef struct fmp4_init_t
+    {
+        fmp4_track_t tracks[FMP4_MAX_TRACKS];
+        size_t       track_count;
+
+    } fmp4_init_t;
+
+    /* Bounds-checked box iterator, errnum tells why iteration ended */
+    typedef struct fmp4_box_iter_t
+    {
+        const uint8_t    *cursor;    // first unconsumed byte
+        const uint8_t    *end;       // end of buffer
+        const fmp4_box_t *box;       // current box
+        uint64_t          size;      // current box size including header
+        size_t            header;    // current box header size
+        bool              unbounded; // box size 0, extends to end of buffer
+        int               errnum;    // reason for iteration end
+
+    } fmp4_box_iter_t;
+
+    /* View of a received box, valid until the next receive on its stream */
+    typedef struct fmp4_box_view_t
+    {
+        const fmp4_box_t *box;
+        uint32_t          type;   // host order, compare against FMP4_FOURCC()
+        uint64_t          size;   // box size including header
+        uint64_t          offset; // stream offset, bytes received before it
+
+    } fmp4_box_view_t;
+
+    /* Per box type counters, the last slot counts the other types */
+    #define FMP4_STATS_BOX_TYPES 8
+    typedef struct fmp4_box_stats_t
+    {
+        uint32_t type; // host order, 0 for a free slot or the last one
+        uint64_t boxes;
+        uint64_t bytes;
+
+    } fmp4_box_stats_t;
+
+    /* Stream counters */
+    typedef struct fmp4_stats_t
+    {
+        uint64_t         boxes;
+        uint64_t         bytes;
+        fmp4_box_stats_t types[FMP4_STATS_BOX_TYPES];
+        uint64_t         fragments;         // moof boxes
+        uint64_t         frames;            // samples of the moof boxes
+        uint64_t         callback_time;     // ns spent in the user callback
+        uint64_t         connects;          // fmp4_connect() & pool attaches
+        uint64_t         reconnects;        // connects after the first one
+        size_t           pending;           // batch views not handed out yet
+        fmp4_histogram_t callback_duration; // ns a callback invocation
+        fmp4_histogram_t fragment_gap;      // ns between moof boxes
+        fmp4_histogram_t latency;           // us from prft clock to arrival
+        int64_t          latency_last;      // us, largest of a pool's
+        int64_t          clock_offset;      // us, lowest of a pool's
+        uint64_t         latency_alerts;    // alert callback invocations
+        uint64_t         pauses;            // fmp4_pause() stopping reads
+
+    } fmp4_stats_t;
+
+    /* Allocator of stream metadata, all freed by fmp4_destroy() */
+    typedef struct fmp4_allocator_t
+    {
+        void *(*alloc)(size_t size, void *userdata);
+        void  (*free)(void *ptr, size_t size, void *userdata);
+        void   *userdata;
+
+    } fmp4_allocator_t;
+
     /* FMP4 stream context object */
     typedef void * fmp4_t;
 
@@ -59,12 +179,111 @@ extern "C"
     typedef bool (*fmp4box_function_t)(const fmp4_box_t *box, void *userdata,
             error_context_t *errctx);
 
+    /* Callback for latency alerts, latency in us */
+    typedef void (*fmp4_latency_function_t)(fmp4_t fmp4, int64_t latency,
+            void *userdata);
+
+    /* Callback for connect completion, errnum 0 once connected */
+    typedef void (*fmp4_connect_function_t)(fmp4_t fmp4, int errnum,
+            void *userdata);
+
+    /* Callback telling whether a paused stream's consumer caught up */
+    typedef bool (*fmp4_drained_function_t)(void *userdata);
+
+    /* FMP4 stream pool object, services many streams from one event loop */
+    typedef void * fmp4_pool_t;
+
     /* FMP4 public functions */
     fmp4_t fmp4_create(const char *url, error_context_t *errctx);
+    fmp4_t fmp4_create_with_allocator(const char *url,
+            const fmp4_allocator_t *allocator, error_context_t *errctx);
     bool fmp4_connect(fmp4_t fmp4, error_context_t *errctx);
     bool fmp4_recv(fmp4_t fmp4, fmp4box_function_t callback, void *userdata,
             error_context_t *errctx);
     void fmp4_destroy(fmp4_t *fmp4);
+
+    /* Connect many unpooled streams concurrently */
+    bool fmp4_connect_many(fmp4_t *streams, size_t count, size_t inflight,
+            int timeout, fmp4_connect_function_t callback, void *userdata,
+            error_context_t *errctx);
+
+    /* Warm up connection setup of a URL, e.g. the TLS session cache */
+    bool fmp4_prewarm(const char *url, error_context_t *errctx);
+
+    /* In-place reconnect with backoff, EAGAIN until it is due */
+    bool fmp4_reconnect(fmp4_t fmp4, error_context_t *errctx);
+
+    /* Batch receive, fills views instead of invoking a callback */
+    bool fmp4_recv_batch(fmp4_t fmp4, fmp4_box_view_t *views, size_t *count,
+            error_context_t *errctx);
+
+    /* External event loop integration of unpooled streams */
+    bool fmp4_pollfds(fmp4_t fmp4, struct pollfd *pollfds, size_t *count,
+            error_context_t *errctx);
+    int fmp4_next_timeout(fmp4_t fmp4, int timeout);
+    bool fmp4_service_fd(fmp4_t fmp4, struct pollfd *pollfd,
+            fmp4box_function_t callback, void *userdata,
+            error_context_t *errctx);
+
+    /* Stream options */
+    typedef enum fmp4_option_t
+    {
+        FMP4_OPTION_PING_INTERVAL,   // keepalive interval in ms, 0 disables
+        FMP4_OPTION_PING_RTT,        // last keepalive round-trip in us
+        FMP4_OPTION_CALLBACK_TIMING, // time callbacks, 1 by default
+        FMP4_OPTION_RECONNECT_BASE,  // first backoff window in ms, 100
+        FMP4_OPTION_RECONNECT_CAP,   // largest backoff window in ms, 30000
+        FMP4_OPTION_RX_BUFFER_SIZE,  // WebSocket read size, 0 for auto
+
+    } fmp4_option_t;
+    bool fmp4_set_option(fmp4_t fmp4, fmp4_option_t option, int64_t value,
+            error_context_t *errctx);
+    bool fmp4_get_option(fmp4_t fmp4, fmp4_option_t option, int64_t *value,
+            error_context_t *errctx);
+
+    /* Stream & pool counters, taken on the receiving thread */
+    void fmp4_stats(fmp4_t fmp4, fmp4_stats_t *stats);
+    void fmp4_pool_stats(fmp4_pool_t pool, fmp4_stats_t *stats);
+
+    /* Receive backpressure, reads resume once drained returns true */
+    #define FMP4_FLOW_POLL_INTERVAL 10 // ms
+    bool fmp4_pause(fmp4_t fmp4, fmp4_drained_function_t drained,
+            void *userdata, error_context_t *errctx);
+    bool fmp4_can_pause(fmp4_t fmp4);
+
+    /* Glass-to-glass latency from prft boxes, in us */
+    bool fmp4_set_latency_alert(fmp4_t fmp4, int64_t threshold,
+            fmp4_latency_function_t callback, void *userdata,
+            error_context_t *errctx);
+
+    /* Process-wide budget of box staging buffers, 0 for no limit */
+    void fmp4_set_memory_budget(size_t budget);
+    size_t fmp4_memory_used(void);
+
+    /* Init segment of a stream, shared by streams of the same URL */
+    const fmp4_init_t *fmp4_get_init(fmp4_t fmp4);
+
+    /* FMP4 stream pool public functions */
+    fmp4_pool_t fmp4_pool_create(error_context_t *errctx);
+    bool fmp4_pool_attach(fmp4_pool_t pool, fmp4_t fmp4,
+            fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+    void fmp4_pool_detach(fmp4_pool_t pool, fmp4_t fmp4);
+    bool fmp4_pool_service(fmp4_pool_t pool, int timeout,
+            error_context_t *errctx);
+    void fmp4_pool_destroy(fmp4_pool_t *pool);
+
+    uint64_t fmp4_box_size(const fmp4_box_t *box);
+    void fmp4_box_iter_init(fmp4_box_iter_t *iter, const uint8_t *buffer,
+            size_t length);
+    bool fmp4_box_iter_next(fmp4_box_iter_t *iter);
+    bool fmp4_parse_init(const fmp4_box_t *moov, fmp4_init_t *init,
+            error_context_t *errctx);
+    const fmp4_track_t *fmp4_init_track(const fmp4_init_t *init,
+            uint32_t track_id);
+    bool fmp4_parse_moof(const fmp4_box_t *moof, const fmp4_init_t *init,
+            fmp4_samples_t *samples, error_context_t *errctx);
+    bool fmp4_parse_keyframe(const fmp4_box_t *moof, const fmp4_init_t *init,
+            bool *keyframe, error_context_t *errctx);
     uint64_t fmp4_parse_wallclock(const uint8_t *body, size_t size,
             error_context_t *errctx);
 
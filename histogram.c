@@ -0,0 +1,72 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   histogram.c
+ * Desc:   Log-bucketed histogram implementation
+ */
+
+#include "histogram.h"
+
+void fmp4_histogram_merge(fmp4_histogram_t       *into,
+                          const fmp4_histogram_t *from)
+{
+    size_t idx = 0;
+
+    /* Sanity checks */
+    if (!into || !from)
+        return;
+
+    /* Buckets share their bounds, so merging is a sum */
+    for (idx = 0; idx < FMP4_HISTOGRAM_BUCKETS; idx++)
+        (into->buckets)[idx] += (from->buckets)[idx];
+    into->count += from->count;
+    into->sum += from->sum;
+    into->max = MAX(into->max, from->max);
+}
+
+uint64_t fmp4_histogram_percentile(const fmp4_histogram_t *histogram,
+                                   double                  percentile)
+{
+    double   exact = 0.0;
+    uint64_t rank  = 0;
+    uint64_t seen  = 0;
+    uint64_t upper = 0;
+    size_t   idx   = 0;
+    size_t   shift = 0;
+
+    /* Sanity checks */
+    if (!histogram || !histogram->count)
+        return 0;
+
+    /* Rank of the wanted value, 1-based */
+    if (percentile <= 0.0)
+        rank = 1;
+    else if (percentile >= 100.0)
+        rank = histogram->count;
+    else
+    {
+        exact = percentile / 100.0 * (double)(histogram->count);
+        rank = (uint64_t)(exact);
+        rank += ((double)(rank) < exact);
+    }
+    rank = MAX(rank, 1);
+
+    /* Walk buckets until the rank is reached */
+    for (idx = 0; idx < FMP4_HISTOGRAM_BUCKETS; idx++)
+    {
+        seen += (histogram->buckets)[idx];
+        if (seen >= rank)
+            break;
+    }
+    if (idx >= FMP4_HISTOGRAM_BUCKETS - 1)
+        return histogram->max;
+    if (idx < FMP4_HISTOGRAM_SUB_COUNT)
+        return idx;
+
+    /* Upper bound of the sub-bucket, the inverse of the record mapping */
+    shift = idx / FMP4_HISTOGRAM_SUB_COUNT - 1;
+    upper = ((uint64_t)(FMP4_HISTOGRAM_SUB_COUNT +
+                idx % FMP4_HISTOGRAM_SUB_COUNT + 1) << shift) - 1;
+
+    return MIN(upper, histogram->max);
+}
@@ -0,0 +1,70 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   histogram.h
+ * Desc:   Log-bucketed histogram interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Log-linear buckets, within 12.5% of the values they count */
+    #define FMP4_HISTOGRAM_SUB_BITS 3
+    #define FMP4_HISTOGRAM_SUB_COUNT (1 << FMP4_HISTOGRAM_SUB_BITS)
+    #define FMP4_HISTOGRAM_MAX_BITS 41
+    #define FMP4_HISTOGRAM_BUCKETS \
+        ((FMP4_HISTOGRAM_MAX_BITS - FMP4_HISTOGRAM_SUB_BITS + 1) * \
+         FMP4_HISTOGRAM_SUB_COUNT)
+
+    /* Log-linear histogram, zero initialized before first use */
+    typedef struct fmp4_histogram_t
+    {
+        uint64_t buckets[FMP4_HISTOGRAM_BUCKETS];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+
+    } fmp4_histogram_t;
+
+    /* Record one value, cheap enough to be called on every box */
+    static inline void fmp4_histogram_record(fmp4_histogram_t *histogram,
+                                             uint64_t          value)
+    {
+        size_t bucket = (size_t)(value);
+        size_t shift  = 0;
+
+        /* Octave from the top bit, sub-bucket from the bits below it */
+        if (value >= FMP4_HISTOGRAM_SUB_COUNT)
+        {
+            shift = 63 - (size_t)(__builtin_clzll(value)) -
+                FMP4_HISTOGRAM_SUB_BITS;
+            bucket = (shift + 1) * FMP4_HISTOGRAM_SUB_COUNT +
+                ((size_t)(value >> shift) & (FMP4_HISTOGRAM_SUB_COUNT - 1));
+        }
+        if (bucket >= FMP4_HISTOGRAM_BUCKETS)
+            bucket = FMP4_HISTOGRAM_BUCKETS - 1;
+        (histogram->buckets)[bucket]++;
+        histogram->count++;
+        histogram->sum += value;
+        if (value > histogram->max)
+            histogram->max = value;
+    }
+
+    /* Histogram public functions */
+    void fmp4_histogram_merge(fmp4_histogram_t *into,
+            const fmp4_histogram_t *from);
+    uint64_t fmp4_histogram_percentile(const fmp4_histogram_t *histogram,
+            double percentile);
+
+#ifdef __cplusplus
+}
+#endif
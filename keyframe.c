@@ -0,0 +1,236 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   keyframe.c
+ * Desc:   Keyframe-only FMP4 sample decimation implementation
+ */
+
+#include "keyframe.h"
+
+#define KEYFRAMES_MIN_CAPACITY 64
+
+/* Bytes of one sample table entry across all of its arrays */
+#define KEYFRAMES_ENTRY_SIZE \
+    (2 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + sizeof(int32_t))
+
+typedef struct keyframes_internal_t
+{
+    fmp4_t                  stream;
+    fmp4_sample_function_t  callback;
+    void                   *userdata;
+
+    /* Sample table of the last moof, compacted to the sync samples still
+     * awaiting the following mdat, the arrays share the table allocation */
+    fmp4_samples_t          samples;
+    void                   *table;
+    size_t                  pending;
+
+    fmp4_keyframes_stats_t  stats;
+
+} keyframes_internal_t;
+
+static bool keyframes_parse(keyframes_internal_t *keyframes,
+        const fmp4_box_t *moof, error_context_t *errctx);
+static bool keyframes_reserve(keyframes_internal_t *keyframes,
+        size_t capacity);
+static bool keyframes_deliver(keyframes_internal_t *keyframes,
+        const fmp4_box_t *mdat, error_context_t *errctx);
+
+fmp4_keyframes_t
+fmp4_keyframes_create(fmp4_t                  fmp4,
+                      fmp4_sample_function_t  callback,
+                      void                   *userdata,
+                      error_context_t        *errctx)
+{
+    keyframes_internal_t *keyframes = NULL;
+
+    /* Sanity checks */
+    if (!fmp4 || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal decimator context */
+    keyframes = (keyframes_internal_t *)(calloc(1,
+                sizeof(keyframes_internal_t)));
+    error_save_retval_if(!keyframes, errctx, ENOMEM, NULL);
+    keyframes->stream = fmp4;
+    keyframes->callback = callback;
+    keyframes->userdata = userdata;
+    if (!keyframes_reserve(keyframes, KEYFRAMES_MIN_CAPACITY))
+    {
+        FREE_AND_NULLIFY(keyframes);
+        error_save_retval(errctx, ENOMEM, NULL);
+    }
+
+    return (fmp4_keyframes_t)(keyframes);
+}
+
+bool
+fmp4_keyframes_push(const fmp4_box_t *box,
+                    void             *userdata,
+                    error_context_t  *errctx)
+{
+    keyframes_internal_t *keyframes = (keyframes_internal_t *)(userdata);
+
+    /* Sanity checks */
+    if (!box || !keyframes || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Samples of a moof are only valid for the mdat right after it */
+    switch (ntohl(box->type))
+    {
+        case FMP4_FOURCC('m', 'o', 'o', 'f'):
+            keyframes->pending = 0;
+            return keyframes_parse(keyframes, box, errctx);
+        case FMP4_FOURCC('m', 'd', 'a', 't'):
+            return keyframes_deliver(keyframes, box, errctx);
+        default: break;
+    }
+
+    return true;
+}
+
+void
+fmp4_keyframes_stats(fmp4_keyframes_t        keyframes,
+                     fmp4_keyframes_stats_t *stats)
+{
+    keyframes_internal_t *keyframesctx = (keyframes_internal_t *)(keyframes);
+
+    /* Sanity checks */
+    if (!keyframesctx || !stats)
+        return;
+
+    *stats = keyframesctx->stats;
+}
+
+void fmp4_keyframes_destroy(fmp4_keyframes_t *keyframes)
+{
+    keyframes_internal_t *keyframesctx = NULL;
+
+    /* Sanity checks */
+    if (!keyframes || !*keyframes)
+        return;
+
+    /* Free & clear allocated resources */
+    keyframesctx = (keyframes_internal_t *)(*keyframes);
+    FREE_AND_NULLIFY(keyframesctx->table);
+    FREE_AND_NULLIFY(*keyframes);
+}
+
+static bool
+keyframes_parse(keyframes_internal_t *keyframes,
+                const fmp4_box_t     *moof,
+                error_context_t      *errctx)
+{
+    error_context_t     parsectx = {};
+    fmp4_samples_t     *samples  = &(keyframes->samples);
+    const fmp4_init_t  *init     = fmp4_get_init(keyframes->stream);
+    const fmp4_track_t *track    = NULL;
+    size_t              idx      = 0;
+    size_t              kept     = 0;
+    bool                video    = false;
+
+    /* Decode the sample table, growing it once to the moof's sample count */
+    if (!fmp4_parse_moof(moof, init, samples, &parsectx))
+    {
+        error_save_retval_if(parsectx.errnum != ENOBUFS, errctx,
+                parsectx.errnum, false);
+        error_save_retval_if(!keyframes_reserve(keyframes, samples->count),
+                errctx, ENOMEM, false);
+        if (!fmp4_parse_moof(moof, init, samples, errctx))
+            return false;
+    }
+    keyframes->stats.fragments++;
+
+    /* Sync decisions follow the video tracks, every track without any */
+    for (idx = 0; init && idx < init->track_count; idx++)
+        video |= (init->tracks)[idx].handler == FMP4_FOURCC('v', 'i', 'd', 'e');
+
+    /* Keep the sync samples at the front of the table */
+    for (idx = 0; idx < samples->count; idx++)
+    {
+        track = fmp4_init_track(init, (samples->track_ids)[idx]);
+        if (((samples->flags)[idx] & FMP4_SAMPLE_IS_NON_SYNC) || (video &&
+                    (!track ||
+                     track->handler != FMP4_FOURCC('v', 'i', 'd', 'e'))))
+        {
+            keyframes->stats.skipped++;
+            keyframes->stats.skipped_bytes += (samples->sizes)[idx];
+            continue;
+        }
+        (samples->track_ids)[kept] = (samples->track_ids)[idx];
+        (samples->sizes)[kept] = (samples->sizes)[idx];
+        (samples->flags)[kept] = (samples->flags)[idx];
+        (samples->composition_offsets)[kept] =
+            (samples->composition_offsets)[idx];
+        (samples->offsets)[kept] = (samples->offsets)[idx];
+        (samples->decode_times)[kept] = (samples->decode_times)[idx];
+        kept++;
+    }
+    keyframes->pending = kept;
+
+    return true;
+}
+
+static bool keyframes_reserve(keyframes_internal_t *keyframes, size_t capacity)
+{
+    fmp4_samples_t *samples = &(keyframes->samples);
+    uint8_t        *table   = NULL;
+
+    /* Carve every array out of one allocation, widest entries first */
+    if (capacity <= samples->capacity)
+        return true;
+    if (capacity > SIZE_MAX / KEYFRAMES_ENTRY_SIZE)
+        return false;
+    table = (uint8_t *)(malloc(capacity * KEYFRAMES_ENTRY_SIZE));
+    if (!table)
+        return false;
+    FREE_AND_NULLIFY(keyframes->table);
+    keyframes->table = table;
+    samples->offsets = (uint64_t *)(table);
+    samples->decode_times = samples->offsets + capacity;
+    samples->track_ids = (uint32_t *)(samples->decode_times + capacity);
+    samples->sizes = samples->track_ids + capacity;
+    samples->flags = samples->sizes + capacity;
+    samples->composition_offsets = (int32_t *)(samples->flags + capacity);
+    samples->durations = NULL;
+    samples->capacity = capacity;
+
+    return true;
+}
+
+static bool
+keyframes_deliver(keyframes_internal_t *keyframes,
+                  const fmp4_box_t     *mdat,
+                  error_context_t      *errctx)
+{
+    const fmp4_samples_t *samples = &(keyframes->samples);
+    fmp4_sample_t         sample  = {};
+    uint64_t              size    = fmp4_box_size(mdat);
+    uint64_t              offset  = 0;
+    size_t                header  = sizeof(fmp4_box_t);
+    size_t                idx     = 0;
+    size_t                pending = keyframes->pending;
+
+    /* Offsets count from the mdat box start, skipped samples are never
+     * read, so fragments without a sync sample end here */
+    keyframes->pending = 0;
+    if (ntohl(mdat->size) == 1)
+        header = sizeof(fmp4_large_box_t);
+    for (idx = 0; idx < pending; idx++)
+    {
+        offset = (samples->offsets)[idx];
+        error_save_retval_if(offset < header || offset > size ||
+                (samples->sizes)[idx] > size - offset, errctx, EBADMSG, false);
+        sample.data = (const uint8_t *)(mdat) + offset;
+        sample.size = (samples->sizes)[idx];
+        sample.track_id = (samples->track_ids)[idx];
+        sample.decode_time = (samples->decode_times)[idx];
+        sample.composition_offset = (samples->composition_offsets)[idx];
+        sample.flags = (samples->flags)[idx];
+        keyframes->stats.samples++;
+        if (!keyframes->callback(&sample, keyframes->userdata, errctx))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   keyframe.h
+ * Desc:   Keyframe-only FMP4 sample decimation interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Sync sample of a fragment, valid until the callback returns */
+    typedef struct fmp4_sample_t
+    {
+        const uint8_t *data;
+        uint32_t       size;
+        uint32_t       track_id;
+        uint64_t       decode_time;        // tfdt based, track timescale
+        int32_t        composition_offset; // presentation minus decode time
+        uint32_t       flags;              // trun/tfhd/trex sample flags
+
+    } fmp4_sample_t;
+
+    /* Callback for sync samples */
+    typedef bool (*fmp4_sample_function_t)(const fmp4_sample_t *sample,
+            void *userdata, error_context_t *errctx);
+
+    /* FMP4 keyframe decimator object */
+    typedef void * fmp4_keyframes_t;
+
+    /* Decimator counters */
+    typedef struct fmp4_keyframes_stats_t
+    {
+        uint64_t fragments;     // moof boxes parsed
+        uint64_t samples;       // sync samples delivered
+        uint64_t skipped;       // samples skipped
+        uint64_t skipped_bytes; // mdat bytes of the skipped samples
+
+    } fmp4_keyframes_stats_t;
+
+    /* Keyframe decimator public functions */
+    fmp4_keyframes_t fmp4_keyframes_create(fmp4_t fmp4,
+            fmp4_sample_function_t callback, void *userdata,
+            error_context_t *errctx);
+    bool fmp4_keyframes_push(const fmp4_box_t *box, void *keyframes,
+            error_context_t *errctx);
+    void fmp4_keyframes_stats(fmp4_keyframes_t keyframes,
+            fmp4_keyframes_stats_t *stats);
+    void fmp4_keyframes_destroy(fmp4_keyframes_t *keyframes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -53,6 +53,7 @@ extern "C"
         ((x & 0x0000000000FF0000ULL) << 24) | \
         ((x & 0x000000000000FF00ULL) << 40) | \
         ((x & 0x00000000000000FFULL) << 56))
+    #define ntohu64(x) htonu64(x)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,502 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   queue.c
+ * Desc:   Lock-free SPSC FMP4 box queue implementation
+ */
+
+#include <pthread.h>
+
+#include "queue.h"
+
+#define QUEUE_MIN_CAPACITY (64 * 1024)
+#define QUEUE_RECORD_SKIP  0x1
+#define QUEUE_RECORD_MEDIA 0x2 // moof or mdat, droppable by overload policies
+#define QUEUE_RECORD_MOOF  0x4 // fragment start, where discarding is decided
+#define QUEUE_FRAGMENTS    64  // queued fragment starts remembered
+#define QUEUE_ALIGN(x)     (((x) + 7) & ~((size_t)(7)))
+#define QUEUE_CACHE_LINE   64
+
+/* Ring record, records never wrap, a skip record pads the ring tail */
+typedef struct queue_record_t
+{
+    uint32_t length;
+    uint32_t flags;
+    uint8_t  data[];
+
+} queue_record_t;
+
+typedef struct queue_internal_t
+{
+    /* Producer side, written by the receive thread only */
+    uint64_t head __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint64_t pushed;
+    uint64_t dropped;
+    size_t   high_water;
+
+    /* Overload policy, producer side, fragments holds the ring positions
+     * of the latest queued moof records */
+    fmp4_overload_t policy;
+    fmp4_t          stream;
+    size_t          budget;
+    bool            skipping; // dropping fragment boxes until a moof
+    bool            paused;   // stream reads stopped by this queue
+    uint64_t        overloads;
+    uint64_t        fragments[QUEUE_FRAGMENTS];
+    uint64_t        fragment_count;
+
+    /* Media records queued before this ring position are skipped */
+    uint64_t discard;
+
+    /* Consumer side, written by the consumer thread only */
+    uint64_t tail __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint64_t delivered;
+    uint64_t discarded;
+    bool     discarding; // current fragment's moof was discarded
+    int      errnum;
+
+    /* Shared, read-mostly state */
+    uint8_t            *buffer __attribute__((aligned(QUEUE_CACHE_LINE)));
+    size_t              capacity;
+    fmp4box_function_t  callback;
+    void               *userdata;
+
+    /* Consumer thread & wakeup */
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    int             sleeping;
+    bool            stop;
+
+} queue_internal_t;
+
+static void *queue_consumer_run(void *arg);
+static bool queue_admit(queue_internal_t *queue, const fmp4_box_t *box,
+        size_t needed, uint64_t tail);
+static void queue_discard_oldest(queue_internal_t *queue, size_t needed,
+        uint64_t tail);
+static void queue_discard_fragment(queue_internal_t *queue, uint64_t tail);
+static bool queue_keyframe(queue_internal_t *queue, const fmp4_box_t *box);
+static bool queue_drained(void *userdata);
+
+fmp4_queue_t
+fmp4_queue_create(size_t              capacity,
+                  fmp4box_function_t  callback,
+                  void               *userdata,
+                  error_context_t    *errctx)
+{
+    queue_internal_t *queue  = NULL;
+    bool              result = false;
+
+    /* Sanity checks */
+    if (!callback || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal queue context */
+    queue = (queue_internal_t *)(aligned_alloc(QUEUE_CACHE_LINE,
+                sizeof(queue_internal_t)));
+    error_save_retval_if(!queue, errctx, ENOMEM, NULL);
+    memset(queue, 0, sizeof(queue_internal_t));
+    pthread_mutex_init(&(queue->lock), NULL);
+    pthread_cond_init(&(queue->wake), NULL);
+    queue->callback = callback;
+    queue->userdata = userdata;
+
+    /* Round ring capacity up to a power of two */
+    queue->capacity = QUEUE_MIN_CAPACITY;
+    while (queue->capacity < capacity)
+        queue->capacity <<= 1;
+    queue->buffer = (uint8_t *)(malloc(queue->capacity));
+    error_save_jump_if(!queue->buffer, errctx, ENOMEM, CLEANUP);
+
+    /* Start consumer thread */
+    if (pthread_create(&(queue->thread), NULL, queue_consumer_run, queue))
+        error_save_jump(errctx, EAGAIN, CLEANUP);
+
+    result = true;
+
+CLEANUP:
+
+    if (!result)
+    {
+        FREE_AND_NULLIFY(queue->buffer);
+        pthread_cond_destroy(&(queue->wake));
+        pthread_mutex_destroy(&(queue->lock));
+        FREE_AND_NULLIFY(queue);
+    }
+
+    return (fmp4_queue_t)(queue);
+}
+
+bool
+fmp4_queue_push(const fmp4_box_t *box,
+                void             *userdata,
+                error_context_t  *errctx)
+{
+    queue_internal_t *queue      = (queue_internal_t *)(userdata);
+    queue_record_t   *record     = NULL;
+    uint64_t          size       = 0;
+    uint64_t          tail       = 0;
+    size_t            needed     = 0;
+    size_t            offset     = 0;
+    size_t            contiguous = 0;
+    size_t            depth      = 0;
+    uint64_t          position   = 0;
+    uint32_t          type       = 0;
+    int               errnum     = 0;
+
+    /* Sanity checks */
+    if (!box || !queue || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Propagate consumer callback failures to the receive path */
+    errnum = __atomic_load_n(&(queue->errnum), __ATOMIC_RELAXED);
+    error_save_retval_if(errnum, errctx, errnum, false);
+
+    /* Compute record space, padding to the ring end if it would wrap */
+    size = fmp4_box_size(box);
+    needed = QUEUE_ALIGN(sizeof(queue_record_t) + size);
+    offset = queue->head & (queue->capacity - 1);
+    contiguous = queue->capacity - offset;
+    tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+    type = ntohl(box->type);
+
+    /* Apply the overload policy, which may skip this box */
+    if (queue->policy != FMP4_OVERLOAD_DROP_NEWEST &&
+        !queue_admit(queue, box, needed, tail))
+    {
+        __atomic_store_n(&(queue->dropped), queue->dropped + 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    if (size > UINT32_MAX || needed > queue->capacity ||
+        queue->head + needed + (needed > contiguous ? contiguous : 0) - tail >
+        queue->capacity)
+    {
+        /* Never block the receive path, drop the box instead, policies drop
+         * the rest of its fragment & what was queued of it too */
+        if (queue->policy != FMP4_OVERLOAD_DROP_NEWEST &&
+            (type == FMP4_FOURCC('m', 'o', 'o', 'f') ||
+             type == FMP4_FOURCC('m', 'd', 'a', 't')))
+        {
+            queue->skipping = true;
+            queue_discard_fragment(queue, tail);
+        }
+        __atomic_store_n(&(queue->dropped), queue->dropped + 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    if (needed > contiguous)
+    {
+        record = (queue_record_t *)(queue->buffer + offset);
+        record->flags = QUEUE_RECORD_SKIP;
+        __atomic_store_n(&(queue->head), queue->head + contiguous,
+                __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    /* Copy box into the ring and publish it, remembering fragment starts */
+    position = queue->head;
+    record = (queue_record_t *)(queue->buffer + offset);
+    record->length = (uint32_t)(size);
+    record->flags = type == FMP4_FOURCC('m', 'o', 'o', 'f') ?
+        QUEUE_RECORD_MEDIA | QUEUE_RECORD_MOOF :
+        type == FMP4_FOURCC('m', 'd', 'a', 't') ? QUEUE_RECORD_MEDIA : 0;
+    memcpy(record->data, box, size);
+
+    /* Sequentially consistent, so the sleeping load below cannot pass the
+     * store & miss a consumer about to wait on the old head */
+    __atomic_store_n(&(queue->head), queue->head + needed, __ATOMIC_SEQ_CST);
+    if (type == FMP4_FOURCC('m', 'o', 'o', 'f'))
+        (queue->fragments)[(queue->fragment_count)++ % QUEUE_FRAGMENTS] =
+            position;
+
+    /* Update counters */
+    depth = queue->head - tail;
+    if (depth > queue->high_water)
+        __atomic_store_n(&(queue->high_water), depth, __ATOMIC_RELAXED);
+    __atomic_store_n(&(queue->pushed), queue->pushed + 1, __ATOMIC_RELAXED);
+
+    /* Wake the consumer only if it went to sleep */
+    if (__atomic_load_n(&(queue->sleeping), __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&(queue->lock));
+        pthread_cond_signal(&(queue->wake));
+        pthread_mutex_unlock(&(queue->lock));
+    }
+
+    return true;
+}
+
+void fmp4_queue_stats(fmp4_queue_t queue, fmp4_queue_stats_t *stats)
+{
+    queue_internal_t *queuectx = (queue_internal_t *)(queue);
+
+    /* Sanity checks */
+    if (!queuectx || !stats)
+        return;
+
+    /* Snapshot counters, each one is consistent on its own */
+    stats->pushed = __atomic_load_n(&(queuectx->pushed), __ATOMIC_RELAXED);
+    stats->delivered = __atomic_load_n(&(queuectx->delivered), __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&(queuectx->dropped), __ATOMIC_RELAXED);
+    stats->discarded = __atomic_load_n(&(queuectx->discarded),
+            __ATOMIC_RELAXED);
+    stats->overloads = __atomic_load_n(&(queuectx->overloads),
+            __ATOMIC_RELAXED);
+    stats->depth = __atomic_load_n(&(queuectx->head), __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&(queuectx->tail), __ATOMIC_ACQUIRE);
+    stats->high_water = __atomic_load_n(&(queuectx->high_water),
+            __ATOMIC_RELAXED);
+    stats->capacity = queuectx->capacity;
+}
+
+bool
+fmp4_queue_set_overload(fmp4_queue_t     queue,
+                        fmp4_t           fmp4,
+                        fmp4_overload_t  policy,
+                        size_t           budget,
+                        error_context_t *errctx)
+{
+    queue_internal_t *queuectx = (queue_internal_t *)(queue);
+
+    /* Sanity checks */
+    if (!queuectx || !errctx || policy > FMP4_OVERLOAD_DROP_TO_KEYFRAME)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!fmp4 && (policy == FMP4_OVERLOAD_BLOCK ||
+            policy == FMP4_OVERLOAD_DROP_TO_KEYFRAME), errctx, EINVAL, false);
+    error_save_retval_if(policy == FMP4_OVERLOAD_BLOCK &&
+            !fmp4_can_pause(fmp4), errctx, EPROTONOSUPPORT, false);
+    error_save_retval_if(queuectx->pushed, errctx, EBUSY, false);
+
+    /* Leave headroom above the budget for boxes arriving past it */
+    queuectx->policy = policy;
+    queuectx->stream = fmp4;
+    queuectx->budget = (!budget || budget > queuectx->capacity) ?
+        queuectx->capacity / 2 : budget;
+
+    return true;
+}
+
+void fmp4_queue_destroy(fmp4_queue_t *queue)
+{
+    queue_internal_t *queuectx = NULL;
+
+    /* Sanity checks */
+    if (!queue || !*queue)
+        return;
+
+    /* Cast to internal queue context */
+    queuectx = (queue_internal_t *)(*queue);
+
+    /* Stop consumer thread once it has drained the ring */
+    pthread_mutex_lock(&(queuectx->lock));
+    queuectx->stop = true;
+    pthread_cond_signal(&(queuectx->wake));
+    pthread_mutex_unlock(&(queuectx->lock));
+    pthread_join(queuectx->thread, NULL);
+
+    /* Free & clear allocated resources */
+    FREE_AND_NULLIFY(queuectx->buffer);
+    pthread_cond_destroy(&(queuectx->wake));
+    pthread_mutex_destroy(&(queuectx->lock));
+    FREE_AND_NULLIFY(*queue);
+}
+
+static void *queue_consumer_run(void *arg)
+{
+    queue_internal_t *queue  = (queue_internal_t *)(arg);
+    queue_record_t   *record  = NULL;
+    error_context_t   errctx  = {};
+    uint64_t          head    = 0;
+    uint64_t          discard = 0;
+    size_t            offset  = 0;
+
+    while (true)
+    {
+        /* Sleep while the ring is empty, the producer wakes us up */
+        head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+        if (head == queue->tail)
+        {
+            pthread_mutex_lock(&(queue->lock));
+            __atomic_store_n(&(queue->sleeping), 1, __ATOMIC_SEQ_CST);
+            while (!queue->stop &&
+                   __atomic_load_n(&(queue->head), __ATOMIC_SEQ_CST) == queue->tail)
+                pthread_cond_wait(&(queue->wake), &(queue->lock));
+            __atomic_store_n(&(queue->sleeping), 0, __ATOMIC_RELAXED);
+            if (queue->stop &&
+                __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE) == queue->tail)
+            {
+                pthread_mutex_unlock(&(queue->lock));
+                break;
+            }
+            pthread_mutex_unlock(&(queue->lock));
+            continue;
+        }
+
+        /* Skip padding at the ring end */
+        offset = queue->tail & (queue->capacity - 1);
+        record = (queue_record_t *)(queue->buffer + offset);
+        if (record->flags & QUEUE_RECORD_SKIP)
+        {
+            __atomic_store_n(&(queue->tail), queue->tail +
+                    (queue->capacity - offset), __ATOMIC_RELEASE);
+            continue;
+        }
+
+        /* Skip fragments an overload policy discarded, decided at their
+         * moof only so a fragment is either delivered or skipped whole */
+        if (record->flags & QUEUE_RECORD_MOOF)
+        {
+            discard = __atomic_load_n(&(queue->discard), __ATOMIC_ACQUIRE);
+            queue->discarding = queue->tail < discard;
+        }
+        if ((record->flags & QUEUE_RECORD_MEDIA) && queue->discarding)
+        {
+            __atomic_store_n(&(queue->discarded), queue->discarded + 1,
+                    __ATOMIC_RELAXED);
+            __atomic_store_n(&(queue->tail), queue->tail +
+                    QUEUE_ALIGN(sizeof(queue_record_t) + record->length),
+                    __ATOMIC_RELEASE);
+            continue;
+        }
+
+        /* Invoke user-provided callback, stop delivering after a failure */
+        if (!queue->errnum &&
+            !queue->callback((const fmp4_box_t *)(record->data),
+                queue->userdata, &errctx))
+            __atomic_store_n(&(queue->errnum), errctx.errnum ? errctx.errnum :
+                    ECANCELED, __ATOMIC_RELAXED);
+        __atomic_store_n(&(queue->delivered), queue->delivered + 1,
+                __ATOMIC_RELAXED);
+
+        /* Release ring space to the producer */
+        __atomic_store_n(&(queue->tail), queue->tail +
+                QUEUE_ALIGN(sizeof(queue_record_t) + record->length),
+                __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static bool
+queue_admit(queue_internal_t *queue,
+            const fmp4_box_t *box,
+            size_t            needed,
+            uint64_t          tail)
+{
+    error_context_t errctx = {};
+    uint32_t        type   = ntohl(box->type);
+    bool            over   = queue->head - tail + needed > queue->budget;
+
+    /* Stop the stream's reads as soon as the budget is exceeded, a pause
+     * refused while the connection is down is retried on the next box */
+    if (queue->policy == FMP4_OVERLOAD_BLOCK)
+    {
+        if (over && !queue->paused &&
+            fmp4_pause(queue->stream, queue_drained, queue, &errctx))
+        {
+            queue->paused = true;
+            __atomic_store_n(&(queue->overloads), queue->overloads + 1,
+                    __ATOMIC_RELAXED);
+        }
+        return true;
+    }
+
+    /* Boxes outside fragments are never dropped, fragments are dropped
+     * whole so decisions are only taken at their moof box */
+    if (type == FMP4_FOURCC('m', 'd', 'a', 't'))
+        return !queue->skipping;
+    if (type != FMP4_FOURCC('m', 'o', 'o', 'f'))
+        return true;
+    if (over)
+        __atomic_store_n(&(queue->overloads), queue->overloads + 1,
+                __ATOMIC_RELAXED);
+    if (queue->policy == FMP4_OVERLOAD_DROP_OLDEST)
+    {
+        if (over)
+            queue_discard_oldest(queue, needed, tail);
+        queue->skipping = false;
+        return true;
+    }
+
+    /* Drop to keyframe discards all queued fragments, then skips received
+     * ones until a keyframe fragment */
+    if (over)
+    {
+        __atomic_store_n(&(queue->discard), queue->head, __ATOMIC_RELEASE);
+        queue->skipping = true;
+    }
+    if (queue->skipping && queue_keyframe(queue, box))
+        queue->skipping = false;
+
+    return !queue->skipping;
+}
+
+static void
+queue_discard_oldest(queue_internal_t *queue,
+                     size_t            needed,
+                     uint64_t          tail)
+{
+    uint64_t start    = 0;
+    uint64_t discard  = queue->head;
+    uint64_t position = 0;
+
+    /* Oldest queued fragment start keeping the rest within the budget,
+     * without one every queued fragment goes */
+    start = queue->fragment_count > QUEUE_FRAGMENTS ?
+        queue->fragment_count - QUEUE_FRAGMENTS : 0;
+    for (; start < queue->fragment_count; start++)
+    {
+        position = (queue->fragments)[start % QUEUE_FRAGMENTS];
+        if (position < tail || position <= queue->discard)
+            continue;
+        if (queue->head + needed - position <= queue->budget)
+        {
+            discard = position;
+            break;
+        }
+    }
+    __atomic_store_n(&(queue->discard), discard, __ATOMIC_RELEASE);
+}
+
+static void queue_discard_fragment(queue_internal_t *queue, uint64_t tail)
+{
+    uint64_t position = 0;
+
+    /* A single discard position cannot cut out the fragment being received
+     * alone, so it goes together with those queued before it */
+    if (!queue->fragment_count)
+        return;
+    position = (queue->fragments)[(queue->fragment_count - 1) %
+        QUEUE_FRAGMENTS];
+    if (position >= tail && position > queue->discard)
+        __atomic_store_n(&(queue->discard), queue->head, __ATOMIC_RELEASE);
+}
+
+static bool queue_keyframe(queue_internal_t *queue, const fmp4_box_t *box)
+{
+    error_context_t errctx   = {};
+    bool            keyframe = false;
+
+    /* Fragments which cannot be told apart count as keyframes, so that a
+     * stream without an init segment yet is not dropped for good */
+    if (!fmp4_parse_keyframe(box, fmp4_get_init(queue->stream), &keyframe,
+                &errctx))
+        return true;
+
+    return keyframe;
+}
+
+static bool queue_drained(void *userdata)
+{
+    queue_internal_t *queue = (queue_internal_t *)(userdata);
+    uint64_t          tail  = 0;
+
+    /* Polled on the receive thread, resume below half the budget */
+    tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+    if (queue->head - tail > queue->budget / 2)
+        return false;
+    queue->paused = false;
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   queue.h
+ * Desc:   Lock-free SPSC FMP4 box queue interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* FMP4 box queue object, boxes pushed from the receive path are copied
+     * into a bounded single-producer/single-consumer ring and delivered to
+     * the consumer callback from a dedicated consumer thread */
+    typedef void * fmp4_queue_t;
+
+    /* Overload policies, applied once the ring holds more than the budget.
+     * Dropping policies only ever drop moof & mdat boxes, whole fragments
+     * at a time, other boxes such as init segments are always delivered.
+     * Only an mdat not fitting the ring once its moof was delivered leaves
+     * that fragment cut */
+    typedef enum fmp4_overload_t
+    {
+        FMP4_OVERLOAD_DROP_NEWEST,      // drop boxes not fitting the ring,
+                                        // the default, budget unused
+        FMP4_OVERLOAD_BLOCK,            // pause the stream's reads until
+                                        // the ring drained to half budget
+        FMP4_OVERLOAD_DROP_OLDEST,      // discard the oldest queued whole
+                                        // fragments down to the budget
+        FMP4_OVERLOAD_DROP_TO_KEYFRAME, // discard every queued fragment &
+                                        // the received ones until a
+                                        // keyframe fragment
+
+    } fmp4_overload_t;
+
+    /* Queue counters, depth is measured in bytes of ring space in use */
+    typedef struct fmp4_queue_stats_t
+    {
+        uint64_t pushed;     // boxes accepted into the ring
+        uint64_t delivered;  // boxes handed to the consumer callback
+        uint64_t dropped;    // boxes dropped because the ring was full
+        uint64_t discarded;  // queued boxes skipped by an overload policy
+        uint64_t overloads;  // times the budget was exceeded
+        size_t   depth;      // ring bytes currently in use
+        size_t   high_water; // maximum ring bytes ever in use
+        size_t   capacity;   // ring capacity in bytes
+
+    } fmp4_queue_stats_t;
+
+    /* Queue public functions, fmp4_queue_push() has the fmp4box_function_t
+     * signature and takes the queue as userdata, so it can be passed to
+     * fmp4_recv(), fmp4_pool_attach() or fmp4_engine_add() directly */
+    fmp4_queue_t fmp4_queue_create(size_t capacity, fmp4box_function_t callback,
+            void *userdata, error_context_t *errctx);
+    bool fmp4_queue_push(const fmp4_box_t *box, void *queue,
+            error_context_t *errctx);
+    void fmp4_queue_stats(fmp4_queue_t queue, fmp4_queue_stats_t *stats);
+
+    /* Select the overload policy of a queue fed by the given stream alone,
+     * before the first push. Budget is in ring bytes, 0 or more than the
+     * capacity meaning half the capacity, so that boxes received while
+     * reads stop or fragments are discarded still fit the ring. The stream
+     * may be NULL under FMP4_OVERLOAD_DROP_NEWEST & DROP_OLDEST, BLOCK
+     * fails with EPROTONOSUPPORT on transports which cannot stop reading */
+    bool fmp4_queue_set_overload(fmp4_queue_t queue, fmp4_t fmp4,
+            fmp4_overload_t policy, size_t budget, error_context_t *errctx);
+    void fmp4_queue_destroy(fmp4_queue_t *queue);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,847 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   recorder.c
+ * Desc:   Asynchronous segmented FMP4 recorder implementation
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "recorder.h"
+
+#define RECORDER_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define RECORDER_DEFAULT_BUFFERS     256
+#define RECORDER_DEFAULT_THREADS     4
+#define RECORDER_ALIGNMENT           4096
+#define RECORDER_MAX_IOV             16
+
+typedef struct recorder_internal_t recorder_internal_t;
+typedef struct recording_internal_t recording_internal_t;
+
+/* Segment file, closed after it was rotated away & its last write is done */
+typedef struct recorder_file_t
+{
+    recording_internal_t *recording;
+    int                   fd;
+    uint32_t              refs; // current segment & writes in flight
+
+} recorder_file_t;
+
+/* Page aligned write buffer, a write request once submitted */
+typedef struct recorder_buffer_t
+{
+    struct recorder_buffer_t *next;
+    recorder_file_t          *file;
+    off_t                     offset; // file offset of data
+    size_t                    length; // bytes filled
+    size_t                    done;   // bytes written
+    uint8_t                  *data;
+
+} recorder_buffer_t;
+
+struct recorder_internal_t
+{
+    fmp4_recorder_options_t options;
+
+    /* Buffers & writes in flight, guarded by lock */
+    pthread_mutex_t    lock;
+    pthread_cond_t     idle;      // signaled on every completed write
+    recorder_buffer_t *free;
+    size_t             allocated;
+    size_t             inflight;
+    bool               stop;
+
+#ifdef HAVE_LIBURING
+    /* Submission ring, shared by the submitting threads, guarded by
+     * ring_lock, completions are reaped by a single thread. Writes go
+     * through it once the reaper started */
+    struct io_uring    ring;
+    pthread_mutex_t    ring_lock;
+    pthread_t          reaper;
+    bool               ring_ready;
+    bool               reaper_started;
+#endif
+
+    /* Pending writes of the pwritev threads, FIFO guarded by lock, used
+     * when no ring could be set up */
+    pthread_cond_t     wake;
+    recorder_buffer_t *head;
+    recorder_buffer_t *tail;
+    pthread_t         *threads;
+    size_t             started;
+};
+
+struct recording_internal_t
+{
+    recorder_internal_t *recorder;
+    char                *prefix;
+    int64_t              segment_duration; // in us, 0 = unlimited
+
+    /* Init segment, copied at the start of every segment */
+    uint8_t    *ftyp;
+    size_t      ftyp_size;
+    uint8_t    *moov;
+    size_t      moov_size;
+    fmp4_init_t init;
+
+    /* Current segment, only touched by the writing thread */
+    recorder_file_t   *file;
+    recorder_buffer_t *buffer;
+    off_t              offset;  // file offset of the next byte
+    int64_t            started; // monotonic us of the segment start
+    uint32_t           index;
+    bool               keyed;   // segment started at a keyframe fragment
+    bool               gap;     // boxes dropped until the next segment
+
+    /* Shared with the I/O threads */
+    size_t                 pending; // writes in flight, guarded by lock
+    int                    errnum;  // first write error, atomic
+    fmp4_recording_stats_t stats;   // written is atomic
+
+};
+
+static bool recording_segment_start(recording_internal_t *recording,
+        error_context_t *errctx);
+static void recording_segment_finish(recording_internal_t *recording);
+static bool recording_append(recording_internal_t *recording,
+        const uint8_t *data, size_t length);
+static bool recording_copy(uint8_t **copy, size_t *copy_size,
+        const fmp4_box_t *box, error_context_t *errctx);
+static recorder_buffer_t *recorder_buffers_get(recorder_internal_t *recorder,
+        size_t count);
+static void recorder_submit(recorder_internal_t *recorder,
+        recorder_buffer_t *buffer);
+static void recorder_complete(recorder_internal_t *recorder,
+        recorder_buffer_t *buffer, int errnum);
+static void recorder_file_unref(recorder_file_t *file);
+#ifdef HAVE_LIBURING
+static bool recorder_ring_start(recorder_internal_t *recorder);
+static bool recorder_ring_write(recorder_internal_t *recorder,
+        recorder_buffer_t *buffer);
+static void *recorder_reaper_run(void *arg);
+#endif
+static bool recorder_threads_start(recorder_internal_t *recorder,
+        error_context_t *errctx);
+static void *recorder_thread_run(void *arg);
+static int recorder_pwritev(recorder_buffer_t **batch, size_t count);
+
+fmp4_recorder_t
+fmp4_recorder_create(const fmp4_recorder_options_t *options,
+                     error_context_t               *errctx)
+{
+    recorder_internal_t *recorder = NULL;
+    bool                 ring     = false;
+    bool                 result   = false;
+
+    /* Sanity checks */
+    if (!errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal recorder context */
+    recorder = (recorder_internal_t *)(calloc(1, sizeof(recorder_internal_t)));
+    error_save_retval_if(!recorder, errctx, errno, NULL);
+    pthread_mutex_init(&(recorder->lock), NULL);
+    pthread_cond_init(&(recorder->idle), NULL);
+    pthread_cond_init(&(recorder->wake), NULL);
+#ifdef HAVE_LIBURING
+    pthread_mutex_init(&(recorder->ring_lock), NULL);
+#endif
+
+    /* Apply options & defaults, whole pages keep every full buffer, and so
+     * every write but a segment's last, at a page aligned file offset */
+    if (options)
+        recorder->options = *options;
+    if (!(recorder->options).buffer_size)
+        (recorder->options).buffer_size = RECORDER_DEFAULT_BUFFER_SIZE;
+    (recorder->options).buffer_size = ((recorder->options).buffer_size +
+            RECORDER_ALIGNMENT - 1) / RECORDER_ALIGNMENT * RECORDER_ALIGNMENT;
+    if (!(recorder->options).buffers)
+        (recorder->options).buffers = RECORDER_DEFAULT_BUFFERS;
+    if (!(recorder->options).threads)
+        (recorder->options).threads = RECORDER_DEFAULT_THREADS;
+
+    /* io_uring when built with it & the kernel grants a ring, which old
+     * kernels, seccomp filters or a low RLIMIT_MEMLOCK prevent, pwritev
+     * threads otherwise */
+#ifdef HAVE_LIBURING
+    ring = recorder_ring_start(recorder);
+#endif
+    if (!ring && !recorder_threads_start(recorder, errctx))
+        goto CLEANUP;
+
+    result = true;
+
+CLEANUP:
+
+    if (!result)
+        fmp4_recorder_destroy((fmp4_recorder_t *)(&recorder));
+
+    return (fmp4_recorder_t)(recorder);
+}
+
+void fmp4_recorder_destroy(fmp4_recorder_t *recorder)
+{
+    recorder_internal_t *recorderctx = NULL;
+    recorder_buffer_t   *buffer      = NULL;
+#ifdef HAVE_LIBURING
+    struct io_uring_sqe *sqe         = NULL;
+#endif
+    size_t               idx         = 0;
+
+    /* Sanity checks */
+    if (!recorder || !*recorder)
+        return;
+
+    /* Cast to internal recorder context */
+    recorderctx = (recorder_internal_t *)(*recorder);
+
+    /* Let writes in flight complete, then stop the I/O threads */
+    pthread_mutex_lock(&(recorderctx->lock));
+    while (recorderctx->inflight)
+        pthread_cond_wait(&(recorderctx->idle), &(recorderctx->lock));
+    recorderctx->stop = true;
+    pthread_cond_broadcast(&(recorderctx->wake));
+    pthread_mutex_unlock(&(recorderctx->lock));
+
+#ifdef HAVE_LIBURING
+    /* A write-less completion wakes the reaper up for good */
+    if (recorderctx->reaper_started)
+    {
+        pthread_mutex_lock(&(recorderctx->ring_lock));
+        sqe = io_uring_get_sqe(&(recorderctx->ring));
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, NULL);
+        io_uring_submit(&(recorderctx->ring));
+        pthread_mutex_unlock(&(recorderctx->ring_lock));
+        pthread_join(recorderctx->reaper, NULL);
+    }
+    if (recorderctx->ring_ready)
+        io_uring_queue_exit(&(recorderctx->ring));
+    pthread_mutex_destroy(&(recorderctx->ring_lock));
+#endif
+    for (idx = 0; idx < recorderctx->started; idx++)
+        pthread_join((recorderctx->threads)[idx], NULL);
+    FREE_AND_NULLIFY(recorderctx->threads);
+    pthread_cond_destroy(&(recorderctx->wake));
+
+    /* Free & clear allocated resources */
+    while (recorderctx->free)
+    {
+        buffer = recorderctx->free;
+        recorderctx->free = buffer->next;
+        FREE_AND_NULLIFY(buffer->data);
+        FREE_AND_NULLIFY(buffer);
+    }
+    pthread_cond_destroy(&(recorderctx->idle));
+    pthread_mutex_destroy(&(recorderctx->lock));
+    FREE_AND_NULLIFY(*recorder);
+}
+
+fmp4_recording_t
+fmp4_recording_open(fmp4_recorder_t  recorder,
+                    const char      *prefix,
+                    uint32_t         segment_duration,
+                    error_context_t *errctx)
+{
+    recording_internal_t *recording = NULL;
+
+    /* Sanity checks */
+    if (!recorder || !prefix || !*prefix || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Setup internal recording context, the first segment is opened with
+     * the first keyframe fragment */
+    recording = (recording_internal_t *)(calloc(1,
+                sizeof(recording_internal_t)));
+    error_save_retval_if(!recording, errctx, errno, NULL);
+    recording->recorder = (recorder_internal_t *)(recorder);
+    recording->segment_duration = (int64_t)(segment_duration) * 1000;
+    recording->prefix = strdup(prefix);
+    if (!recording->prefix)
+    {
+        FREE_AND_NULLIFY(recording);
+        error_save_retval(errctx, ENOMEM, NULL);
+    }
+
+    return (fmp4_recording_t)(recording);
+}
+
+bool
+fmp4_recording_write(const fmp4_box_t *box,
+                     void             *recording,
+                     error_context_t  *errctx)
+{
+    recording_internal_t *recordingctx = (recording_internal_t *)(recording);
+    error_context_t       errors       = {};
+    bool                  keyframe     = false;
+    int                   errnum       = 0;
+
+    /* Sanity checks */
+    if (!box || !recordingctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Report write errors of earlier boxes */
+    errnum = __atomic_load_n(&(recordingctx->errnum), __ATOMIC_ACQUIRE);
+    error_save_retval_if(errnum, errctx, errnum, false);
+
+    switch (ntohl(box->type))
+    {
+        /* A new init segment ends the current segment, the next one starts
+         * with it at the next keyframe fragment */
+        case FMP4_FOURCC('f', 't', 'y', 'p'):
+            recording_segment_finish(recordingctx);
+            recordingctx->keyed = false;
+            FREE_AND_NULLIFY(recordingctx->moov);
+            recordingctx->moov_size = 0;
+            memset(&(recordingctx->init), 0, sizeof(fmp4_init_t));
+        return recording_copy(&(recordingctx->ftyp),
+                &(recordingctx->ftyp_size), box, errctx);
+        case FMP4_FOURCC('m', 'o', 'o', 'v'):
+            recording_segment_finish(recordingctx);
+            recordingctx->keyed = false;
+            if (!recording_copy(&(recordingctx->moov),
+                        &(recordingctx->moov_size), box, errctx))
+                return false;
+            if (!fmp4_parse_init((const fmp4_box_t *)(recordingctx->moov),
+                        &(recordingctx->init), &errors))
+                memset(&(recordingctx->init), 0, sizeof(fmp4_init_t));
+        return true;
+
+        /* Segments start & rotate on keyframe fragments only */
+        case FMP4_FOURCC('m', 'o', 'o', 'f'):
+            if (!fmp4_parse_keyframe(box, &(recordingctx->init), &keyframe,
+                        &errors))
+                keyframe = false;
+            if (keyframe && (!recordingctx->keyed ||
+                        (recordingctx->segment_duration &&
+                         current_monotonic_microseconds() -
+                         recordingctx->started >=
+                         recordingctx->segment_duration)))
+            {
+                if (!recording_segment_start(recordingctx, errctx))
+                    return false;
+            }
+        break;
+        default: break;
+    }
+
+    /* Nothing is recorded ahead of the first keyframe fragment, boxes
+     * skipped after a drop count as dropped too */
+    if (!recordingctx->keyed)
+    {
+        if (recordingctx->gap)
+            recordingctx->stats.dropped++;
+        return true;
+    }
+
+    /* Out of buffers, skip to the next keyframe fragment */
+    if (!recording_append(recordingctx, (const uint8_t *)(box),
+                fmp4_box_size(box)))
+    {
+        recordingctx->stats.dropped++;
+        recording_segment_finish(recordingctx);
+        recordingctx->keyed = false;
+        recordingctx->gap = true;
+    }
+
+    return true;
+}
+
+void
+fmp4_recording_stats(fmp4_recording_t        recording,
+                     fmp4_recording_stats_t *stats)
+{
+    recording_internal_t *recordingctx = (recording_internal_t *)(recording);
+
+    /* Sanity checks */
+    if (!recordingctx || !stats)
+        return;
+
+    *stats = recordingctx->stats;
+    stats->written = __atomic_load_n(&(recordingctx->stats.written),
+            __ATOMIC_RELAXED);
+}
+
+bool
+fmp4_recording_close(fmp4_recording_t *recording,
+                     error_context_t  *errctx)
+{
+    recording_internal_t *recordingctx = NULL;
+    recorder_internal_t  *recorder     = NULL;
+    int                   errnum       = 0;
+
+    /* Sanity checks */
+    if (!recording || !*recording)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast to internal recording context */
+    recordingctx = (recording_internal_t *)(*recording);
+    recorder = recordingctx->recorder;
+
+    /* Flush the current segment & wait for its writes to complete */
+    recording_segment_finish(recordingctx);
+    pthread_mutex_lock(&(recorder->lock));
+    while (recordingctx->pending)
+        pthread_cond_wait(&(recorder->idle), &(recorder->lock));
+    pthread_mutex_unlock(&(recorder->lock));
+    errnum = __atomic_load_n(&(recordingctx->errnum), __ATOMIC_ACQUIRE);
+
+    /* Free & clear allocated resources */
+    FREE_AND_NULLIFY(recordingctx->ftyp);
+    FREE_AND_NULLIFY(recordingctx->moov);
+    FREE_AND_NULLIFY(recordingctx->prefix);
+    FREE_AND_NULLIFY(*recording);
+    error_save_retval_if(errnum, errctx, errnum, false);
+
+    return true;
+}
+
+static bool
+recording_segment_start(recording_internal_t *recording,
+                        error_context_t      *errctx)
+{
+    recorder_file_t *file = NULL;
+    char             path[PATH_MAX] = {};
+    int              fd   = -1;
+
+    /* Open the next segment file */
+    recording_segment_finish(recording);
+    if (snprintf(path, sizeof(path), "%s-%06u.mp4", recording->prefix,
+                recording->index) >= (int)(sizeof(path)))
+        error_save_retval(errctx, ENAMETOOLONG, false);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    error_save_retval_if(fd < 0, errctx, errno, false);
+    file = (recorder_file_t *)(calloc(1, sizeof(recorder_file_t)));
+    if (!file)
+    {
+        close(fd);
+        error_save_retval(errctx, ENOMEM, false);
+    }
+    file->recording = recording;
+    file->fd = fd;
+    file->refs = 1;
+    recording->file = file;
+    recording->offset = 0;
+    recording->started = current_monotonic_microseconds();
+    recording->index++;
+    recording->keyed = true;
+    recording->gap = false;
+    recording->stats.segments++;
+
+    /* Every segment opens with the init segment, without it the segment is
+     * abandoned & the boxes up to the next keyframe fragment are dropped */
+    if ((recording->ftyp && !recording_append(recording, recording->ftyp,
+                    recording->ftyp_size)) ||
+        (recording->moov && !recording_append(recording, recording->moov,
+                    recording->moov_size)))
+    {
+        recording->stats.dropped++;
+        recording_segment_finish(recording);
+        recording->keyed = false;
+        recording->gap = true;
+    }
+
+    return true;
+}
+
+static void recording_segment_finish(recording_internal_t *recording)
+{
+    /* Submit the partly filled buffer, the file closes after its write */
+    if (recording->buffer)
+    {
+        recorder_submit(recording->recorder, recording->buffer);
+        recording->buffer = NULL;
+    }
+    if (recording->file)
+    {
+        recorder_file_unref(recording->file);
+        recording->file = NULL;
+    }
+}
+
+static bool
+recording_append(recording_internal_t *recording,
+                 const uint8_t        *data,
+                 size_t                length)
+{
+    recorder_internal_t *recorder = recording->recorder;
+    recorder_buffer_t   *buffers  = NULL;
+    recorder_buffer_t   *buffer   = recording->buffer;
+    size_t               size     = (recorder->options).buffer_size;
+    size_t               room     = buffer ? size - buffer->length : 0;
+    size_t               chunk    = 0;
+
+    /* Take every buffer the box needs up front, boxes are never split
+     * between a segment & a gap */
+    if (length > room)
+    {
+        buffers = recorder_buffers_get(recorder,
+                (length - room + size - 1) / size);
+        if (!buffers)
+            return false;
+    }
+
+    /* Coalesce into buffers, submitting each as soon as it is full */
+    while (length)
+    {
+        if (!buffer)
+        {
+            buffer = buffers;
+            buffers = buffers->next;
+            buffer->next = NULL;
+            buffer->file = recording->file;
+            buffer->offset = recording->offset;
+        }
+        chunk = MIN(length, size - buffer->length);
+        memcpy(buffer->data + buffer->length, data, chunk);
+        buffer->length += chunk;
+        recording->offset += chunk;
+        data += chunk;
+        length -= chunk;
+        if (buffer->length == size)
+        {
+            recorder_submit(recorder, buffer);
+            buffer = NULL;
+        }
+    }
+    recording->buffer = buffer;
+
+    return true;
+}
+
+static bool
+recording_copy(uint8_t          **copy,
+               size_t            *copy_size,
+               const fmp4_box_t  *box,
+               error_context_t   *errctx)
+{
+    uint64_t size = fmp4_box_size(box);
+
+    /* Keep a private copy of an init segment box */
+    FREE_AND_NULLIFY(*copy);
+    *copy_size = 0;
+    *copy = (uint8_t *)(malloc(size));
+    error_save_retval_if(!*copy, errctx, ENOMEM, false);
+    memcpy(*copy, box, size);
+    *copy_size = size;
+
+    return true;
+}
+
+static recorder_buffer_t *
+recorder_buffers_get(recorder_internal_t *recorder,
+                     size_t               count)
+{
+    recorder_buffer_t *buffers = NULL;
+    recorder_buffer_t *buffer  = NULL;
+    size_t             idx     = 0;
+    size_t             spare   = 0;
+
+    /* All or nothing, from the free list first, then new allocations */
+    pthread_mutex_lock(&(recorder->lock));
+    for (buffer = recorder->free; buffer && spare < count; buffer = buffer->next)
+        spare++;
+    if (spare + (recorder->options).buffers - recorder->allocated < count)
+    {
+        pthread_mutex_unlock(&(recorder->lock));
+        return NULL;
+    }
+    for (idx = 0; idx < count; idx++)
+    {
+        buffer = recorder->free;
+        if (buffer)
+            recorder->free = buffer->next;
+        else
+        {
+            buffer = (recorder_buffer_t *)(calloc(1,
+                        sizeof(recorder_buffer_t)));
+            if (buffer && posix_memalign((void **)(&(buffer->data)),
+                        RECORDER_ALIGNMENT, (recorder->options).buffer_size))
+                FREE_AND_NULLIFY(buffer);
+            if (!buffer)
+                break;
+            recorder->allocated++;
+        }
+        buffer->next = buffers;
+        buffers = buffer;
+    }
+
+    /* Hand partial takes back on allocation failure */
+    if (idx < count)
+    {
+        while (buffers)
+        {
+            buffer = buffers;
+            buffers = buffer->next;
+            buffer->next = recorder->free;
+            recorder->free = buffer;
+        }
+    }
+    pthread_mutex_unlock(&(recorder->lock));
+
+    return buffers;
+}
+
+static void
+recorder_submit(recorder_internal_t *recorder,
+                recorder_buffer_t   *buffer)
+{
+    recording_internal_t *recording = buffer->file->recording;
+
+    /* The write holds its file open & its recording alive */
+    __atomic_add_fetch(&(buffer->file->refs), 1, __ATOMIC_RELAXED);
+    buffer->done = 0;
+    pthread_mutex_lock(&(recorder->lock));
+    recording->pending++;
+    recorder->inflight++;
+#ifdef HAVE_LIBURING
+    if (recorder->reaper_started)
+    {
+        pthread_mutex_unlock(&(recorder->lock));
+        if (!recorder_ring_write(recorder, buffer))
+            recorder_complete(recorder, buffer, EBUSY);
+        return;
+    }
+#endif
+    buffer->next = NULL;
+    if (recorder->tail)
+        recorder->tail->next = buffer;
+    else
+        recorder->head = buffer;
+    recorder->tail = buffer;
+    pthread_cond_signal(&(recorder->wake));
+    pthread_mutex_unlock(&(recorder->lock));
+}
+
+static void
+recorder_complete(recorder_internal_t *recorder,
+                  recorder_buffer_t   *buffer,
+                  int                  errnum)
+{
+    recording_internal_t *recording = buffer->file->recording;
+    int                   expected  = 0;
+
+    /* Keep the first write error for the recording to report */
+    if (errnum)
+        __atomic_compare_exchange_n(&(recording->errnum), &expected, errnum,
+                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&(recording->stats.written), buffer->length,
+                __ATOMIC_RELAXED);
+    recorder_file_unref(buffer->file);
+
+    /* Recycle buffer */
+    buffer->file = NULL;
+    buffer->length = 0;
+    pthread_mutex_lock(&(recorder->lock));
+    buffer->next = recorder->free;
+    recorder->free = buffer;
+    recording->pending--;
+    recorder->inflight--;
+    pthread_cond_broadcast(&(recorder->idle));
+    pthread_mutex_unlock(&(recorder->lock));
+}
+
+static void recorder_file_unref(recorder_file_t *file)
+{
+    /* Close segment file with its last reference */
+    if (__atomic_sub_fetch(&(file->refs), 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(file->fd);
+        FREE_AND_NULLIFY(file);
+    }
+}
+
+#ifdef HAVE_LIBURING
+static bool recorder_ring_start(recorder_internal_t *recorder)
+{
+    /* One ring sized for every buffer in flight, completions are reaped
+     * off the submitting threads */
+    if (io_uring_queue_init((unsigned)(MIN((recorder->options).buffers,
+                        4096)), &(recorder->ring), 0) < 0)
+        return false;
+    recorder->ring_ready = true;
+    if (pthread_create(&(recorder->reaper), NULL, recorder_reaper_run,
+                recorder))
+    {
+        io_uring_queue_exit(&(recorder->ring));
+        recorder->ring_ready = false;
+        return false;
+    }
+    recorder->reaper_started = true;
+
+    return true;
+}
+
+static bool
+recorder_ring_write(recorder_internal_t *recorder,
+                    recorder_buffer_t   *buffer)
+{
+    struct io_uring_sqe *sqe = NULL;
+
+    /* One submission per buffer, never per box */
+    pthread_mutex_lock(&(recorder->ring_lock));
+    sqe = io_uring_get_sqe(&(recorder->ring));
+    if (!sqe)
+    {
+        io_uring_submit(&(recorder->ring));
+        sqe = io_uring_get_sqe(&(recorder->ring));
+    }
+    if (sqe)
+    {
+        io_uring_prep_write(sqe, buffer->file->fd, buffer->data + buffer->done,
+                (unsigned)(buffer->length - buffer->done),
+                (uint64_t)(buffer->offset) + buffer->done);
+        io_uring_sqe_set_data(sqe, buffer);
+        io_uring_submit(&(recorder->ring));
+    }
+    pthread_mutex_unlock(&(recorder->ring_lock));
+
+    return sqe != NULL;
+}
+
+static void *recorder_reaper_run(void *arg)
+{
+    recorder_internal_t *recorder = (recorder_internal_t *)(arg);
+    recorder_buffer_t   *buffer   = NULL;
+    struct io_uring_cqe *cqe      = NULL;
+    int                  res      = 0;
+
+    while (true)
+    {
+        if (io_uring_wait_cqe(&(recorder->ring), &cqe))
+            continue;
+        buffer = (recorder_buffer_t *)(io_uring_cqe_get_data(cqe));
+        res = cqe->res;
+        io_uring_cqe_seen(&(recorder->ring), cqe);
+
+        /* The write-less completion posted by fmp4_recorder_destroy() */
+        if (!buffer)
+            break;
+
+        /* Resubmit the remainder of short writes */
+        if (res > 0 && buffer->done + (size_t)(res) < buffer->length)
+        {
+            buffer->done += (size_t)(res);
+            if (recorder_ring_write(recorder, buffer))
+                continue;
+            res = -EBUSY;
+        }
+        recorder_complete(recorder, buffer, res < 0 ? -res :
+                res == 0 ? EIO : 0);
+    }
+
+    return NULL;
+}
+#endif
+
+static bool
+recorder_threads_start(recorder_internal_t *recorder,
+                       error_context_t     *errctx)
+{
+    size_t idx = 0;
+
+    /* Start pwritev threads */
+    recorder->threads = (pthread_t *)(calloc((recorder->options).threads,
+                sizeof(pthread_t)));
+    error_save_retval_if(!recorder->threads, errctx, ENOMEM, false);
+    for (idx = 0; idx < (recorder->options).threads; idx++)
+    {
+        if (pthread_create(&((recorder->threads)[idx]), NULL,
+                    recorder_thread_run, recorder))
+            error_save_retval(errctx, EAGAIN, false);
+        recorder->started++;
+    }
+
+    return true;
+}
+
+static void *recorder_thread_run(void *arg)
+{
+    recorder_internal_t *recorder = (recorder_internal_t *)(arg);
+    recorder_buffer_t   *batch[RECORDER_MAX_IOV] = {};
+    recorder_buffer_t   *last     = NULL;
+    size_t               count    = 0;
+    size_t               idx      = 0;
+    int                  errnum   = 0;
+
+    pthread_mutex_lock(&(recorder->lock));
+    while (true)
+    {
+        while (!recorder->head && !recorder->stop)
+            pthread_cond_wait(&(recorder->wake), &(recorder->lock));
+        if (!recorder->head)
+            break;
+
+        /* Take the oldest write & the ones continuing it in the same file,
+         * written together by a single pwritev() */
+        for (count = 0; recorder->head && count < RECORDER_MAX_IOV; count++)
+        {
+            last = count ? batch[count - 1] : NULL;
+            if (last && (recorder->head->file != last->file ||
+                        recorder->head->offset != last->offset +
+                        (off_t)(last->length)))
+                break;
+            batch[count] = recorder->head;
+            recorder->head = recorder->head->next;
+        }
+        if (!recorder->head)
+            recorder->tail = NULL;
+        pthread_mutex_unlock(&(recorder->lock));
+
+        errnum = recorder_pwritev(batch, count);
+        for (idx = 0; idx < count; idx++)
+            recorder_complete(recorder, batch[idx], errnum);
+
+        pthread_mutex_lock(&(recorder->lock));
+    }
+    pthread_mutex_unlock(&(recorder->lock));
+
+    return NULL;
+}
+
+static int recorder_pwritev(recorder_buffer_t **batch, size_t count)
+{
+    struct iovec iov[RECORDER_MAX_IOV] = {};
+    ssize_t      written = 0;
+    off_t        offset  = batch[0]->offset;
+    size_t       first   = 0;
+    size_t       idx     = 0;
+
+    for (idx = 0; idx < count; idx++)
+    {
+        iov[idx].iov_base = batch[idx]->data;
+        iov[idx].iov_len = batch[idx]->length;
+    }
+
+    /* Write until done, skipping over what short writes consumed */
+    while (first < count)
+    {
+        written = pwritev(batch[0]->file->fd, iov + first, (int)(count - first),
+                offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return written < 0 ? errno : EIO;
+        offset += written;
+        while (first < count && (size_t)(written) >= iov[first].iov_len)
+            written -= (ssize_t)(iov[first++].iov_len);
+        if (first < count)
+        {
+            iov[first].iov_base = (uint8_t *)(iov[first].iov_base) + written;
+            iov[first].iov_len -= (size_t)(written);
+        }
+    }
+
+    return 0;
+}
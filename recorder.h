@@ -0,0 +1,77 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   recorder.h
+ * Desc:   Asynchronous segmented FMP4 recorder interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+#include "fmp4.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* FMP4 recorder object, owns the write buffers & the I/O backend shared
+     * by every recording, io_uring when built with HAVE_LIBURING & the
+     * kernel grants a ring, pwritev threads otherwise */
+    typedef void * fmp4_recorder_t;
+
+    /* FMP4 recording object, one segmented recording of a stream */
+    typedef void * fmp4_recording_t;
+
+    /* Recorder options, zeroed fields select the defaults */
+    typedef struct fmp4_recorder_options_t
+    {
+        size_t buffer_size; // write size, rounded up to pages, default 1MB
+        size_t buffers;     // buffers shared by all recordings, default 256
+        size_t threads;     // pwritev threads without io_uring, default 4
+
+    } fmp4_recorder_options_t;
+
+    /* Recording counters */
+    typedef struct fmp4_recording_stats_t
+    {
+        uint64_t written;  // bytes written to disk
+        uint64_t dropped;  // boxes dropped because no buffer was free
+        uint32_t segments; // segment files opened
+
+    } fmp4_recording_stats_t;
+
+    /* Recorder public functions, every recording must be closed before the
+     * recorder is destroyed */
+    fmp4_recorder_t fmp4_recorder_create(
+            const fmp4_recorder_options_t *options, error_context_t *errctx);
+    void fmp4_recorder_destroy(fmp4_recorder_t *recorder);
+
+    /* Recording public functions, fmp4_recording_write() has the
+     * fmp4box_function_t signature and takes the recording as userdata, so
+     * it can be passed to fmp4_recv(), fmp4_pool_attach() or
+     * fmp4_engine_add() directly, it copies the box & never waits for I/O.
+     * Segments are named <prefix>-<index>.mp4, each starts at a keyframe
+     * fragment with the init segment & a new one is started at the first
+     * keyframe fragment after segment_duration ms, 0 for a single segment.
+     * Boxes are dropped when every buffer is in use & the recording resumes
+     * with a new segment at the next keyframe fragment, the boxes skipped
+     * until then are counted as dropped too, write errors are
+     * reported by the following fmp4_recording_write() call */
+    fmp4_recording_t fmp4_recording_open(fmp4_recorder_t recorder,
+            const char *prefix, uint32_t segment_duration,
+            error_context_t *errctx);
+    bool fmp4_recording_write(const fmp4_box_t *box, void *recording,
+            error_context_t *errctx);
+    void fmp4_recording_stats(fmp4_recording_t recording,
+            fmp4_recording_stats_t *stats);
+    bool fmp4_recording_close(fmp4_recording_t *recording,
+            error_context_t *errctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   replay.c
+ * Desc:   FMP4 stream from memory-mapped file paced in real time implementation
+ */
+
+#include "common.h"
+#include "error.h"
+#include "file.h"
+#include "transport.h"
+
+static fmp4_transport_context_t fmp4_transport_replay_context(
+        fmp4_arena_t *arena, error_context_t *errctx);
+static bool fmp4_transport_replay_probe(const char *url);
+static bool fmp4_transport_replay_init(fmp4_transport_context_t ctx,
+        const char *url, fmp4_arena_t *arena, error_context_t *errctx);
+static bool fmp4_transport_replay_connect(fmp4_transport_context_t ctx,
+        error_context_t *errctx);
+static bool fmp4_transport_replay_recv(fmp4_transport_context_t ctx,
+        fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+static bool replay_next_fragment(file_context_t *filectx, int64_t *media);
+
+static fmp4_transport_t replay =
+{
+    .name    = "replay",
+    .desc    = "Paced FMP4-from-file",
+    .context = fmp4_transport_replay_context,
+    .probe   = fmp4_transport_replay_probe,
+    .init    = fmp4_transport_replay_init,
+    .connect = fmp4_transport_replay_connect,
+    .recv    = fmp4_transport_replay_recv,
+    .fini    = fmp4_transport_file_fini,
+
+    .stable_boxes = true,
+};
+
+REGISTER_TRANSPORT(replay);
+
+static bool
+fmp4_transport_replay_init(fmp4_transport_context_t  ctx,
+                           const char               *url,
+                           fmp4_arena_t             *arena,
+                           error_context_t          *errctx)
+{
+    file_context_t *filectx = NULL;
+    char           *query   = NULL;
+    char           *param   = NULL;
+    char           *end     = NULL;
+
+    /* Setup file path from URL */
+    if (!fmp4_transport_file_init(ctx, url, arena, errctx))
+        return false;
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+
+    /* Parse pacing parameters, e.g. replay:///rec.mp4?speed=2&loop */
+    query = strchr(filectx->path, '?');
+    if (query)
+        *(query++) = '\0';
+    for (param = query ? strtok_r(query, "&", &end) : NULL; param;
+         param = strtok_r(NULL, "&", &end))
+    {
+        if (!strncmp(param, "speed=", sizeof("speed=") - 1))
+            filectx->speed = strtod(param + sizeof("speed=") - 1, NULL);
+        else if (!strcmp(param, "loop") || !strcmp(param, "loop=1"))
+            filectx->loop = true;
+    }
+    if (!*(filectx->path) || !(filectx->speed > 0))
+    {
+        fmp4_transport_file_fini(ctx);
+        error_save_retval(errctx, EINVAL, false);
+    }
+
+    return true;
+}
+
+static bool
+fmp4_transport_replay_connect(fmp4_transport_context_t  ctx,
+                              error_context_t          *errctx)
+{
+    file_context_t *filectx = (file_context_t *)(ctx);
+
+    /* Map recording */
+    if (!fmp4_transport_file_connect(ctx, errctx))
+        return false;
+
+    /* Restart pacing with the first fragment */
+    memset(&(filectx->init), 0, sizeof(fmp4_init_t));
+    filectx->anchored = false;
+    filectx->first_fragment = SIZE_MAX;
+    filectx->last_due = 0;
+    filectx->last_gap = 0;
+    filectx->last_media = 0;
+
+    return true;
+}
+
+static bool
+fmp4_transport_replay_recv(fmp4_transport_context_t  ctx,
+                           fmp4box_function_t        callback,
+                           void                     *userdata,
+                           error_context_t          *errctx)
+{
+    file_context_t *filectx = NULL;
+    int64_t         media   = 0;
+    int64_t         now     = 0;
+    int64_t         due     = 0;
+
+    /* Sanity checks */
+    if (!ctx || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Cast transport context to internal context */
+    filectx = (file_context_t *)(ctx);
+    error_save_retval_if(!filectx->map, errctx, ENOTCONN, false);
+
+    /* Loop back to the first fragment, continuing the fragment cadence */
+    if (!replay_next_fragment(filectx, &media) && filectx->loop &&
+        filectx->first_fragment != SIZE_MAX)
+    {
+        filectx->offset = filectx->first_fragment;
+        filectx->anchored = false;
+        replay_next_fragment(filectx, &media);
+    }
+
+    /* Boxes without a fragment to pace on go out right away */
+    now = current_monotonic_microseconds();
+    if (media < 0)
+        return fmp4_transport_file_recv(ctx, callback, userdata, errctx);
+
+    /* Anchor media time to the wall clock on the first fragment, after a
+     * loop and after timestamp discontinuities, told apart in media time so
+     * slow speeds stretching the wall-clock gaps do not count */
+    due = filectx->anchor_wall + (int64_t)((double)(media -
+                filectx->anchor_media) / filectx->speed);
+    if (!filectx->anchored || media < filectx->anchor_media ||
+        (media != filectx->anchor_media &&
+         media - filectx->last_media > REPLAY_MAX_GAP_US))
+    {
+        filectx->anchor_wall = filectx->last_due ?
+            MAX(now, filectx->last_due + filectx->last_gap) : now;
+        filectx->anchor_media = media;
+        filectx->anchored = true;
+        due = filectx->anchor_wall;
+    }
+
+    /* Sleep towards the release time in short steps */
+    if (due > now)
+    {
+        usleep((useconds_t)(MIN(due - now, REPLAY_MAX_SLEEP_US)));
+        return true;
+    }
+    if (filectx->last_due)
+        filectx->last_gap = due - filectx->last_due;
+    filectx->last_due = due;
+    filectx->last_media = media;
+
+    /* Release the fragment */
+    return fmp4_transport_file_recv(ctx, callback, userdata, errctx);
+}
+
+static fmp4_transport_context_t
+fmp4_transport_replay_context(fmp4_arena_t    *arena,
+                              error_context_t *errctx)
+{
+    /* Allocate file context from the stream arena, real-time speed unless
+     * told otherwise */
+    file_context_t *filectx = (file_context_t *)(fmp4_arena_alloc(arena,
+                sizeof(file_context_t), errctx));
+    if (!filectx)
+        return NULL;
+    filectx->fd = -1;
+    filectx->speed = 1.0;
+    filectx->first_fragment = SIZE_MAX;
+
+    return (fmp4_transport_context_t)(filectx);
+}
+
+static bool fmp4_transport_replay_probe(const char *url)
+{
+    /* Sanity checks */
+    if (!url)
+        return false;
+
+    /* Check if URL begins with replay protocol scheme */
+    return strncmp(url, "replay://", sizeof("replay://") - 1) == 0;
+}
+
+static bool replay_next_fragment(file_context_t *filectx, int64_t *media)
+{
+    fmp4_box_iter_t     iter     = {};
+    error_context_t     errctx   = {};
+    fmp4_samples_t      samples  = {};
+    const fmp4_track_t *track    = NULL;
+    uint32_t            track_id = 0;
+    uint64_t            dts      = 0;
+
+    /* Look ahead for the next moof, picking up timescales from the moov */
+    *media = -1;
+    fmp4_box_iter_init(&iter, filectx->map + filectx->offset,
+            filectx->size - filectx->offset);
+    while (fmp4_box_iter_next(&iter))
+    {
+        if (ntohl(iter.box->type) == FMP4_FOURCC('m', 'o', 'o', 'v') &&
+            !filectx->init.track_count)
+            fmp4_parse_init(iter.box, &(filectx->init), &errctx);
+        if (ntohl(iter.box->type) == FMP4_FOURCC('m', 'o', 'o', 'f'))
+            break;
+    }
+    if (!iter.box)
+        return !iter.errnum && filectx->offset < filectx->size;
+
+    /* Pace on the decode time of the first sample of the fragment, boxes
+     * ahead of it are released along with it */
+    if (filectx->first_fragment == SIZE_MAX)
+        filectx->first_fragment = (size_t)((const uint8_t *)(iter.box) -
+                filectx->map);
+    samples.track_ids = &track_id;
+    samples.decode_times = &dts;
+    samples.capacity = 1;
+    if (!fmp4_parse_moof(iter.box, &(filectx->init), &samples, &errctx) &&
+        errctx.errnum != ENOBUFS)
+        return true;
+    track = fmp4_init_track(&(filectx->init), track_id);
+    if (!samples.count || !track || !track->timescale)
+        return true;
+    *media = (int64_t)(dts / track->timescale * 1000000 +
+            dts % track->timescale * 1000000 / track->timescale);
+
+    return true;
+}
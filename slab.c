@@ -0,0 +1,164 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   slab.c
+ * Desc:   Process-wide size-classed buffer pool implementation
+ */
+
+#include <pthread.h>
+
+#include "slab.h"
+
+/* Idle buffer of a size class, the link lives in the buffer itself */
+typedef struct slab_free_t
+{
+    struct slab_free_t *next;
+
+} slab_free_t;
+
+static pthread_mutex_t  slab_lock                = PTHREAD_MUTEX_INITIALIZER;
+static slab_free_t     *slab_idle[SLAB_CLASSES]  = {};
+static size_t           slab_idle_bytes          = 0;
+static size_t           slab_used_bytes          = 0;
+static size_t           slab_budget              = 0;
+
+static size_t slab_class(size_t size);
+static void slab_trim(size_t limit);
+
+void *slab_alloc(size_t size, size_t *capacity, error_context_t *errctx)
+{
+    slab_free_t *buffer  = NULL;
+    size_t       class   = 0;
+    size_t       rounded = 0;
+
+    /* Sanity checks */
+    if (!size || !capacity || !errctx)
+        error_save_retval(errctx, EINVAL, NULL);
+
+    /* Round up to the size class, buffers past the largest class are
+     * allocated as they are */
+    class = slab_class(size);
+    rounded = class < SLAB_CLASSES ?
+        (size_t)(1) << (class + SLAB_MIN_SHIFT) : size;
+
+    /* Take an idle buffer of the class, or account for a fresh one */
+    pthread_mutex_lock(&slab_lock);
+    if (class < SLAB_CLASSES && slab_idle[class])
+    {
+        buffer = slab_idle[class];
+        slab_idle[class] = buffer->next;
+        slab_idle_bytes -= rounded;
+    }
+    slab_used_bytes += rounded;
+    if (slab_budget && slab_used_bytes + slab_idle_bytes > slab_budget)
+        slab_trim(slab_budget > slab_used_bytes ?
+                slab_budget - slab_used_bytes : 0);
+    pthread_mutex_unlock(&slab_lock);
+
+    /* Allocate outside the lock, giving the accounting back on failure */
+    if (!buffer)
+        buffer = (slab_free_t *)(malloc(rounded));
+    if (!buffer)
+    {
+        pthread_mutex_lock(&slab_lock);
+        slab_used_bytes -= rounded;
+        pthread_mutex_unlock(&slab_lock);
+        error_save_retval(errctx, ENOMEM, NULL);
+    }
+    *capacity = rounded;
+
+    return buffer;
+}
+
+void slab_free(void *buffer, size_t capacity)
+{
+    slab_free_t *idle  = (slab_free_t *)(buffer);
+    size_t       class = 0;
+    bool         kept  = false;
+
+    /* Sanity checks */
+    if (!buffer)
+        return;
+
+    /* Keep a class buffer for reuse while within the idle & budget bounds */
+    class = slab_class(capacity);
+    pthread_mutex_lock(&slab_lock);
+    slab_used_bytes -= capacity;
+    if (class < SLAB_CLASSES && slab_idle_bytes + capacity <= SLAB_IDLE_MAX &&
+            (!slab_budget || slab_used_bytes + slab_idle_bytes + capacity <=
+             slab_budget))
+    {
+        idle->next = slab_idle[class];
+        slab_idle[class] = idle;
+        slab_idle_bytes += capacity;
+        kept = true;
+    }
+    pthread_mutex_unlock(&slab_lock);
+
+    if (!kept)
+        free(buffer);
+}
+
+void slab_set_budget(size_t budget)
+{
+    pthread_mutex_lock(&slab_lock);
+    slab_budget = budget;
+    if (slab_budget)
+        slab_trim(slab_budget > slab_used_bytes ?
+                slab_budget - slab_used_bytes : 0);
+    pthread_mutex_unlock(&slab_lock);
+}
+
+bool slab_over_budget(void)
+{
+    bool over = false;
+
+    pthread_mutex_lock(&slab_lock);
+    over = slab_budget && slab_used_bytes > slab_budget;
+    pthread_mutex_unlock(&slab_lock);
+
+    return over;
+}
+
+size_t slab_used(void)
+{
+    size_t used = 0;
+
+    pthread_mutex_lock(&slab_lock);
+    used = slab_used_bytes;
+    pthread_mutex_unlock(&slab_lock);
+
+    return used;
+}
+
+static size_t slab_class(size_t size)
+{
+    size_t shift = SLAB_MIN_SHIFT;
+
+    /* Smallest class holding size, SLAB_CLASSES if none does */
+    if (size > ((size_t)(1) << SLAB_MAX_SHIFT))
+        return SLAB_CLASSES;
+    while (((size_t)(1) << shift) < size)
+        shift++;
+
+    return shift - SLAB_MIN_SHIFT;
+}
+
+static void slab_trim(size_t limit)
+{
+    slab_free_t *buffer = NULL;
+    size_t       class  = SLAB_CLASSES;
+
+    /* Free idle buffers, largest classes first, until within the limit,
+     * called with the lock held */
+    while (slab_idle_bytes > limit && class-- > 0)
+    {
+        while (slab_idle_bytes > limit && slab_idle[class])
+        {
+            buffer = slab_idle[class];
+            slab_idle[class] = buffer->next;
+            slab_idle_bytes -= (size_t)(1) << (class + SLAB_MIN_SHIFT);
+            free(buffer);
+        }
+    }
+}
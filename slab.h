@@ -0,0 +1,38 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   slab.h
+ * Desc:   Process-wide size-classed buffer pool interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Power of two size classes from 4 KB to 4 MB */
+    #define SLAB_MIN_SHIFT 12
+    #define SLAB_MAX_SHIFT 22
+    #define SLAB_CLASSES   (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+    #define SLAB_IDLE_MAX  (64 * 1024 * 1024)
+
+    /* Slab pool public functions */
+    void *slab_alloc(size_t size, size_t *capacity, error_context_t *errctx);
+    void slab_free(void *buffer, size_t capacity);
+
+    /* Soft budget of the bytes in use & kept idle, 0 for no limit */
+    void slab_set_budget(size_t budget);
+    bool slab_over_budget(void);
+    size_t slab_used(void);
+
+#ifdef __cplusplus
+}
+#endif
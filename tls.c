@@ -0,0 +1,267 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   tls.c
+ * Desc:   Shared client TLS context & session cache implementation
+ */
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/x509.h>
+
+#include "tls.h"
+
+#define TLS_MAX_KEY_LENGTH (NI_MAXHOST + 8)
+
+/* Cached client session of a server, keyed by "name:port" */
+typedef struct tls_session_t
+{
+    char                 *key;
+    SSL_SESSION          *session;
+    struct tls_session_t *next;
+
+} tls_session_t;
+
+static pthread_once_t   tls_once          = PTHREAD_ONCE_INIT;
+static SSL_CTX         *tls_shared        = NULL;
+static pthread_mutex_t  tls_lock          = PTHREAD_MUTEX_INITIALIZER;
+static tls_session_t   *tls_sessions      = NULL;
+static size_t           tls_session_count = 0;
+
+static void tls_context_create(void);
+static bool tls_session_key(SSL *ssl, char *key, size_t size);
+static int tls_session_new(SSL *ssl, SSL_SESSION *session);
+static void tls_info(const SSL *ssl, int where, int ret);
+static int tls_verify(int preverify, X509_STORE_CTX *store);
+static void tls_set_timeout(int fd, int timeout);
+
+SSL_CTX *tls_context(error_context_t *errctx)
+{
+    /* Create the shared context once for the whole process */
+    pthread_once(&tls_once, tls_context_create);
+    error_save_retval_if(!tls_shared, errctx, ENOMEM, NULL);
+
+    return tls_shared;
+}
+
+bool
+tls_prewarm(const char      *host,
+            uint32_t         port,
+            error_context_t *errctx)
+{
+    struct addrinfo  hints   = {};
+    struct addrinfo *addrs   = NULL;
+    struct addrinfo *addr    = NULL;
+    SSL_CTX         *context = NULL;
+    SSL             *ssl     = NULL;
+    char             service[8];
+    uint8_t          byte    = 0;
+    int              fd      = -1;
+    bool             result  = false;
+
+    /* Sanity checks */
+    if (!host || !port || port > UINT16_MAX || !errctx)
+        error_save_jump(errctx, EINVAL, CLEANUP);
+    context = tls_context(errctx);
+    if (!context)
+        goto CLEANUP;
+
+    /* Resolve & connect to the first reachable address */
+    snprintf(service, sizeof(service), "%u", port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error_save_jump_if(getaddrinfo(host, service, &hints, &addrs), errctx,
+            EHOSTUNREACH, CLEANUP);
+    for (addr = addrs; addr; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        tls_set_timeout(fd, TLS_PREWARM_TIMEOUT);
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    error_save_jump_if(fd < 0, errctx, ECONNREFUSED, CLEANUP);
+
+    /* Handshake, the new session lands in the cache */
+    ssl = SSL_new(context);
+    error_save_jump_if(!ssl, errctx, ENOMEM, CLEANUP);
+    SSL_set_verify(ssl, SSL_VERIFY_PEER, tls_verify);
+    error_save_jump_if(!SSL_set_fd(ssl, fd) ||
+            !SSL_set_tlsext_host_name(ssl, host), errctx, ENOMEM, CLEANUP);
+    error_save_jump_if(SSL_connect(ssl) != 1, errctx, EPROTO, CLEANUP);
+
+    /* TLS 1.3 servers send session tickets after the handshake, the read
+     * processes them & then times out, websocket servers say nothing first */
+    if (SSL_version(ssl) >= TLS1_3_VERSION)
+    {
+        tls_set_timeout(fd, TLS_TICKET_WAIT);
+        SSL_read(ssl, &byte, sizeof(byte));
+    }
+    SSL_shutdown(ssl);
+
+    result = true;
+
+CLEANUP:
+
+    if (ssl)
+        SSL_free(ssl);
+    if (fd >= 0)
+        close(fd);
+    if (addrs)
+        freeaddrinfo(addrs);
+
+    return result;
+}
+
+static void tls_context_create(void)
+{
+    /* Client context, sessions are kept by tls_session_new() only */
+    tls_shared = SSL_CTX_new(TLS_client_method());
+    if (!tls_shared)
+        return;
+    SSL_CTX_set_default_verify_paths(tls_shared);
+    SSL_CTX_set_session_cache_mode(tls_shared,
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls_shared, tls_session_new);
+    SSL_CTX_set_info_callback(tls_shared, tls_info);
+}
+
+static bool tls_session_key(SSL *ssl, char *key, size_t size)
+{
+    struct sockaddr_storage  peer      = {};
+    socklen_t                length    = sizeof(peer);
+    const char              *name      = NULL;
+    char                     host[NI_MAXHOST];
+    char                     service[NI_MAXSERV];
+    int                      ret       = 0;
+
+    /* Port from the peer address, name from the SNI or else the address */
+    if (getpeername(SSL_get_fd(ssl), (struct sockaddr *)(&peer), &length))
+        return false;
+    if (getnameinfo((struct sockaddr *)(&peer), length, host, sizeof(host),
+                service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV))
+        return false;
+    name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    ret = snprintf(key, size, "%s:%s", name ? name : host, service);
+
+    return ret > 0 && (size_t)(ret) < size;
+}
+
+static int tls_session_new(SSL *ssl, SSL_SESSION *session)
+{
+    tls_session_t  *entry = NULL;
+    tls_session_t **link  = NULL;
+    tls_session_t  *evict = NULL;
+    char            key[TLS_MAX_KEY_LENGTH];
+
+    /* Sessions of unknown servers are left to OpenSSL to free */
+    if (!tls_session_key(ssl, key, sizeof(key)))
+        return 0;
+
+    pthread_mutex_lock(&tls_lock);
+
+    /* Replace the session of a known server, or insert at the head */
+    for (entry = tls_sessions; entry; entry = entry->next)
+        if (!strcmp(entry->key, key))
+            break;
+    if (!entry)
+    {
+        entry = (tls_session_t *)(calloc(1, sizeof(tls_session_t)));
+        if (entry)
+            entry->key = strdup(key);
+        if (!entry || !entry->key)
+        {
+            FREE_AND_NULLIFY(entry);
+            pthread_mutex_unlock(&tls_lock);
+            return 0;
+        }
+        entry->next = tls_sessions;
+        tls_sessions = entry;
+        tls_session_count++;
+    }
+    else if (entry->session)
+        SSL_SESSION_free(entry->session);
+    entry->session = session;
+
+    /* Bound the cache by evicting the oldest server */
+    if (tls_session_count > TLS_SESSION_CACHE_MAX)
+    {
+        for (link = &tls_sessions; (*link)->next; link = &((*link)->next));
+        evict = *link;
+        *link = NULL;
+        tls_session_count--;
+    }
+
+    pthread_mutex_unlock(&tls_lock);
+
+    if (evict)
+    {
+        SSL_SESSION_free(evict->session);
+        FREE_AND_NULLIFY(evict->key);
+        FREE_AND_NULLIFY(evict);
+    }
+
+    /* The reference now belongs to the cache */
+    return 1;
+}
+
+static void tls_info(const SSL *ssl, int where, int ret)
+{
+    const tls_session_t *entry   = NULL;
+    SSL                 *client  = (SSL *)(ssl);
+    long                 expires = 0;
+    char                 key[TLS_MAX_KEY_LENGTH];
+
+    /* Offer the cached session before a client hello is composed */
+    if (!(where & SSL_CB_HANDSHAKE_START) || SSL_is_server(client) ||
+            SSL_get_session(client))
+        return;
+    if (!tls_session_key(client, key, sizeof(key)))
+        return;
+
+    pthread_mutex_lock(&tls_lock);
+    for (entry = tls_sessions; entry; entry = entry->next)
+    {
+        if (strcmp(entry->key, key))
+            continue;
+        expires = SSL_SESSION_get_time(entry->session) +
+            SSL_SESSION_get_timeout(entry->session);
+        if (SSL_SESSION_is_resumable(entry->session) && expires > time(NULL))
+            SSL_set_session(client, entry->session);
+        break;
+    }
+    pthread_mutex_unlock(&tls_lock);
+}
+
+static int tls_verify(int preverify, X509_STORE_CTX *store)
+{
+    /* Accept what the wss:// transports allow, self-signed & expired */
+    switch (X509_STORE_CTX_get_error(store))
+    {
+        case X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT:
+        case X509_V_ERR_SELF_SIGNED_CERT_IN_CHAIN:
+        case X509_V_ERR_CERT_HAS_EXPIRED:
+        case X509_V_ERR_CERT_NOT_YET_VALID:
+            return 1;
+        default: break;
+    }
+
+    return preverify;
+}
+
+static void tls_set_timeout(int fd, int timeout)
+{
+    struct timeval tv = {};
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
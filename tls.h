@@ -0,0 +1,42 @@
+/*
+ * Author: Mave Rick
+ * Date:   2026/10/16
+ * File:   tls.h
+ * Desc:   Shared client TLS context & session cache interface header
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <openssl/ssl.h>
+
+#include "common.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    #define TLS_SESSION_CACHE_MAX 4096
+    #define TLS_PREWARM_TIMEOUT   5000 // ms, connect & handshake
+    #define TLS_TICKET_WAIT       200  // ms, for TLS 1.3 session tickets
+
+    /* Process-wide client SSL_CTX shared by every wss:// stream, created
+     * on first use with the system CA paths. Client sessions are cached by
+     * server name & port, taken from the SNI & the peer address, and
+     * offered again at the start of every handshake of the same server,
+     * from any lws context using it as provided_client_ssl_ctx */
+    SSL_CTX *tls_context(error_context_t *errctx);
+
+    /* Handshake with host:port ahead of the streams to fill the session
+     * cache, blocking for up to TLS_PREWARM_TIMEOUT ms. Certificates are
+     * checked like the wss:// transports do, self-signed & expired ones
+     * are accepted, the host name is not checked */
+    bool tls_prewarm(const char *host, uint32_t port, error_context_t *errctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -8,10 +8,12 @@
 #pragma once
 
 #include <assert.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "common.h"
 #include "error.h"
 #include "fmp4.h"
@@ -34,22 +36,75 @@ extern "C"
             assert(transport.connect != NULL); \
             assert(transport.recv != NULL); \
             assert(transport.fini != NULL); \
+            assert(transport.attach == NULL || (transport.detach != NULL && \
+                   transport.loop_create != NULL && \
+                   transport.loop_service != NULL && \
+                   transport.loop_destroy != NULL)); \
+            assert(transport.pollfds == NULL || \
+                   (transport.next_timeout != NULL && \
+                   transport.service_fd != NULL)); \
+            assert(transport.connect_start == NULL || \
+                   (transport.connect_service != NULL && \
+                   transport.pollfds != NULL)); \
             transport_registry[transport_count++] = &transport; \
         }
 
     /* Transport-specific implementation function pointers types */
     typedef void * fmp4_transport_context_t;
     typedef fmp4_transport_context_t (*fmp4_transport_context_function_t)(
-            error_context_t *errctx); // context needs be freed
+            fmp4_arena_t *arena, error_context_t *errctx); // from arena
     typedef bool (*fmp4_transport_probe_function_t)(const char *url);
     typedef bool (*fmp4_transport_init_function_t)(fmp4_transport_context_t ctx,
-            const char *url, error_context_t *errctx);
+            const char *url, fmp4_arena_t *arena, error_context_t *errctx);
     typedef bool (*fmp4_transport_connect_function_t)(fmp4_transport_context_t ctx,
             error_context_t *errctx);
     typedef bool (*fmp4_transport_recv_function_t)(fmp4_transport_context_t ctx,
             fmp4box_function_t callback, void *userdata, error_context_t *errctx);
     typedef void (*fmp4_transport_fini_function_t)(fmp4_transport_context_t ctx);
 
+    /* Optional shared event loop function pointers types */
+    typedef void * fmp4_transport_loop_t;
+    typedef fmp4_transport_loop_t (*fmp4_transport_loop_create_function_t)(
+            error_context_t *errctx);
+    typedef bool (*fmp4_transport_loop_service_function_t)(
+            fmp4_transport_loop_t loop, int timeout, error_context_t *errctx);
+    typedef void (*fmp4_transport_loop_destroy_function_t)(
+            fmp4_transport_loop_t loop);
+    typedef bool (*fmp4_transport_attach_function_t)(fmp4_transport_context_t ctx,
+            fmp4_transport_loop_t loop, fmp4box_function_t callback,
+            void *userdata, error_context_t *errctx);
+    typedef void (*fmp4_transport_detach_function_t)(fmp4_transport_context_t ctx);
+
+    /* Optional external event loop function pointers types */
+    typedef bool (*fmp4_transport_pollfds_function_t)(
+            fmp4_transport_context_t ctx, struct pollfd *pollfds,
+            size_t *count, error_context_t *errctx);
+    typedef int (*fmp4_transport_next_timeout_function_t)(
+            fmp4_transport_context_t ctx, int timeout);
+    typedef bool (*fmp4_transport_service_fd_function_t)(
+            fmp4_transport_context_t ctx, struct pollfd *pollfd,
+            fmp4box_function_t callback, void *userdata, error_context_t *errctx);
+
+    /* Optional non-blocking connect function pointers types */
+    typedef bool (*fmp4_transport_connect_start_function_t)(
+            fmp4_transport_context_t ctx, error_context_t *errctx);
+    typedef bool (*fmp4_transport_connect_service_function_t)(
+            fmp4_transport_context_t ctx, struct pollfd *pollfd,
+            error_context_t *errctx);
+
+    /* Optional stream option function pointer type */
+    typedef bool (*fmp4_transport_option_function_t)(
+            fmp4_transport_context_t ctx, fmp4_option_t option, int64_t *value,
+            bool set, error_context_t *errctx);
+
+    /* Optional receive flow control function pointer type */
+    typedef bool (*fmp4_transport_flow_function_t)(
+            fmp4_transport_context_t ctx, bool receive, error_context_t *errctx);
+
+    /* Optional connection prewarm function pointer type */
+    typedef bool (*fmp4_transport_prewarm_function_t)(const char *url,
+            error_context_t *errctx);
+
     /* Transport context definition */
     typedef struct fmp4_transport_t
     {
@@ -62,6 +117,34 @@ extern "C"
         const fmp4_transport_recv_function_t     recv;
         const fmp4_transport_fini_function_t     fini;
 
+        /* Boxes handed to callbacks stay valid until the next receive */
+        const bool stable_boxes;
+
+        /* Optional, transports sharing loop functions can share a loop */
+        const fmp4_transport_loop_create_function_t   loop_create;
+        const fmp4_transport_loop_service_function_t  loop_service;
+        const fmp4_transport_loop_destroy_function_t  loop_destroy;
+        const fmp4_transport_attach_function_t        attach;
+        const fmp4_transport_detach_function_t        detach;
+
+        /* Optional, transports with sockets can be driven by the user */
+        const fmp4_transport_pollfds_function_t       pollfds;
+        const fmp4_transport_next_timeout_function_t  next_timeout;
+        const fmp4_transport_service_fd_function_t    service_fd;
+
+        /* Optional, transports connecting in the background */
+        const fmp4_transport_connect_start_function_t   connect_start;
+        const fmp4_transport_connect_service_function_t connect_service;
+
+        /* Optional, transports with tunables handle fmp4_set_option() */
+        const fmp4_transport_option_function_t        option;
+
+        /* Optional, transports able to push back on a slow consumer */
+        const fmp4_transport_flow_function_t          flow;
+
+        /* Optional, transports with connection setup to warm up ahead */
+        const fmp4_transport_prewarm_function_t       prewarm;
+
     } fmp4_transport_t;
 
     /* Global transport registry and registered transport count */
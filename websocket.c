@@ -12,17 +12,31 @@
 #include <libwebsockets.h>
 
 #include "common.h"
+#include "dns.h"
 #include "error.h"
+#include "slab.h"
+#include "tls.h"
 #include "transport.h"
 #include "websocket.h"
 
 static fmp4_transport_context_t fmp4_transport_websocket_context(
-        error_context_t *errctx);
+        fmp4_arena_t *arena, error_context_t *errctx);
 static bool fmp4_transport_websocket_probe(const char *url);
 static int websocket_event_handler(struct lws *wsi,
         enum lws_callback_reasons reason, void *data, void *in, size_t length);
-static bool websocket_traverse_frame(const context_t *wsctx,
+static int websocket_loop_handler(struct lws *wsi,
+        enum lws_callback_reasons reason, void *data, void *in, size_t length);
+static bool websocket_traverse_frame(context_t *wsctx, struct lws *wsi,
         const uint8_t *frame, size_t length, error_context_t *errctx);
+static bool websocket_client_connect(context_t *wsctx,
+        error_context_t *errctx);
+static void websocket_resolve_retry(lws_sorted_usec_list_t *sul);
+static void websocket_resolve_poll(context_t *wsctx);
+static void websocket_select_rx_class(context_t *wsctx);
+static void websocket_throttle_retry(lws_sorted_usec_list_t *sul);
+static void websocket_close(context_t *wsctx);
+static size_t websocket_socket_pollfd(context_t *wsctx,
+        struct pollfd *pollfd);
 
 static fmp4_transport_t websocket =
 {
@@ -34,6 +48,27 @@ static fmp4_transport_t websocket =
     .connect = fmp4_transport_websocket_connect,
     .recv    = fmp4_transport_websocket_recv,
     .fini    = fmp4_transport_websocket_fini,
+
+    .loop_create  = fmp4_transport_websocket_loop_create,
+    .loop_service = fmp4_transport_websocket_loop_service,
+    .loop_destroy = fmp4_transport_websocket_loop_destroy,
+    .attach       = fmp4_transport_websocket_attach,
+    .detach       = fmp4_transport_websocket_detach,
+
+    .pollfds      = fmp4_transport_websocket_pollfds,
+    .next_timeout = fmp4_transport_websocket_next_timeout,
+    .service_fd   = fmp4_transport_websocket_service_fd,
+
+    /* Handshakes need the exact poll events only lws' poll fd callbacks
+     * tell, without them fmp4_connect_many() connects on threads */
+#ifdef LWS_WITH_EXTERNAL_POLL
+    .connect_start   = fmp4_transport_websocket_connect_start,
+    .connect_service = fmp4_transport_websocket_connect_service,
+#endif
+
+    .option       = fmp4_transport_websocket_option,
+    .flow         = fmp4_transport_websocket_flow,
+    .prewarm      = fmp4_transport_websocket_prewarm,
 };
 
 REGISTER_TRANSPORT(websocket);
@@ -41,29 +76,28 @@ REGISTER_TRANSPORT(websocket);
 bool
 fmp4_transport_websocket_init(fmp4_transport_context_t  ctx,
                              const char              *url,
+                             fmp4_arena_t            *arena,
                              error_context_t         *errctx)
 {
     context_t *wsctx   = NULL;
-    size_t     url_len = 0;
     bool       use_ssl = false;
     bool       result  = false;
     int        ret     = 0;
 
     /* Sanity checks */
-    if (!ctx || !url || !errctx)
+    if (!ctx || !url || !arena || !errctx)
         error_save_jump(errctx, EINVAL, CLEANUP);
 
     /* Cast transport context to internal context */
     wsctx = (context_t *)(ctx);
 
-    /* Allocate buffer and copy URL string */
-    url_len = strnlen(url, MAX_STR_LEN);
-    wsctx->url = (char *)(calloc(url_len + 1, 1));
-    error_save_jump_if(!wsctx->url, errctx, errno, CLEANUP);
-    memcpy(wsctx->url, url, url_len);
+    /* Copy URL string into the stream arena */
+    wsctx->url = fmp4_arena_strndup(arena, url, MAX_STR_LEN, errctx);
+    if (!wsctx->url)
+        goto CLEANUP;
 
     /* Parse URL components */
-    websocket_parse_url(wsctx->url, &(wsctx->hostname),
+    websocket_parse_url(wsctx->url, arena, &(wsctx->hostname),
             &(wsctx->port), &(wsctx->path));
     if (!wsctx->hostname || !wsctx->port || !wsctx->path)
         error_save_jump(errctx, ENOMEM, CLEANUP);
@@ -72,18 +106,21 @@ fmp4_transport_websocket_init(fmp4_transport_context_t  ctx,
     ret = strncmp(wsctx->url, "wss://", sizeof("wss://") - 1);
     use_ssl = (ret == 0);
 
-    /* Setup WebSocket context info */
+    /* Setup WebSocket context info, TLS state is the process-wide shared
+     * context, lws' global init only runs OpenSSL's run-once init */
     if (use_ssl)
+    {
         (wsctx->ctx_info).options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+        (wsctx->ctx_info).provided_client_ssl_ctx = tls_context(errctx);
+        if (!(wsctx->ctx_info).provided_client_ssl_ctx)
+            goto CLEANUP;
+    }
     (wsctx->ctx_info).port = CONTEXT_PORT_NO_LISTEN;
     (wsctx->ctx_info).protocols = wsctx->protocols;
+    (wsctx->ctx_info).user = wsctx;
 
-    /* Setup WebSocket context */
-    wsctx->lwsctx = lws_create_context(&(wsctx->ctx_info));
-    error_save_jump_if(!wsctx->lwsctx, errctx, ENOMEM, CLEANUP);
-
-    /* Setup WebSocket client connection info */
-    (wsctx->conn_info).context = wsctx->lwsctx;
+    /* Setup WebSocket client connection info, the event loop context is
+     * bound on connect or attach, events are dispatched by wsi user data */
     (wsctx->conn_info).port = wsctx->port;
     (wsctx->conn_info).address = wsctx->hostname;
     (wsctx->conn_info).path = wsctx->path;
@@ -91,6 +128,7 @@ fmp4_transport_websocket_init(fmp4_transport_context_t  ctx,
     (wsctx->conn_info).origin = wsctx->hostname;
     (wsctx->conn_info).protocol = (wsctx->protocols)[0].name;
     (wsctx->conn_info).pwsi = &(wsctx->wsi);
+    (wsctx->conn_info).userdata = wsctx;
     if (use_ssl) {
         (wsctx->conn_info).ssl_connection = LCCSCF_USE_SSL;
         (wsctx->conn_info).ssl_connection |= LCCSCF_ALLOW_EXPIRED;
@@ -103,14 +141,8 @@ fmp4_transport_websocket_init(fmp4_transport_context_t  ctx,
 
 CLEANUP:
 
-    if (!result)
-    {
-        FREE_AND_NULLIFY(wsctx->path);
-        FREE_AND_NULLIFY(wsctx->hostname);
-        FREE_AND_NULLIFY(wsctx->url);
-        lws_context_destroy(wsctx->lwsctx);
-        wsctx->lwsctx = NULL;
-    }
+    if (!result && wsctx)
+        wsctx->url = wsctx->hostname = wsctx->path = NULL;
 
     return result;
 }
@@ -119,9 +151,26 @@ bool
 fmp4_transport_websocket_connect(fmp4_transport_context_t  ctx,
                                 error_context_t         *errctx)
 {
-    context_t *wsctx = NULL;
+    context_t *wsctx = (context_t *)(ctx);
     int        ret   = 0;
 
+    /* Start connecting, then execute event loop until connected */
+    if (!fmp4_transport_websocket_connect_start(ctx, errctx))
+        return false;
+    while (ret >= 0 && (wsctx->wsi || wsctx->resolving) && !wsctx->connected &&
+            !wsctx->error)
+        ret = lws_service(wsctx->lwsctx, 10);
+    error_save_retval_if(ret < 0 || !wsctx->connected, errctx, ENOTCONN, false);
+
+    return true;
+}
+
+bool
+fmp4_transport_websocket_connect_start(fmp4_transport_context_t  ctx,
+                                       error_context_t         *errctx)
+{
+    context_t *wsctx = NULL;
+
     /* Sanity checks */
     if (!ctx || !errctx)
         error_save_retval(errctx, EINVAL, false);
@@ -130,15 +179,55 @@ fmp4_transport_websocket_connect(fmp4_transport_context_t  ctx,
     wsctx = (context_t *)(ctx);
     error_save_retval_if(!wsctx->url, errctx, EINVAL, false);
 
-    /* Connect WebSocket connection, client is stored in pwsi */
-    if (!lws_client_connect_via_info(&(wsctx->conn_info)))
-        error_save_retval(errctx, ENOTCONN, false);
+    /* Pooled streams are connected on attach and serviced by the pool */
+    error_save_retval_if(wsctx->pooled, errctx, EINVAL, false);
 
-    /* Execute event loop until WebSocket state is connected */
+    /* Setup private WebSocket context on first connect */
+    if (!wsctx->lwsctx)
+    {
+        wsctx->lwsctx = lws_create_context(&(wsctx->ctx_info));
+        error_save_retval_if(!wsctx->lwsctx, errctx, ENOMEM, false);
+    }
+    (wsctx->conn_info).context = wsctx->lwsctx;
+
+    /* Reconnecting reuses the event loop & its TLS state, a connection
+     * still lingering is closed & the previous error forgotten */
+    websocket_close(wsctx);
+    wsctx->error = false;
+
+    /* Discard partial boxes staged from any previous connection */
+    fmp4_assembler_reset(&(wsctx->assembler));
+    websocket_select_rx_class(wsctx);
+
+    /* Connect WebSocket connection, the handshake completes in service */
     wsctx->errctx = errctx;
-    while (ret >= 0 && wsctx->wsi && !wsctx->connected && !wsctx->error)
-        ret = lws_service(wsctx->lwsctx, 10);
-    error_save_retval_if(ret < 0, errctx, ENOTCONN, false);
+    return websocket_client_connect(wsctx, errctx);
+}
+
+bool
+fmp4_transport_websocket_connect_service(fmp4_transport_context_t  ctx,
+                                         struct pollfd            *pollfd,
+                                         error_context_t          *errctx)
+{
+    context_t *wsctx = (context_t *)(ctx);
+    int        ret   = 0;
+
+    /* Sanity checks */
+    if (!wsctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->lwsctx || wsctx->pooled, errctx, EINVAL,
+            false);
+
+    /* Start the connection once its host lookup is done, then service the
+     * ready socket, or timeouts & forced service without one */
+    wsctx->errctx = errctx;
+    websocket_resolve_poll(wsctx);
+    ret = lws_service_fd(wsctx->lwsctx, pollfd);
+    if (ret >= 0 && !pollfd && !lws_service_adjust_timeout(wsctx->lwsctx, 1, 0))
+        ret = lws_service_tsi(wsctx->lwsctx, -1, 0);
+    error_save_retval_if(ret < 0 || wsctx->error ||
+            (!wsctx->wsi && !wsctx->resolving), errctx, ENOTCONN, false);
+    error_save_retval_if(!wsctx->connected, errctx, EINPROGRESS, false);
 
     return true;
 }
@@ -158,7 +247,7 @@ fmp4_transport_websocket_recv(fmp4_transport_context_t  ctx,
 
     /* Cast transport context to internal context */
     wsctx = (context_t *)(ctx);
-    error_save_retval_if(!wsctx->url, errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->url || wsctx->pooled, errctx, EINVAL, false);
 
     /* Prepare WebSocket context for WebSocket callback invocation */
     wsctx->callback = callback;
@@ -181,25 +270,434 @@ void fmp4_transport_websocket_fini(fmp4_transport_context_t ctx)
     if (!wsctx)
         return;
 
+    /* Close connection on a shared loop, or tear down the private one */
+    if (wsctx->pooled)
+        fmp4_transport_websocket_detach(ctx);
+    else
+    {
+        websocket_close(wsctx);
+        lws_context_destroy(wsctx->lwsctx);
+    }
+    wsctx->lwsctx = NULL;
+
+    /* Free allocated resources */
+    fmp4_assembler_fini(&(wsctx->assembler));
+    FREE_AND_NULLIFY(wsctx->pollfds);
+    wsctx->pollfd_count = wsctx->pollfd_capacity = 0;
+
+    /* URL strings go with the stream arena */
+    wsctx->url = wsctx->hostname = wsctx->path = NULL;
+}
+
+fmp4_transport_loop_t
+fmp4_transport_websocket_loop_create(error_context_t *errctx)
+{
+    websocket_loop_t *loopctx = NULL;
+
+    /* Allocate shared WebSocket event loop */
+    loopctx = (websocket_loop_t *)(calloc(1, sizeof(websocket_loop_t)));
+    error_save_retval_if(!loopctx, errctx, errno, NULL);
+
+    /* Setup dispatching protocol, stream contexts are the wsi user data */
+    websocket_setup_protocols(loopctx->protocols, websocket_loop_handler,
+            loopctx);
+
+    /* Setup shared WebSocket context, which may carry ws:// & wss:// */
+    (loopctx->ctx_info).options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+    (loopctx->ctx_info).provided_client_ssl_ctx = tls_context(errctx);
+    if (!(loopctx->ctx_info).provided_client_ssl_ctx)
+    {
+        FREE_AND_NULLIFY(loopctx);
+        return NULL;
+    }
+    (loopctx->ctx_info).port = CONTEXT_PORT_NO_LISTEN;
+    (loopctx->ctx_info).protocols = loopctx->protocols;
+    loopctx->lwsctx = lws_create_context(&(loopctx->ctx_info));
+    if (!loopctx->lwsctx)
+    {
+        FREE_AND_NULLIFY(loopctx);
+        error_save_retval(errctx, ENOMEM, NULL);
+    }
+
+    return (fmp4_transport_loop_t)(loopctx);
+}
+
+bool
+fmp4_transport_websocket_loop_service(fmp4_transport_loop_t  loop,
+                                      int                    timeout,
+                                      error_context_t       *errctx)
+{
+    websocket_loop_t *loopctx = (websocket_loop_t *)(loop);
+    int               ret     = 0;
+
+    /* Sanity checks */
+    if (!loopctx || !loopctx->lwsctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Execute one iteration of the shared WebSocket event loop */
+    ret = lws_service(loopctx->lwsctx, timeout);
+    error_save_retval_if(ret < 0, errctx, EIO, false);
+
+    return true;
+}
+
+void fmp4_transport_websocket_loop_destroy(fmp4_transport_loop_t loop)
+{
+    websocket_loop_t *loopctx = (websocket_loop_t *)(loop);
+
+    /* Sanity checks */
+    if (!loopctx)
+        return;
+
     /* Free allocated resources */
-    FREE_AND_NULLIFY(wsctx->path);
-    FREE_AND_NULLIFY(wsctx->hostname);
-    FREE_AND_NULLIFY(wsctx->url);
+    lws_context_destroy(loopctx->lwsctx);
+    loopctx->lwsctx = NULL;
+    FREE_AND_NULLIFY(loopctx);
+}
+
+bool
+fmp4_transport_websocket_attach(fmp4_transport_context_t  ctx,
+                                fmp4_transport_loop_t     loop,
+                                fmp4box_function_t        callback,
+                                void                     *userdata,
+                                error_context_t          *errctx)
+{
+    websocket_loop_t *loopctx = (websocket_loop_t *)(loop);
+    context_t        *wsctx   = (context_t *)(ctx);
+
+    /* Sanity checks */
+    if (!wsctx || !loopctx || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->url || wsctx->pooled, errctx, EINVAL, false);
+    error_save_retval_if(wsctx->connected, errctx, EISCONN, false);
+
+    /* Drop the private event loop in favour of the shared one */
+    websocket_close(wsctx);
     lws_context_destroy(wsctx->lwsctx);
+    wsctx->lwsctx = loopctx->lwsctx;
+    wsctx->wsi = NULL;
+    wsctx->pooled = true;
+    wsctx->error = false;
+
+    /* Prepare WebSocket context for WebSocket callback invocation */
+    wsctx->callback = callback;
+    wsctx->userdata = userdata;
+    wsctx->errctx = errctx;
+    fmp4_assembler_reset(&(wsctx->assembler));
+    websocket_select_rx_class(wsctx);
+
+    /* Start connecting, the shared loop completes the handshake */
+    (wsctx->conn_info).context = wsctx->lwsctx;
+    if (!websocket_client_connect(wsctx, errctx))
+    {
+        wsctx->lwsctx = NULL;
+        wsctx->pooled = false;
+        return false;
+    }
+
+    return true;
+}
+
+void fmp4_transport_websocket_detach(fmp4_transport_context_t ctx)
+{
+    context_t *wsctx = (context_t *)(ctx);
+
+    /* Sanity checks */
+    if (!wsctx || !wsctx->pooled)
+        return;
+
+    /* Close connection, the shared loop itself stays up */
+    websocket_close(wsctx);
     wsctx->lwsctx = NULL;
+    wsctx->pooled = false;
+}
+
+bool
+fmp4_transport_websocket_pollfds(fmp4_transport_context_t  ctx,
+                                 struct pollfd            *pollfds,
+                                 size_t                   *count,
+                                 error_context_t          *errctx)
+{
+    context_t     *wsctx  = (context_t *)(ctx);
+    struct pollfd  own    = {};
+    struct pollfd *source = NULL;
+    size_t         needed = 0;
+
+    /* Sanity checks */
+    if (!wsctx || !count || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->lwsctx || wsctx->pooled, errctx, EINVAL,
+            false);
+
+    /* Sockets tracked from lws' poll fd callbacks, or the connection's own
+     * socket when lws was built without LWS_WITH_EXTERNAL_POLL */
+    source = wsctx->pollfd_count ? wsctx->pollfds : &own;
+    needed = wsctx->pollfd_count ? wsctx->pollfd_count :
+        websocket_socket_pollfd(wsctx, &own);
+
+    /* Copy out the sockets, telling the count needed if short */
+    if (needed > *count)
+    {
+        *count = needed;
+        error_save_retval(errctx, ENOBUFS, false);
+    }
+    if (needed)
+        memcpy(pollfds, source, needed * sizeof(struct pollfd));
+    *count = needed;
+
+    return true;
+}
+
+int
+fmp4_transport_websocket_next_timeout(fmp4_transport_context_t ctx,
+                                      int                      timeout)
+{
+    context_t *wsctx = (context_t *)(ctx);
+
+    /* Sanity checks */
+    if (!wsctx || !wsctx->lwsctx || wsctx->pooled)
+        return timeout;
+
+    /* Pending connection timeouts are checked at a coarse granularity,
+     * buffered data such as decrypted TLS records need service now */
+    if (timeout < 0 || timeout > WEBSOCKET_MAX_POLL_TIMEOUT)
+        timeout = WEBSOCKET_MAX_POLL_TIMEOUT;
+    if (wsctx->resolving && timeout > WEBSOCKET_RESOLVE_INTERVAL)
+        timeout = WEBSOCKET_RESOLVE_INTERVAL;
+
+    return lws_service_adjust_timeout(wsctx->lwsctx, timeout, 0);
+}
+
+bool
+fmp4_transport_websocket_service_fd(fmp4_transport_context_t  ctx,
+                                    struct pollfd            *pollfd,
+                                    fmp4box_function_t        callback,
+                                    void                     *userdata,
+                                    error_context_t          *errctx)
+{
+    context_t *wsctx = (context_t *)(ctx);
+    int        ret   = 0;
+
+    /* Sanity checks */
+    if (!wsctx || !callback || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->lwsctx || wsctx->pooled, errctx, EINVAL,
+            false);
+
+    /* Prepare WebSocket context for WebSocket callback invocation */
+    wsctx->callback = callback;
+    wsctx->userdata = userdata;
+    wsctx->errctx = errctx;
+
+    /* Service the ready socket, or timeouts & forced service without one */
+    websocket_resolve_poll(wsctx);
+    ret = lws_service_fd(wsctx->lwsctx, pollfd);
+    if (ret >= 0 && !pollfd && !lws_service_adjust_timeout(wsctx->lwsctx, 1, 0))
+        ret = lws_service_tsi(wsctx->lwsctx, -1, 0);
+    error_save_retval_if(ret < 0 || wsctx->error, errctx, ENOTCONN, false);
+
+    return true;
+}
+
+bool
+fmp4_transport_websocket_flow(fmp4_transport_context_t  ctx,
+                              bool                      receive,
+                              error_context_t          *errctx)
+{
+    context_t *wsctx = (context_t *)(ctx);
+
+    /* Sanity checks */
+    if (!wsctx || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+    error_save_retval_if(!wsctx->wsi, errctx, ENOTCONN, false);
+
+    /* Stop or resume reading, the server is pushed back by TCP meanwhile,
+     * a stream over the memory budget resumes once back within it */
+    error_save_retval_if(lws_rx_flow_control(wsctx->wsi,
+                receive && !wsctx->throttled ? 1 : 0) < 0, errctx, EIO, false);
+    wsctx->paused = !receive;
+
+    return true;
+}
+
+bool
+fmp4_transport_websocket_option(fmp4_transport_context_t  ctx,
+                                fmp4_option_t             option,
+                                int64_t                  *value,
+                                bool                      set,
+                                error_context_t          *errctx)
+{
+    context_t *wsctx = (context_t *)(ctx);
+
+    /* Sanity checks */
+    if (!wsctx || !value || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    switch (option)
+    {
+        case FMP4_OPTION_RX_BUFFER_SIZE:
+            if (!set)
+            {
+                *value = (int64_t)(wsctx->rx_buffer_size);
+                return true;
+            }
+            error_save_retval_if(*value < 0 ||
+                    *value > WEBSOCKET_MAX_RX_BUFFER_SIZE, errctx, EINVAL,
+                    false);
+            wsctx->rx_buffer_size = (size_t)(*value);
+            return true;
+        default: break;
+    }
+
+    error_save_retval(errctx, ENOPROTOOPT, false);
+}
+
+bool
+fmp4_transport_websocket_prewarm(const char      *url,
+                                 error_context_t *errctx)
+{
+    char     *hostname = NULL;
+    char     *path     = NULL;
+    uint32_t  port     = 0;
+    bool      result   = false;
+
+    /* Sanity checks */
+    if (!url || !errctx)
+        error_save_retval(errctx, EINVAL, false);
+
+    /* Plain ws:// streams have no TLS state to warm up */
+    if (strncmp(url, "wss://", sizeof("wss://") - 1) != 0)
+        return true;
+
+    /* Handshake with the server, filling the shared session cache */
+    websocket_parse_url(url, NULL, &hostname, &port, &path);
+    if (!hostname || !port || !path)
+        error_save_jump(errctx, ENOMEM, CLEANUP);
+    result = tls_prewarm(hostname, port, errctx);
+
+CLEANUP:
+
+    FREE_AND_NULLIFY(path);
+    FREE_AND_NULLIFY(hostname);
+
+    return result;
 }
 
 void
-websocket_parse_url(const char  *url,
-                    char       **hostname,
-                    uint32_t    *port,
-                    char       **path)
+websocket_setup_protocols(struct lws_protocols  *protocols,
+                          lws_callback_function *callback,
+                          void                  *user)
+{
+    static const char *names[WEBSOCKET_RX_CLASSES] =
+        { "", "fmp4-rx-256k", "fmp4-rx-1m", "fmp4-rx-4m" };
+    size_t             idx = 0;
+
+    /* One protocol per rx buffer class, a connection binds to its class by
+     * name, the first is the default one */
+    memset(protocols, 0, (WEBSOCKET_RX_CLASSES + 1) *
+            sizeof(struct lws_protocols));
+    for (idx = 0; idx < WEBSOCKET_RX_CLASSES; idx++)
+    {
+        protocols[idx].name = names[idx];
+        protocols[idx].callback = callback;
+        protocols[idx].rx_buffer_size = (size_t)(WEBSOCKET_RX_BUFFER_SIZE) <<
+            (2 * idx);
+        protocols[idx].user = user;
+    }
+}
+
+bool websocket_throttle(context_t *wsctx, struct lws *wsi)
 {
-    const char *host_head = NULL;
-    const char *host_tail = NULL;
-    const char *port_head = NULL;
-    const char *port_tail = NULL;
-    const char *path_head = NULL;
+    /* Stop reading between boxes while the slab pool is over budget, a box
+     * being staged still completes so its buffer can go back */
+    if (wsctx->throttled || (wsctx->assembler).length || !slab_over_budget())
+        return true;
+    if (lws_rx_flow_control(wsi, 0) < 0)
+        return false;
+    wsctx->throttled = true;
+    lws_sul_schedule(lws_get_context(wsi), 0, &(wsctx->throttle),
+            websocket_throttle_retry,
+            WEBSOCKET_THROTTLE_INTERVAL * LWS_US_PER_MS);
+
+    return true;
+}
+
+bool
+websocket_track_pollfd(struct lws                *wsi,
+                       enum lws_callback_reasons  reason,
+                       const void                *in)
+{
+    const struct lws_pollargs *args  = (const struct lws_pollargs *)(in);
+    context_t                 *wsctx = NULL;
+    struct pollfd             *grown = NULL;
+    size_t                     idx   = 0;
+
+    if (reason != LWS_CALLBACK_ADD_POLL_FD &&
+        reason != LWS_CALLBACK_DEL_POLL_FD &&
+        reason != LWS_CALLBACK_CHANGE_MODE_POLL_FD)
+        return false;
+
+    /* Only private event loops have their stream as context user */
+    wsctx = (context_t *)(lws_context_user(lws_get_context(wsi)));
+    if (!wsctx || !args)
+        return true;
+    for (idx = 0; idx < wsctx->pollfd_count; idx++)
+    {
+        if ((wsctx->pollfds)[idx].fd == args->fd)
+            break;
+    }
+
+    switch (reason)
+    {
+        case LWS_CALLBACK_ADD_POLL_FD:
+            if (idx == wsctx->pollfd_count &&
+                wsctx->pollfd_count == wsctx->pollfd_capacity)
+            {
+                grown = (struct pollfd *)(realloc(wsctx->pollfds,
+                            (wsctx->pollfd_capacity + 4) *
+                            sizeof(struct pollfd)));
+                if (!grown)
+                {
+                    wsctx->error = true;
+                    break;
+                }
+                wsctx->pollfds = grown;
+                wsctx->pollfd_capacity += 4;
+            }
+            if (idx == wsctx->pollfd_count)
+                (wsctx->pollfd_count)++;
+            (wsctx->pollfds)[idx].fd = args->fd;
+            (wsctx->pollfds)[idx].events = (short)(args->events);
+            (wsctx->pollfds)[idx].revents = 0;
+        break;
+        case LWS_CALLBACK_DEL_POLL_FD:
+            if (idx < wsctx->pollfd_count)
+                (wsctx->pollfds)[idx] =
+                    (wsctx->pollfds)[--(wsctx->pollfd_count)];
+        break;
+        case LWS_CALLBACK_CHANGE_MODE_POLL_FD:
+            if (idx < wsctx->pollfd_count)
+                (wsctx->pollfds)[idx].events = (short)(args->events);
+        break;
+        default: break;
+    }
+
+    return true;
+}
+
+void
+websocket_parse_url(const char    *url,
+                    fmp4_arena_t  *arena,
+                    char         **hostname,
+                    uint32_t      *port,
+                    char         **path)
+{
+    error_context_t  errctx    = {};
+    const char      *host_head = NULL;
+    const char      *host_tail = NULL;
+    const char      *port_head = NULL;
+    const char      *port_tail = NULL;
+    const char      *path_head = NULL;
 
     /* Sanity checks */
     if (!url || !hostname || !port || !path)
@@ -228,9 +726,10 @@ websocket_parse_url(const char  *url,
         port_tail = path_head;
     }
 
-    /* Copy portions */
-    asprintf(hostname, "%.*s", (int)(host_tail - host_head), host_head);
-    asprintf(path, "%s", path_head);
+    /* Copy portions, into the arena if given or else the heap */
+    *hostname = fmp4_arena_strndup(arena, host_head,
+            (size_t)(host_tail - host_head), &errctx);
+    *path = fmp4_arena_strndup(arena, path_head, MAX_STR_LEN, &errctx);
 
     /* Parse port to int */
     if (port_head)
@@ -249,21 +748,18 @@ websocket_parse_url(const char  *url,
 }
 
 static fmp4_transport_context_t
-fmp4_transport_websocket_context(error_context_t *errctx)
+fmp4_transport_websocket_context(fmp4_arena_t    *arena,
+                                 error_context_t *errctx)
 {
-    /* Allocate WebSocket context */
-    context_t *wsctx = (context_t *)(calloc(1, sizeof(context_t)));
-    error_save_retval_if(!wsctx, errctx, errno, NULL);
+    /* Allocate WebSocket context from the stream arena */
+    context_t *wsctx = (context_t *)(fmp4_arena_alloc(arena,
+                sizeof(context_t), errctx));
+    if (!wsctx)
+        return NULL;
 
     /* Setup WebSocket protocols */
-    (wsctx->protocols)[0].name = "";
-    (wsctx->protocols)[0].callback = websocket_event_handler;
-    (wsctx->protocols)[0].per_session_data_size = sizeof(context_t);
-    (wsctx->protocols)[0].rx_buffer_size = 4 * 1024 * 1024;
-    (wsctx->protocols)[0].id = 0;
-    (wsctx->protocols)[0].user = NULL;
-    (wsctx->protocols)[0].tx_packet_size = 0;
-    (wsctx->protocols)[0].user = wsctx;
+    websocket_setup_protocols(wsctx->protocols, websocket_event_handler,
+            wsctx);
 
     return (fmp4_transport_context_t)(wsctx);
 }
@@ -304,16 +800,25 @@ websocket_event_handler(struct lws                *wsi,
     if (!wsi)
         return 0;
 
+    /* Socket events of the private event loop carry no stream */
+    if (websocket_track_pollfd(wsi, reason, in))
+        return 0;
+
     /* Obtain WebSocket protocol context */
     protocol = lws_get_protocol(wsi);
     if (!protocol)
         return 0;
 
-    /* Obtain WebSocket internal user context */
-    wsctx = (context_t *)(protocol->user);
+    /* Obtain WebSocket internal user context, from the wsi if bound */
+    wsctx = (context_t *)(data ? data : protocol->user);
     if (!wsctx)
         return 0;
 
+    /* Connections closed for a reconnect were unbound, their late events
+     * must not reach the stream, even while the next one awaits its host */
+    if (!data && wsctx->wsi != wsi && reason != LWS_CALLBACK_PROTOCOL_DESTROY)
+        return 0;
+
     /* Handle WebSocket event based on reason */
     switch (reason)
     {
@@ -321,14 +826,32 @@ websocket_event_handler(struct lws                *wsi,
             wsctx->connected = true;
         break;
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            if (!websocket_traverse_frame(wsctx, frame, length, wsctx->errctx))
+            if (!websocket_traverse_frame(wsctx, wsi, frame, length,
+                        wsctx->errctx))
                 return -1;
             (wsctx->response_count)++;
         break;
-        case LWS_CALLBACK_CLOSED:
-        case LWS_CALLBACK_PROTOCOL_DESTROY:
         case LWS_CALLBACK_WSI_DESTROY:
+            if (wsctx->wsi == wsi)
+                wsctx->wsi = NULL;
+            wsctx->connected = false;
+            wsctx->error = true;
+            if (wsctx->pooled)
+                error_save(wsctx->errctx, ECONNRESET);
+            return -1;
+        case LWS_CALLBACK_CLOSED:
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            /* Pooled streams are not waited on, their errctx tells the
+             * owner the connection dropped. A cached address which could
+             * not be connected to is looked up again next time */
+            wsctx->error = true;
+            if (reason == LWS_CALLBACK_CLIENT_CONNECTION_ERROR)
+                dns_evict(wsctx->hostname, wsctx->address);
+            if (wsctx->pooled)
+                error_save(wsctx->errctx, reason == LWS_CALLBACK_CLOSED ?
+                        ECONNRESET : ECONNREFUSED);
+            return -1;
+        case LWS_CALLBACK_PROTOCOL_DESTROY:
             wsctx->error = true;
             return -1;
         default: break;
@@ -337,34 +860,152 @@ websocket_event_handler(struct lws                *wsi,
     return 0;
 }
 
+static int
+websocket_loop_handler(struct lws                *wsi,
+                       enum lws_callback_reasons  reason,
+                       void                      *data,
+                       void                      *in,
+                       size_t                     length)
+{
+    const context_t *wsctx = (const context_t *)(data);
+
+    /* Events without a stream bound to the wsi are ignored */
+    if (!wsi || !wsctx)
+        return 0;
+
+    /* Dispatch to the event handler of the owning stream's transport */
+    return (wsctx->protocols)[0].callback(wsi, reason, data, in, length);
+}
+
 static bool
-websocket_traverse_frame(const context_t *wsctx,
+websocket_traverse_frame(context_t       *wsctx,
+                         struct lws      *wsi,
                          const uint8_t   *frame,
                          size_t           length,
                          error_context_t *errctx)
 {
-    const fmp4_box_t *box = NULL;
-    const uint8_t   *end = frame + length;
-
     /* Sanity checks */
-    if (!wsctx || !frame || !wsctx->errctx || !wsctx->callback)
+    if (!wsctx || !wsi || !frame || !wsctx->errctx || !wsctx->callback)
         error_save_retval(errctx, EINVAL, false);
 
-    /* Check whether the frame is an event response or a FMP4 frame */
-    if (*frame == '{' && length < WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH)
-        return true;
+    /* Feed frame to the box assembler, which dispatches completed boxes */
+    return fmp4_assembler_feed(&(wsctx->assembler), frame, length,
+            lws_is_final_fragment(wsi), lws_remaining_packet_payload(wsi),
+            wsctx->callback, wsctx->userdata, wsctx->errctx) &&
+        websocket_throttle(wsctx, wsi);
+}
 
-    /* Parse all FMP4 boxes in this WebSocket frame */
-    #define NEXT_BOX_ADDRESS() ((const uint8_t *)(box) + ntohl(box->size))
-    for (box = (const fmp4_box_t *)(frame);
-         box < (const fmp4_box_t *)(end);
-         box = (const fmp4_box_t *)(NEXT_BOX_ADDRESS()))
+static bool websocket_client_connect(context_t *wsctx, error_context_t *errctx)
+{
+    error_context_t dnsctx = {};
+
+    /* Connect to the resolved address of the host, the host name still goes
+     * in the Host header & the SNI. Lookups never block the event loop, a
+     * loop timer asks again until the background lookup is done */
+    wsctx->resolving = false;
+    if (!dns_resolve(wsctx->hostname, wsctx->address, sizeof(wsctx->address),
+                &dnsctx))
     {
-        /* Invoke user-provided callback with FMP4 box */
-        if (!wsctx->callback(box, wsctx->userdata, wsctx->errctx))
-            error_save_retval(wsctx->errctx, errno, false);
+        error_save_retval_if(dnsctx.errnum != EINPROGRESS, errctx,
+                dnsctx.errnum, false);
+        wsctx->resolving = true;
+        lws_sul_schedule((wsctx->conn_info).context, 0, &(wsctx->resolve),
+                websocket_resolve_retry,
+                WEBSOCKET_RESOLVE_INTERVAL * LWS_US_PER_MS);
+        return true;
     }
+    (wsctx->conn_info).address = wsctx->address;
+
+    /* Connect WebSocket connection, client is stored in pwsi */
+    if (!lws_client_connect_via_info(&(wsctx->conn_info)))
+        error_save_retval(errctx, ENOTCONN, false);
 
     return true;
 }
 
+static void websocket_resolve_retry(lws_sorted_usec_list_t *sul)
+{
+    websocket_resolve_poll(lws_container_of(sul, context_t, resolve));
+}
+
+static void websocket_resolve_poll(context_t *wsctx)
+{
+    /* Start the pending connection, a failed lookup fails the stream */
+    if (!wsctx->resolving)
+        return;
+    lws_sul_cancel(&(wsctx->resolve));
+    if (!websocket_client_connect(wsctx, wsctx->errctx))
+        wsctx->error = true;
+}
+
+static void websocket_select_rx_class(context_t *wsctx)
+{
+    size_t wanted = 0;
+
+    /* Smallest class holding the set size, or else the staged box sizes
+     * seen so far, so that such boxes arrive whole from now on */
+    wanted = wsctx->rx_buffer_size ? wsctx->rx_buffer_size :
+        (wsctx->assembler).average;
+    wsctx->rx_class = 0;
+    while (wsctx->rx_class + 1 < WEBSOCKET_RX_CLASSES &&
+            (wsctx->protocols)[wsctx->rx_class].rx_buffer_size < wanted)
+        (wsctx->rx_class)++;
+    (wsctx->conn_info).local_protocol_name = wsctx->rx_class ?
+        (wsctx->protocols)[wsctx->rx_class].name : NULL;
+}
+
+static void websocket_throttle_retry(lws_sorted_usec_list_t *sul)
+{
+    context_t *wsctx = lws_container_of(sul, context_t, throttle);
+
+    /* Resume reads once the slab pool is back within budget, unless the
+     * consumer paused them meanwhile */
+    if (!wsctx->throttled || !wsctx->wsi)
+        return;
+    if (slab_over_budget())
+    {
+        lws_sul_schedule(lws_get_context(wsctx->wsi), 0, &(wsctx->throttle),
+                websocket_throttle_retry,
+                WEBSOCKET_THROTTLE_INTERVAL * LWS_US_PER_MS);
+        return;
+    }
+    wsctx->throttled = false;
+    if (!wsctx->paused && lws_rx_flow_control(wsctx->wsi, 1) < 0)
+        wsctx->error = true;
+}
+
+static void websocket_close(context_t *wsctx)
+{
+    /* Unbind the stream from the wsi so no more events reach it, then have
+     * the event loop close the connection asynchronously */
+    if (wsctx->wsi)
+    {
+        lws_set_wsi_user(wsctx->wsi, NULL);
+        lws_set_timeout(wsctx->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    }
+    lws_sul_cancel(&(wsctx->resolve));
+    lws_sul_cancel(&(wsctx->throttle));
+    wsctx->resolving = false;
+    wsctx->paused = false;
+    wsctx->throttled = false;
+    wsctx->wsi = NULL;
+    wsctx->connected = false;
+}
+
+static size_t websocket_socket_pollfd(context_t *wsctx, struct pollfd *pollfd)
+{
+    int fd = -1;
+
+    /* Reads unless paused, writes until connected, as the TCP connect &
+     * the handshakes need them, then while a write is pending */
+    if (!wsctx->wsi || (fd = lws_get_socket_fd(wsctx->wsi)) < 0)
+        return 0;
+    pollfd->fd = fd;
+    pollfd->events = wsctx->paused || wsctx->throttled ? 0 : POLLIN;
+    if (!wsctx->connected || wsctx->play_pending || wsctx->ping_pending ||
+            lws_partial_buffered(wsctx->wsi))
+        pollfd->events |= POLLOUT;
+    pollfd->revents = 0;
+
+    return 1;
+}
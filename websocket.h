@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <poll.h>
+
+#include "assembler.h"
 #include "common.h"
 #include "error.h"
 #include "fmp4.h"
@@ -17,7 +20,19 @@ extern "C"
 {
 #endif
 
-    #define WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH 1024
+    /* Control messages are told apart from boxes by the assembler */
+    #define WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH \
+        ASSEMBLER_MAX_CONTROL_MESSAGE_LENGTH
+    #define WEBSOCKET_MAX_POLL_TIMEOUT           1000
+    #define WEBSOCKET_DEFAULT_PING_INTERVAL      10000 // ms
+    #define WEBSOCKET_PING_SLOTS                 4
+    #define WEBSOCKET_MAX_ADDRESS_LENGTH         64
+    #define WEBSOCKET_RESOLVE_INTERVAL           10    // ms, host lookup polls
+    #define WEBSOCKET_RX_BUFFER_SIZE             (64 * 1024) // smallest class
+    #define WEBSOCKET_RX_CLASSES                 4     // 64 KB to 4 MB, x4 apart
+    #define WEBSOCKET_MAX_RX_BUFFER_SIZE \
+        (WEBSOCKET_RX_BUFFER_SIZE << (2 * (WEBSOCKET_RX_CLASSES - 1)))
+    #define WEBSOCKET_THROTTLE_INTERVAL          10    // ms, budget polls
 
     /* Internal WebSocket transport context */
     typedef struct context_t
@@ -25,7 +40,7 @@ extern "C"
         /* libwebsocket context */
         struct lws_context_creation_info  ctx_info;
         struct lws_client_connect_info    conn_info;
-        struct lws_protocols              protocols[2];
+        struct lws_protocols              protocols[WEBSOCKET_RX_CLASSES + 1];
         struct lws_context               *lwsctx;
         struct lws                       *wsi;
 
@@ -34,31 +49,104 @@ extern "C"
         void              *userdata;
         error_context_t   *errctx;
 
+        /* FMP4 box assembler */
+        fmp4_assembler_t assembler;
+
         /* WebSocket stream context */
         uint32_t request_count;
         uint32_t response_count;
         uint32_t ping_count;
         bool     connected;
         bool     error;
+        bool     pooled;
+        bool     paused;   // reads stopped by flow control
+
+        /* Rx buffer class of the connection */
+        size_t   rx_buffer_size; // 0 picks the class on connect
+        size_t   rx_class;
+
+        /* Reads stopped while the slab pool is over budget */
+        lws_sorted_usec_list_t throttle;
+        bool                   throttled;
+
+        /* Control messages, formatted after the LWS_PRE headroom */
+        uint8_t  control[LWS_PRE + WEBSOCKET_MAX_CONTROL_MESSAGE_LENGTH];
+        bool     play_pending;
+        bool     ping_pending;
+        int64_t  ping_interval;                  // us, 0 disables PINGs
+        uint32_t ping_ids[WEBSOCKET_PING_SLOTS];  // requestIds in flight
+        int64_t  ping_sent[WEBSOCKET_PING_SLOTS]; // monotonic us, 0 if free
+        int64_t  ping_rtt;                       // us, -1 until answered
+
+        /* Sockets of the private event loop & their wanted events */
+        struct pollfd *pollfds;
+        size_t         pollfd_count;
+        size_t         pollfd_capacity;
 
         /* URL context */
         char     *url;
         char     *hostname;
         char     *path;
         uint32_t  port;
+        char      address[WEBSOCKET_MAX_ADDRESS_LENGTH]; // resolved hostname
+
+        /* Background host lookup, the connection starts once it is done */
+        lws_sorted_usec_list_t resolve;
+        bool                   resolving;
 
     } context_t;
 
+    /* Shared WebSocket event loop, dispatches to streams by wsi user data */
+    typedef struct websocket_loop_t
+    {
+        struct lws_context_creation_info  ctx_info;
+        struct lws_protocols              protocols[WEBSOCKET_RX_CLASSES + 1];
+        struct lws_context               *lwsctx;
+
+    } websocket_loop_t;
+
     /* Public exported functions */
     bool fmp4_transport_websocket_init(fmp4_transport_context_t  ctx,
-            const char *url, error_context_t *errctx);
+            const char *url, fmp4_arena_t *arena, error_context_t *errctx);
     bool fmp4_transport_websocket_connect(fmp4_transport_context_t ctx,
             error_context_t *errctx);
+    bool fmp4_transport_websocket_connect_start(fmp4_transport_context_t ctx,
+            error_context_t *errctx);
+    bool fmp4_transport_websocket_connect_service(fmp4_transport_context_t ctx,
+            struct pollfd *pollfd, error_context_t *errctx);
     bool fmp4_transport_websocket_recv(fmp4_transport_context_t ctx,
             fmp4box_function_t callback, void *userdata, error_context_t *errctx);
     void fmp4_transport_websocket_fini(fmp4_transport_context_t ctx);
-    void websocket_parse_url(const char *url, char **hostname,
-            uint32_t *port, char **path);
+    fmp4_transport_loop_t fmp4_transport_websocket_loop_create(
+            error_context_t *errctx);
+    bool fmp4_transport_websocket_loop_service(fmp4_transport_loop_t loop,
+            int timeout, error_context_t *errctx);
+    void fmp4_transport_websocket_loop_destroy(fmp4_transport_loop_t loop);
+    bool fmp4_transport_websocket_attach(fmp4_transport_context_t ctx,
+            fmp4_transport_loop_t loop, fmp4box_function_t callback,
+            void *userdata, error_context_t *errctx);
+    void fmp4_transport_websocket_detach(fmp4_transport_context_t ctx);
+    bool fmp4_transport_websocket_pollfds(fmp4_transport_context_t ctx,
+            struct pollfd *pollfds, size_t *count, error_context_t *errctx);
+    int fmp4_transport_websocket_next_timeout(fmp4_transport_context_t ctx,
+            int timeout);
+    bool fmp4_transport_websocket_service_fd(fmp4_transport_context_t ctx,
+            struct pollfd *pollfd, fmp4box_function_t callback, void *userdata,
+            error_context_t *errctx);
+    bool fmp4_transport_websocket_flow(fmp4_transport_context_t ctx,
+            bool receive, error_context_t *errctx);
+    bool fmp4_transport_websocket_option(fmp4_transport_context_t ctx,
+            fmp4_option_t option, int64_t *value, bool set,
+            error_context_t *errctx);
+    bool fmp4_transport_websocket_prewarm(const char *url,
+            error_context_t *errctx);
+    void websocket_setup_protocols(struct lws_protocols *protocols,
+            lws_callback_function *callback, void *user);
+    bool websocket_throttle(context_t *wsctx, struct lws *wsi);
+    bool websocket_track_pollfd(struct lws *wsi,
+            enum lws_callback_reasons reason, const void *in);
+    void websocket_parse_url(const char *url, fmp4_arena_t *arena,
+            char **hostname, uint32_t *port, char **path);
 
 #ifdef __cplusplus
 }